@@ -23,6 +23,8 @@ static char *ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_set_shm_interleave(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -31,6 +33,14 @@ static void ngx_unload_module(void *data);
 #endif
 
 
+static ngx_conf_enum_t  ngx_huge_pages[] = {
+    { ngx_string("off"), NGX_HUGE_PAGES_OFF },
+    { ngx_string("on"), NGX_HUGE_PAGES_ON },
+    { ngx_string("transparent"), NGX_HUGE_PAGES_TRANSPARENT },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_conf_enum_t  ngx_debug_points[] = {
     { ngx_string("stop"), NGX_DEBUG_POINTS_STOP },
     { ngx_string("abort"), NGX_DEBUG_POINTS_ABORT },
@@ -110,6 +120,27 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("worker_numa"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, numa),
+      NULL },
+
+    { ngx_string("shared_memory_interleave"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_1MORE,
+      ngx_set_shm_interleave,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("huge_pages"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_core_conf_t, huge_pages),
+      &ngx_huge_pages },
+
     { ngx_string("worker_rlimit_nofile"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -131,6 +162,20 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, shutdown_timeout),
       NULL },
 
+    { ngx_string("reload_keep_workers"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, reload_keep_workers),
+      NULL },
+
+    { ngx_string("connection_handoff"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, connection_handoff),
+      NULL },
+
     { ngx_string("working_directory"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -1016,15 +1061,20 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->cpu_affinity_auto = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
+     *     ccf->shm_interleave = NULL;
      */
 
     ccf->daemon = NGX_CONF_UNSET;
     ccf->master = NGX_CONF_UNSET;
     ccf->timer_resolution = NGX_CONF_UNSET_MSEC;
     ccf->shutdown_timeout = NGX_CONF_UNSET_MSEC;
+    ccf->reload_keep_workers = NGX_CONF_UNSET;
+    ccf->connection_handoff = NGX_CONF_UNSET;
 
     ccf->worker_processes = NGX_CONF_UNSET;
     ccf->debug_points = NGX_CONF_UNSET;
+    ccf->numa = NGX_CONF_UNSET;
+    ccf->huge_pages = NGX_CONF_UNSET_UINT;
 
     ccf->rlimit_nofile = NGX_CONF_UNSET;
     ccf->rlimit_core = NGX_CONF_UNSET;
@@ -1051,10 +1101,25 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ccf->master, 1);
     ngx_conf_init_msec_value(ccf->timer_resolution, 0);
     ngx_conf_init_msec_value(ccf->shutdown_timeout, 0);
+    ngx_conf_init_value(ccf->reload_keep_workers, 0);
+    ngx_conf_init_value(ccf->connection_handoff, 0);
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
 
+#if !(NGX_HAVE_NUMA)
+
+    if (ccf->numa == 1) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"worker_numa\" is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
+
+    ngx_conf_init_value(ccf->numa, 0);
+    ngx_conf_init_uint_value(ccf->huge_pages, NGX_HUGE_PAGES_OFF);
+
 #if (NGX_HAVE_CPU_AFFINITY)
 
     if (!ccf->cpu_affinity_auto
@@ -1402,6 +1467,61 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_set_shm_interleave(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_HAVE_NUMA)
+    ngx_core_conf_t  *ccf = conf;
+
+    ngx_str_t        *value, *name;
+    ngx_uint_t        i;
+
+    if (ccf->shm_interleave) {
+        return "is duplicate";
+    }
+
+    ccf->shm_interleave = ngx_array_create(cf->pool, cf->args->nelts,
+                                           sizeof(ngx_str_t));
+    if (ccf->shm_interleave == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "all") == 0) {
+
+        if (cf->args->nelts > 2) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid number of arguments in "
+                               "\"shared_memory_interleave\" directive");
+            return NGX_CONF_ERROR;
+        }
+
+        /* an empty list means all zones */
+
+        return NGX_CONF_OK;
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+        name = ngx_array_push(ccf->shm_interleave);
+        if (name == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *name = value[i];
+    }
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"shared_memory_interleave\" is not supported "
+                       "on this platform, ignored");
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 ngx_cpuset_t *
 ngx_get_cpu_affinity(ngx_uint_t n)
 {
@@ -1409,6 +1529,9 @@ ngx_get_cpu_affinity(ngx_uint_t n)
     ngx_uint_t        i, j;
     ngx_cpuset_t     *mask;
     ngx_core_conf_t  *ccf;
+#if (NGX_HAVE_NUMA)
+    ngx_int_t         cpu;
+#endif
 
     static ngx_cpuset_t  result;
 
@@ -1422,6 +1545,21 @@ ngx_get_cpu_affinity(ngx_uint_t n)
     if (ccf->cpu_affinity_auto) {
         mask = &ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
 
+#if (NGX_HAVE_NUMA)
+
+        if (ccf->numa && ngx_numa_nodes > 1) {
+            cpu = ngx_numa_auto_cpu(mask, n);
+
+            if (cpu != NGX_ERROR) {
+                CPU_ZERO(&result);
+                CPU_SET(cpu, &result);
+
+                return &result;
+            }
+        }
+
+#endif
+
         for (i = 0, j = n; /* void */ ; i++) {
 
             if (CPU_ISSET(i % CPU_SETSIZE, mask) && j-- == 0) {
@@ -1508,6 +1646,8 @@ ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&file);
+
     cln = ngx_pool_cleanup_add(cf->cycle->pool, 0);
     if (cln == NULL) {
         return NGX_CONF_ERROR;
@@ -75,6 +75,9 @@ typedef ngx_int_t (*ngx_output_chain_filter_pt)(void *ctx, ngx_chain_t *in);
 typedef void (*ngx_output_chain_aio_pt)(ngx_output_chain_ctx_t *ctx,
     ngx_file_t *file);
 
+typedef ngx_int_t (*ngx_output_chain_prefetch_pt)(ngx_output_chain_ctx_t *ctx,
+    ngx_file_t *file, off_t offset, off_t size);
+
 struct ngx_output_chain_ctx_s {
     ngx_buf_t                   *buf;
     ngx_chain_t                 *in;
@@ -87,6 +90,7 @@ struct ngx_output_chain_ctx_s {
     unsigned                     need_in_memory:1;
     unsigned                     need_in_temp:1;
     unsigned                     aio:1;
+    unsigned                     prefetch_cleanup:1;
 
 #if (NGX_HAVE_FILE_AIO || NGX_COMPAT)
     ngx_output_chain_aio_pt      aio_handler;
@@ -103,6 +107,15 @@ struct ngx_output_chain_ctx_s {
 
     off_t                        alignment;
 
+    off_t                        prefetch;
+    off_t                        prefetch_window;
+    off_t                        prefetch_last;
+    off_t                        prefetch_end;
+    off_t                        prefetch_ahead;
+    size_t                       prefetch_budget;
+    ngx_file_t                  *prefetch_file;
+    ngx_output_chain_prefetch_pt prefetch_handler;
+
     ngx_pool_t                  *pool;
     ngx_int_t                    allocated;
     ngx_bufs_t                   bufs;
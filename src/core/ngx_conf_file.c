@@ -7,6 +7,7 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_md5.h>
 
 #define NGX_CONF_BUFFER  4096
 
@@ -14,6 +15,7 @@ static ngx_int_t ngx_conf_add_dump(ngx_conf_t *cf, ngx_str_t *filename);
 static ngx_int_t ngx_conf_handler(ngx_conf_t *cf, ngx_int_t last);
 static ngx_int_t ngx_conf_read_token(ngx_conf_t *cf);
 static void ngx_conf_flush_files(ngx_cycle_t *cycle);
+static void ngx_conf_digest_args(ngx_conf_t *cf, ngx_int_t rc);
 
 
 static ngx_command_t  ngx_conf_commands[] = {
@@ -45,6 +47,21 @@ ngx_module_t  ngx_conf_module = {
 };
 
 
+/*
+ * the digest of the configuration being parsed, see ngx_init_cycle();
+ * it is set only in the master process while the configuration is read
+ */
+
+void  *ngx_conf_digest_ctx;
+
+/*
+ * set by modules which load files that cannot be added to the digest,
+ * e.g., perl modules with their dependencies
+ */
+
+ngx_uint_t  ngx_conf_digest_untracked;
+
+
 /* The eight fixed arguments */
 
 static ngx_uint_t argument_number[] = {
@@ -255,6 +272,13 @@ ngx_conf_parse(ngx_conf_t *cf, ngx_str_t *filename)
             goto done;
         }
 
+        if (rc == NGX_OK
+            || rc == NGX_CONF_BLOCK_START
+            || rc == NGX_CONF_BLOCK_DONE)
+        {
+            ngx_conf_digest_args(cf, rc);
+        }
+
         if (rc == NGX_CONF_BLOCK_DONE) {
 
             if (type != parse_block) {
@@ -876,6 +900,72 @@ ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static void
+ngx_conf_digest_args(ngx_conf_t *cf, ngx_int_t rc)
+{
+    u_char      c;
+    ngx_str_t  *arg;
+    ngx_uint_t  i;
+
+    if (ngx_conf_digest_ctx == NULL) {
+        return;
+    }
+
+    arg = cf->args->elts;
+
+    for (i = 0; i < cf->args->nelts; i++) {
+        ngx_conf_digest(&arg[i].len, sizeof(size_t));
+        ngx_conf_digest(arg[i].data, arg[i].len);
+    }
+
+    c = (rc == NGX_OK) ? ';' : ((rc == NGX_CONF_BLOCK_START) ? '{' : '}');
+
+    ngx_conf_digest(&c, 1);
+}
+
+
+void
+ngx_conf_digest(void *data, size_t len)
+{
+    if (ngx_conf_digest_ctx) {
+        ngx_md5_update(ngx_conf_digest_ctx, data, len);
+    }
+}
+
+
+void
+ngx_conf_digest_file(ngx_str_t *name)
+{
+    time_t            mtime;
+    off_t             size;
+    ngx_file_uniq_t   uniq;
+    ngx_file_info_t   fi;
+
+    if (ngx_conf_digest_ctx == NULL) {
+        return;
+    }
+
+    /*
+     * the name is null-terminated by ngx_conf_full_name(),
+     * as well as the directive arguments
+     */
+
+    ngx_conf_digest(name->data, name->len + 1);
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        return;
+    }
+
+    uniq = ngx_file_uniq(&fi);
+    size = ngx_file_size(&fi);
+    mtime = ngx_file_mtime(&fi);
+
+    ngx_conf_digest(&uniq, sizeof(ngx_file_uniq_t));
+    ngx_conf_digest(&size, sizeof(off_t));
+    ngx_conf_digest(&mtime, sizeof(time_t));
+}
+
+
 ngx_int_t
 ngx_conf_full_name(ngx_cycle_t *cycle, ngx_str_t *name, ngx_uint_t conf_prefix)
 {
@@ -272,6 +272,8 @@ char *ngx_conf_include(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 ngx_int_t ngx_conf_full_name(ngx_cycle_t *cycle, ngx_str_t *name,
     ngx_uint_t conf_prefix);
+void ngx_conf_digest(void *data, size_t len);
+void ngx_conf_digest_file(ngx_str_t *name);
 ngx_open_file_t *ngx_conf_open_file(ngx_cycle_t *cycle, ngx_str_t *name);
 void ngx_cdecl ngx_conf_log_error(ngx_uint_t level, ngx_conf_t *cf,
     ngx_err_t err, const char *fmt, ...);
@@ -292,4 +294,8 @@ char *ngx_conf_set_enum_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 char *ngx_conf_set_bitmask_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
+extern void        *ngx_conf_digest_ctx;
+extern ngx_uint_t   ngx_conf_digest_untracked;
+
+
 #endif /* _NGX_CONF_FILE_H_INCLUDED_ */
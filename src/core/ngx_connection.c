@@ -954,6 +954,141 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+void
+ngx_set_listening_cpu(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+#if (NGX_HAVE_CPU_AFFINITY)
+
+    int                  cpu;
+    ngx_uint_t           k, n;
+    ngx_cpuset_t        *mask;
+    ngx_core_conf_t     *ccf;
+    struct sock_fprog    prog;
+    struct sock_filter  *code, *p;
+
+    mask = ngx_get_cpu_affinity(ls->worker);
+
+    if (mask == NULL) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"incoming_cpu\" on %V requires "
+                      "\"worker_cpu_affinity\", ignored", &ls->addr_text);
+        return;
+    }
+
+#ifdef SO_INCOMING_CPU
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, mask)) {
+            break;
+        }
+    }
+
+    if (cpu < CPU_SETSIZE
+        && setsockopt(ls->fd, SOL_SOCKET, SO_INCOMING_CPU,
+                      (const void *) &cpu, sizeof(int))
+           == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_INCOMING_CPU) %V failed, ignored",
+                      &ls->addr_text);
+    }
+
+#endif
+
+    if (ls->worker != 0) {
+        return;
+    }
+
+    /*
+     * the program is attached to the whole reuseport group by worker 0;
+     * it maps the CPU which received a packet to the index of the socket
+     * of the worker bound to this CPU, sockets join the group in the order
+     * of workers as they are opened by ngx_open_listening_sockets()
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    n = 2;
+
+    for (k = 0; k < (ngx_uint_t) ccf->worker_processes; k++) {
+
+        mask = ngx_get_cpu_affinity(k);
+        if (mask == NULL) {
+            continue;
+        }
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, mask)) {
+                n += 2;
+            }
+        }
+    }
+
+    if (n > BPF_MAXINSNS) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "too many CPUs for \"incoming_cpu\" on %V, ignored",
+                      &ls->addr_text);
+        return;
+    }
+
+    code = ngx_alloc(n * sizeof(struct sock_filter), cycle->log);
+    if (code == NULL) {
+        return;
+    }
+
+    p = code;
+
+    *p++ = (struct sock_filter)
+               BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    for (k = 0; k < (ngx_uint_t) ccf->worker_processes; k++) {
+
+        mask = ngx_get_cpu_affinity(k);
+        if (mask == NULL) {
+            continue;
+        }
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, mask)) {
+                *p++ = (struct sock_filter)
+                           BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, cpu, 0, 1);
+                *p++ = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, k);
+            }
+        }
+    }
+
+    /* an index out of the group range falls back to the hash */
+
+    *p = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0xffffffff);
+
+    prog.len = n;
+    prog.filter = code;
+
+    if (setsockopt(ls->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   (const void *) &prog, sizeof(struct sock_fprog))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %V failed, "
+                      "ignored", &ls->addr_text);
+    }
+
+    ngx_free(code);
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                  "\"incoming_cpu\" is not supported without "
+                  "\"worker_cpu_affinity\", ignored");
+
+#endif
+}
+
+#endif
+
+
 void
 ngx_close_listening_sockets(ngx_cycle_t *cycle)
 {
@@ -53,6 +53,12 @@ struct ngx_listening_s {
 
     ngx_uint_t          worker;
 
+    ngx_rbtree_t        rbtree;
+    ngx_rbtree_node_t   sentinel;
+
+    ngx_uint_t          sessions;
+    ngx_uint_t          max_sessions;
+
     unsigned            open:1;
     unsigned            remain:1;
     unsigned            ignore:1;
@@ -65,12 +71,14 @@ struct ngx_listening_s {
     unsigned            shared:1;    /* shared between threads or processes */
     unsigned            addr_ntop:1;
     unsigned            wildcard:1;
+    unsigned            handoff:1;     /* accepts idle connections handed off */
 
 #if (NGX_HAVE_INET6)
     unsigned            ipv6only:1;
 #endif
     unsigned            reuseport:1;
     unsigned            add_reuseport:1;
+    unsigned            incoming_cpu:1;
     unsigned            keepalive:2;
 
     unsigned            deferred_accept:1;
@@ -113,6 +121,13 @@ typedef enum {
 } ngx_connection_tcp_nopush_e;
 
 
+struct ngx_udp_connection_s {
+    ngx_rbtree_node_t   node;
+    ngx_connection_t   *connection;
+    ngx_buf_t          *buffer;
+};
+
+
 #define NGX_LOWLEVEL_BUFFERED  0x0f
 #define NGX_SSL_BUFFERED       0x01
 #define NGX_HTTP_V2_BUFFERED   0x02
@@ -146,6 +161,7 @@ struct ngx_connection_s {
 
     ngx_str_t           proxy_protocol_addr;
     in_port_t           proxy_protocol_port;
+    ngx_str_t          *proxy_protocol_tlvs;
 
 #if (NGX_SSL || NGX_COMPAT)
     ngx_ssl_connection_t  *ssl;
@@ -156,6 +172,8 @@ struct ngx_connection_s {
 
     ngx_buf_t          *buffer;
 
+    ngx_udp_connection_t  *udp;
+
     ngx_queue_t         queue;
 
     ngx_atomic_uint_t   number;
@@ -174,6 +192,7 @@ struct ngx_connection_s {
     unsigned            reusable:1;
     unsigned            close:1;
     unsigned            shared:1;
+    unsigned            handoff:1;
 
     unsigned            sendfile:1;
     unsigned            sndlowat:1;
@@ -189,6 +208,10 @@ struct ngx_connection_s {
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t  *sendfile_task;
 #endif
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    ngx_linux_zerocopy_t  *zerocopy;
+#endif
 };
 
 
@@ -209,6 +232,9 @@ ngx_int_t ngx_clone_listening(ngx_conf_t *cf, ngx_listening_t *ls);
 ngx_int_t ngx_set_inherited_sockets(ngx_cycle_t *cycle);
 ngx_int_t ngx_open_listening_sockets(ngx_cycle_t *cycle);
 void ngx_configure_listening_sockets(ngx_cycle_t *cycle);
+#if (NGX_HAVE_REUSEPORT_CBPF)
+void ngx_set_listening_cpu(ngx_cycle_t *cycle, ngx_listening_t *ls);
+#endif
 void ngx_close_listening_sockets(ngx_cycle_t *cycle);
 void ngx_close_connection(ngx_connection_t *c);
 void ngx_close_idle_connections(ngx_cycle_t *cycle);
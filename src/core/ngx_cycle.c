@@ -8,11 +8,18 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#include <ngx_md5.h>
 
 
 static void ngx_destroy_cycle_pools(ngx_conf_t *conf);
 static ngx_int_t ngx_init_zone_pool(ngx_cycle_t *cycle,
     ngx_shm_zone_t *shm_zone);
+#if (NGX_HAVE_NUMA)
+static void ngx_set_zone_numa_policy(ngx_cycle_t *cycle,
+    ngx_core_conf_t *ccf, ngx_shm_zone_t *zn);
+#endif
+static ngx_uint_t ngx_cycle_conf_unchanged(ngx_cycle_t *cycle,
+    ngx_cycle_t *old_cycle);
 static ngx_int_t ngx_test_lockfile(u_char *file, ngx_log_t *log);
 static void ngx_clean_old_cycles(ngx_event_t *ev);
 static void ngx_shutdown_timer_handler(ngx_event_t *ev);
@@ -42,6 +49,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     char               **senv;
     ngx_uint_t           i, n;
     ngx_log_t           *log;
+    ngx_md5_t            md5;
     ngx_time_t          *tp;
     ngx_conf_t           conf;
     ngx_pool_t          *pool;
@@ -266,18 +274,29 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     log->log_level = NGX_LOG_DEBUG_ALL;
 #endif
 
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, cycle->conf_param.data, cycle->conf_param.len);
+
+    ngx_conf_digest_ctx = &md5;
+    ngx_conf_digest_untracked = 0;
+
     if (ngx_conf_param(&conf) != NGX_CONF_OK) {
+        ngx_conf_digest_ctx = NULL;
         environ = senv;
         ngx_destroy_cycle_pools(&conf);
         return NULL;
     }
 
     if (ngx_conf_parse(&conf, &cycle->conf_file) != NGX_CONF_OK) {
+        ngx_conf_digest_ctx = NULL;
         environ = senv;
         ngx_destroy_cycle_pools(&conf);
         return NULL;
     }
 
+    ngx_conf_digest_ctx = NULL;
+    ngx_md5_final(cycle->conf_digest, &md5);
+
     if (ngx_test_config && !ngx_quiet_mode) {
         ngx_log_stderr(0, "the configuration file %s syntax is ok",
                        cycle->conf_file.data);
@@ -425,6 +444,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         }
 
         shm_zone[i].shm.log = cycle->log;
+        shm_zone[i].shm.huge_pages = ccf->huge_pages;
 
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
@@ -457,6 +477,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 && !shm_zone[i].noreuse)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.huge_pages = oshm_zone[n].shm.huge_pages;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
@@ -479,6 +500,10 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             goto failed;
         }
 
+#if (NGX_HAVE_NUMA)
+        ngx_set_zone_numa_policy(cycle, ccf, &shm_zone[i]);
+#endif
+
         if (ngx_init_zone_pool(cycle, &shm_zone[i]) != NGX_OK) {
             goto failed;
         }
@@ -748,6 +773,10 @@ old_shm_zone_done:
 
     if (ngx_process == NGX_PROCESS_MASTER || ngx_is_init_cycle(old_cycle)) {
 
+        if (!ngx_is_init_cycle(old_cycle)) {
+            cycle->conf_unchanged = ngx_cycle_conf_unchanged(cycle, old_cycle);
+        }
+
         ngx_destroy_pool(old_cycle->pool);
         cycle->old_cycle = NULL;
 
@@ -865,6 +894,114 @@ ngx_destroy_cycle_pools(ngx_conf_t *conf)
 }
 
 
+#if (NGX_HAVE_NUMA)
+
+static void
+ngx_set_zone_numa_policy(ngx_cycle_t *cycle, ngx_core_conf_t *ccf,
+    ngx_shm_zone_t *zn)
+{
+    ngx_str_t   *name;
+    ngx_uint_t   i;
+
+    if (ccf->shm_interleave == NULL) {
+        return;
+    }
+
+    /* the policy has to be set before the zone pages are touched */
+
+    name = ccf->shm_interleave->elts;
+
+    for (i = 0; i < ccf->shm_interleave->nelts; i++) {
+        if (name[i].len == zn->shm.name.len
+            && ngx_strncmp(name[i].data, zn->shm.name.data, name[i].len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (ccf->shm_interleave->nelts && i == ccf->shm_interleave->nelts) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "interleave shared zone \"%V\"", &zn->shm.name);
+
+    ngx_numa_interleave(zn->shm.addr, zn->shm.size, cycle->log);
+}
+
+#endif
+
+
+static ngx_uint_t
+ngx_cycle_conf_unchanged(ngx_cycle_t *cycle, ngx_cycle_t *old_cycle)
+{
+    ngx_uint_t        i, n;
+    ngx_listening_t  *ls;
+    ngx_shm_zone_t   *shm_zone, *oshm_zone;
+    ngx_list_part_t  *part, *opart;
+
+    if (ngx_conf_digest_untracked) {
+        return 0;
+    }
+
+    if (ngx_memcmp(cycle->conf_digest, old_cycle->conf_digest, 16) != 0) {
+        return 0;
+    }
+
+    /* the listening sockets have to be inherited as is */
+
+    if (cycle->listening.nelts != old_cycle->listening.nelts) {
+        return 0;
+    }
+
+    ls = cycle->listening.elts;
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+        if (ls[i].previous == NULL) {
+            return 0;
+        }
+    }
+
+    /* and the shared memory zones have to be reused */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        opart = &old_cycle->shared_memory.part;
+        oshm_zone = opart->elts;
+
+        for (n = 0; /* void */ ; n++) {
+
+            if (n >= opart->nelts) {
+                if (opart->next == NULL) {
+                    return 0;
+                }
+                opart = opart->next;
+                oshm_zone = opart->elts;
+                n = 0;
+            }
+
+            if (shm_zone[i].shm.addr == oshm_zone[n].shm.addr) {
+                break;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
 static ngx_int_t
 ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
@@ -1268,6 +1405,7 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->shm.size = size;
     shm_zone->shm.name = *name;
     shm_zone->shm.exists = 0;
+    shm_zone->shm.huge_pages = NGX_HUGE_PAGES_OFF;
     shm_zone->init = NULL;
     shm_zone->tag = tag;
     shm_zone->noreuse = 0;
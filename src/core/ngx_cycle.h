@@ -80,6 +80,9 @@ struct ngx_cycle_s {
     ngx_str_t                 prefix;
     ngx_str_t                 lock_file;
     ngx_str_t                 hostname;
+
+    u_char                    conf_digest[16];
+    ngx_uint_t                conf_unchanged;  /* unsigned  conf_unchanged:1; */
 };
 
 
@@ -89,6 +92,8 @@ typedef struct {
 
     ngx_msec_t                timer_resolution;
     ngx_msec_t                shutdown_timeout;
+    ngx_flag_t                reload_keep_workers;
+    ngx_flag_t                connection_handoff;
 
     ngx_int_t                 worker_processes;
     ngx_int_t                 debug_points;
@@ -102,6 +107,11 @@ typedef struct {
     ngx_uint_t                cpu_affinity_n;
     ngx_cpuset_t             *cpu_affinity;
 
+    ngx_flag_t                numa;
+    ngx_array_t              *shm_interleave;  /* of ngx_str_t */
+
+    ngx_uint_t                huge_pages;
+
     char                     *username;
     ngx_uid_t                 user;
     ngx_gid_t                 group;
@@ -117,6 +127,11 @@ typedef struct {
 } ngx_core_conf_t;
 
 
+#define NGX_HUGE_PAGES_OFF          0
+#define NGX_HUGE_PAGES_ON           1
+#define NGX_HUGE_PAGES_TRANSPARENT  2
+
+
 #define ngx_is_init_cycle(cycle)  (cycle->conf_ctx == NULL)
 
 
@@ -10,6 +10,9 @@
 
 
 static ngx_int_t ngx_test_full_name(ngx_str_t *name);
+#if (NGX_HAVE_DONTCACHE)
+static off_t ngx_temp_file_chain_size(ngx_chain_t *cl);
+#endif
 
 
 static ngx_atomic_t   temp_number = 0;
@@ -108,6 +111,8 @@ ngx_test_full_name(ngx_str_t *name)
 ssize_t
 ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
 {
+    off_t      dontcache;
+    ssize_t    n;
     ngx_int_t  rc;
 
     if (tf->file.fd == NGX_INVALID_FILE) {
@@ -124,18 +129,83 @@ ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
         }
     }
 
+#if (NGX_HAVE_DONTCACHE)
+
+    /*
+     * once a file grows beyond the "dontcache" threshold, the data written
+     * are dropped from the page cache, so large files do not push the hot
+     * set out of memory; the range starts at the previous write, as its
+     * pages might still have been under writeback when it was advised
+     */
+
+    if (tf->dontcache
+        && tf->offset + ngx_temp_file_chain_size(chain) >= tf->dontcache)
+    {
+        dontcache = tf->dontcache_offset;
+
+    } else
+
+#endif
+
+    dontcache = -1;
+
 #if (NGX_THREADS && NGX_HAVE_PWRITEV)
 
     if (tf->thread_write) {
-        return ngx_thread_write_chain_to_file(&tf->file, chain, tf->offset,
-                                              tf->pool);
+        n = ngx_thread_write_chain_to_file_dontcache(&tf->file, chain,
+                                                     tf->offset, dontcache,
+                                                     tf->pool);
+
+        if (n > 0 && dontcache != -1) {
+            tf->dontcache_offset = tf->offset;
+        }
+
+        return n;
+    }
+
+#endif
+
+    n = ngx_write_chain_to_file(&tf->file, chain, tf->offset, tf->pool);
+
+#if (NGX_HAVE_DONTCACHE)
+
+    if (n > 0 && dontcache != -1) {
+        if (ngx_dontcache(tf->file.fd, dontcache, tf->offset + n - dontcache)
+            == NGX_FILE_ERROR)
+        {
+            ngx_log_error(NGX_LOG_ALERT, tf->file.log, ngx_errno,
+                          ngx_dontcache_n " \"%s\" failed",
+                          tf->file.name.data);
+            tf->dontcache = 0;
+        }
+
+        tf->dontcache_offset = tf->offset;
     }
 
 #endif
 
-    return ngx_write_chain_to_file(&tf->file, chain, tf->offset, tf->pool);
+    return n;
+}
+
+
+#if (NGX_HAVE_DONTCACHE)
+
+static off_t
+ngx_temp_file_chain_size(ngx_chain_t *cl)
+{
+    off_t  size;
+
+    size = 0;
+
+    for ( /* void */ ; cl; cl = cl->next) {
+        size += cl->buf->last - cl->buf->pos;
+    }
+
+    return size;
 }
 
+#endif
+
 
 ngx_int_t
 ngx_create_temp_file(ngx_file_t *file, ngx_path_t *path, ngx_pool_t *pool,
@@ -45,6 +45,7 @@ struct ngx_file_s {
 typedef ngx_msec_t (*ngx_path_manager_pt) (void *data);
 typedef ngx_msec_t (*ngx_path_purger_pt) (void *data);
 typedef void (*ngx_path_loader_pt) (void *data);
+typedef ngx_int_t (*ngx_path_flusher_pt) (void *data);
 
 
 typedef struct {
@@ -55,6 +56,7 @@ typedef struct {
     ngx_path_manager_pt        manager;
     ngx_path_purger_pt         purger;
     ngx_path_loader_pt         loader;
+    ngx_path_flusher_pt        flusher;
     void                      *data;
 
     u_char                    *conf_file;
@@ -71,6 +73,8 @@ typedef struct {
 typedef struct {
     ngx_file_t                 file;
     off_t                      offset;
+    off_t                      dontcache;
+    off_t                      dontcache_offset;
     ngx_path_t                *path;
     ngx_pool_t                *pool;
     char                      *warn;
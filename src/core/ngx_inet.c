@@ -1232,6 +1232,12 @@ ngx_inet_resolve_host(ngx_pool_t *pool, ngx_url_t *u)
         i++;
     }
 
+    /* resolved addresses are a part of the configuration digest */
+
+    for (i = 0; i < u->naddrs; i++) {
+        ngx_conf_digest(u->addrs[i].sockaddr, u->addrs[i].socklen);
+    }
+
     freeaddrinfo(res);
     return NGX_OK;
 
@@ -1349,6 +1355,12 @@ ngx_inet_resolve_host(ngx_pool_t *pool, ngx_url_t *u)
         u->addrs[0].name.data = p;
     }
 
+    /* resolved addresses are a part of the configuration digest */
+
+    for (i = 0; i < u->naddrs; i++) {
+        ngx_conf_digest(u->addrs[i].sockaddr, u->addrs[i].socklen);
+    }
+
     return NGX_OK;
 }
 
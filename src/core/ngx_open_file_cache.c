@@ -8,6 +8,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 /*
@@ -37,6 +40,15 @@ static ngx_int_t ngx_file_info_wrapper(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_file_info_t *fi, ngx_log_t *log);
 static ngx_int_t ngx_open_and_stat_file(ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_log_t *log);
+static ngx_int_t ngx_open_and_stat_file_wrapper(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    ngx_pool_t *pool);
+#if (NGX_THREADS)
+static ngx_int_t ngx_thread_open_file(ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_file_info_t *fi, ngx_pool_t *pool);
+static void ngx_thread_open_file_handler(void *data, ngx_log_t *log);
+static void ngx_thread_open_file_cleanup(void *data);
+#endif
 static void ngx_open_file_add_event(ngx_open_file_cache_t *cache,
     ngx_cached_open_file_t *file, ngx_open_file_info_t *of, ngx_log_t *log);
 static void ngx_open_file_cleanup(void *data);
@@ -51,6 +63,16 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+static ngx_int_t ngx_open_file_shared_stat(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+static void ngx_open_file_shared_update(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+static ngx_open_file_node_t *ngx_open_file_shared_lookup(
+    ngx_open_file_cache_sh_t *sh, ngx_str_t *name, uint32_t hash);
+static void ngx_open_file_shared_expire(ngx_open_file_cache_t *cache,
+    ngx_uint_t n);
+static void ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 
 ngx_open_file_cache_t *
@@ -72,6 +94,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shm_zone = NULL;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -160,6 +183,18 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
         if (of->test_only) {
 
+#if (NGX_THREADS)
+
+            if (of->thread_handler) {
+                rc = ngx_thread_open_file(name, of, &fi, pool);
+
+                if (rc != NGX_OK) {
+                    return rc;
+                }
+
+            } else
+#endif
+
             if (ngx_file_info_wrapper(name, of, &fi, pool->log)
                 == NGX_FILE_ERROR)
             {
@@ -183,7 +218,7 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
             return NGX_ERROR;
         }
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat_file_wrapper(NULL, name, 0, of, pool);
 
         if (rc == NGX_OK && !of->is_dir) {
             cln->handler = ngx_pool_cleanup_file;
@@ -218,7 +253,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
             /* file was not used often enough to keep open */
 
-            rc = ngx_open_and_stat_file(name, of, pool->log);
+            rc = ngx_open_and_stat_file_wrapper(cache, name, hash, of, pool);
+
+            if (rc == NGX_AGAIN) {
+                goto again;
+            }
 
             if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
                 goto failed;
@@ -286,7 +325,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         of->fd = file->fd;
         of->uniq = file->uniq;
 
-        rc = ngx_open_and_stat_file(name, of, pool->log);
+        rc = ngx_open_and_stat_file_wrapper(cache, name, hash, of, pool);
+
+        if (rc == NGX_AGAIN) {
+            goto again;
+        }
 
         if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
             goto failed;
@@ -351,7 +394,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
-    rc = ngx_open_and_stat_file(name, of, pool->log);
+    rc = ngx_open_and_stat_file_wrapper(cache, name, hash, of, pool);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
         goto failed;
@@ -450,6 +497,18 @@ found:
 
     return NGX_ERROR;
 
+again:
+
+    /* open() and stat() were passed to a thread, the entry is left as is */
+
+    file->uses--;
+
+    ngx_queue_insert_head(&cache->expire_queue, &file->queue);
+
+    of->fd = NGX_INVALID_FILE;
+
+    return NGX_AGAIN;
+
 failed:
 
     if (file) {
@@ -945,6 +1004,209 @@ done:
 }
 
 
+static ngx_int_t
+ngx_open_and_stat_file_wrapper(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_pool_t *pool)
+{
+    ngx_int_t  rc;
+
+    if (cache && cache->shm_zone) {
+        rc = ngx_open_file_shared_stat(cache, name, hash, of);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+#if (NGX_THREADS)
+
+    if (of->thread_handler) {
+        rc = ngx_thread_open_file(name, of, NULL, pool);
+
+    } else
+#endif
+    {
+        rc = ngx_open_and_stat_file(name, of, pool->log);
+    }
+
+    if (cache && cache->shm_zone && (rc == NGX_OK || of->err)) {
+        ngx_open_file_shared_update(cache, name, hash, of);
+    }
+
+    return rc;
+}
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_str_t                name;
+    ngx_fd_t                 fd;
+    ngx_file_uniq_t          uniq;
+
+    ngx_open_file_info_t     of;
+    ngx_file_info_t          fi;
+    ngx_int_t                rc;
+
+    ngx_uint_t               info;   /* unsigned  info:1; */
+} ngx_thread_open_file_ctx_t;
+
+
+/*
+ * open() and stat() are run in a thread pool, and NGX_AGAIN is returned;
+ * once the task is completed, the caller is expected to repeat the same
+ * ngx_open_cached_file() call, and the result is picked up from the task
+ * if it still matches the request: the same name, and, for retests of
+ * cached files, the same descriptor and file identity
+ */
+
+static ngx_int_t
+ngx_thread_open_file(ngx_str_t *name, ngx_open_file_info_t *of,
+    ngx_file_info_t *fi, ngx_pool_t *pool)
+{
+    ngx_thread_task_t           *task;
+    ngx_pool_cleanup_t          *cln;
+    ngx_thread_open_file_ctx_t  *ctx;
+
+    task = of->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_open_file_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_thread_open_file_cleanup;
+        cln->data = task;
+
+        ctx = task->ctx;
+        ctx->of.fd = NGX_INVALID_FILE;
+
+        of->thread_task = task;
+    }
+
+    if (task->event.active) {
+        return NGX_AGAIN;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        if (ctx->info == (fi != NULL)
+            && ctx->fd == of->fd
+            && ctx->uniq == of->uniq
+            && ctx->name.len == name->len
+            && ngx_strncmp(ctx->name.data, name->data, name->len) == 0)
+        {
+            ngx_log_debug3(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                           "thread open done: \"%V\", fd:%d, e:%d",
+                           name, ctx->of.fd, ctx->of.err);
+
+            of->err = ctx->of.err;
+            of->failed = ctx->of.failed;
+
+            if (fi) {
+                *fi = ctx->fi;
+                return ctx->rc;
+            }
+
+            of->fd = ctx->of.fd;
+            of->uniq = ctx->of.uniq;
+            of->mtime = ctx->of.mtime;
+            of->size = ctx->of.size;
+            of->fs_size = ctx->of.fs_size;
+            of->is_dir = ctx->of.is_dir;
+            of->is_file = ctx->of.is_file;
+            of->is_link = ctx->of.is_link;
+            of->is_exec = ctx->of.is_exec;
+            of->is_directio = ctx->of.is_directio;
+
+            ctx->of.fd = NGX_INVALID_FILE;
+
+            return ctx->rc;
+        }
+
+        /* the result is stale, e.g., the cache was changed meanwhile */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                       "thread open stale: \"%V\"", &ctx->name);
+
+        ngx_thread_open_file_cleanup(task);
+    }
+
+    ctx->name = *name;
+    ctx->fd = of->fd;
+    ctx->uniq = of->uniq;
+    ctx->of = *of;
+    ctx->info = (fi != NULL);
+
+    task->handler = ngx_thread_open_file_handler;
+
+    if (of->thread_handler(task, of) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_thread_open_file_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_open_file_ctx_t *ctx = data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                   "thread open handler: \"%V\"", &ctx->name);
+
+    if (ctx->info) {
+        ctx->rc = ngx_file_info_wrapper(&ctx->name, &ctx->of, &ctx->fi, log);
+
+        if (ctx->rc == NGX_FILE_ERROR) {
+            ctx->rc = NGX_ERROR;
+        }
+
+        return;
+    }
+
+    ctx->rc = ngx_open_and_stat_file(&ctx->name, &ctx->of, log);
+}
+
+
+static void
+ngx_thread_open_file_cleanup(void *data)
+{
+    ngx_thread_task_t  *task = data;
+
+    ngx_thread_open_file_ctx_t  *ctx;
+
+    ctx = task->ctx;
+
+    /* close a descriptor opened in a thread if nobody picked it up */
+
+    if (!task->event.active
+        && !ctx->info
+        && ctx->of.fd != NGX_INVALID_FILE
+        && ctx->of.fd != ctx->fd)
+    {
+        if (ngx_close_file(ctx->of.fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          ngx_close_file_n " \"%V\" failed", &ctx->name);
+        }
+    }
+
+    ctx->of.fd = NGX_INVALID_FILE;
+}
+
+#endif
+
+
 /*
  * we ignore any possible event setting error and
  * fallback to usual periodic file retests
@@ -1251,3 +1513,371 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+/*
+ * the shared zone keeps stat() results and errors for all worker processes;
+ * a result is used without syscalls if it is still valid and does not
+ * require to open a file, that is, for errors, directories, and retests
+ * of already opened files
+ */
+
+static ngx_int_t
+ngx_open_file_shared_stat(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    time_t                     now;
+    ngx_int_t                  rc;
+    ngx_slab_pool_t           *shpool;
+    ngx_open_file_node_t      *fn;
+    ngx_open_file_cache_sh_t  *sh;
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(sh, name, hash);
+
+    if (fn == NULL
+        || now - fn->created >= of->valid
+#if (NGX_HAVE_OPENAT)
+        || fn->disable_symlinks != of->disable_symlinks
+        || fn->disable_symlinks_from != of->disable_symlinks_from
+#endif
+       )
+    {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (fn->err) {
+
+        if (!of->errors) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return NGX_DECLINED;
+        }
+
+        of->fd = NGX_INVALID_FILE;
+        of->err = fn->err;
+#if (NGX_HAVE_OPENAT)
+        of->failed = fn->disable_symlinks ? ngx_openat_file_n
+                                          : ngx_open_file_n;
+#else
+        of->failed = ngx_open_file_n;
+#endif
+
+        rc = NGX_ERROR;
+
+        goto done;
+    }
+
+    if (fn->is_dir) {
+        of->fd = NGX_INVALID_FILE;
+
+    } else if (of->fd == NGX_INVALID_FILE || of->uniq != fn->uniq) {
+
+        /* the file has to be opened */
+
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    of->uniq = fn->uniq;
+    of->mtime = fn->mtime;
+    of->size = fn->size;
+    of->fs_size = fn->fs_size;
+    of->is_dir = fn->is_dir;
+    of->is_file = fn->is_file;
+    of->is_link = fn->is_link;
+    of->is_exec = fn->is_exec;
+
+    rc = NGX_OK;
+
+done:
+
+    fn->accessed = now;
+
+    ngx_queue_remove(&fn->queue);
+    ngx_queue_insert_head(&sh->queue, &fn->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: \"%V\", e:%d", name, of->err);
+
+    return rc;
+}
+
+
+static void
+ngx_open_file_shared_update(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    size_t                     n;
+    time_t                     now;
+    ngx_slab_pool_t           *shpool;
+    ngx_open_file_node_t      *fn;
+    ngx_open_file_cache_sh_t  *sh;
+
+    if (name->len > 65535) {
+        return;
+    }
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    fn = ngx_open_file_shared_lookup(sh, name, hash);
+
+    if (of->err && !of->errors) {
+
+        /* errors are not cached, the previous result is obsolete */
+
+        if (fn) {
+            ngx_queue_remove(&fn->queue);
+            ngx_rbtree_delete(&sh->rbtree, &fn->node);
+            ngx_slab_free_locked(shpool, fn);
+        }
+
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    if (fn == NULL) {
+
+        ngx_open_file_shared_expire(cache, 1);
+
+        n = offsetof(ngx_open_file_node_t, name) + name->len;
+
+        fn = ngx_slab_alloc_locked(shpool, n);
+
+        if (fn == NULL) {
+            ngx_open_file_shared_expire(cache, 0);
+
+            fn = ngx_slab_alloc_locked(shpool, n);
+            if (fn == NULL) {
+                ngx_shmtx_unlock(&shpool->mutex);
+                return;
+            }
+        }
+
+        fn->node.key = hash;
+        fn->len = (u_short) name->len;
+        ngx_memcpy(fn->name, name->data, name->len);
+
+        ngx_rbtree_insert(&sh->rbtree, &fn->node);
+
+    } else {
+        ngx_queue_remove(&fn->queue);
+    }
+
+    ngx_queue_insert_head(&sh->queue, &fn->queue);
+
+    fn->created = now;
+    fn->accessed = now;
+    fn->err = of->err;
+
+#if (NGX_HAVE_OPENAT)
+    fn->disable_symlinks = of->disable_symlinks;
+    fn->disable_symlinks_from = of->disable_symlinks_from;
+#endif
+
+    if (of->err == 0) {
+        fn->uniq = of->uniq;
+        fn->mtime = of->mtime;
+        fn->size = of->size;
+        fn->fs_size = of->fs_size;
+        fn->is_dir = of->is_dir;
+        fn->is_file = of->is_file;
+        fn->is_link = of->is_link;
+        fn->is_exec = of->is_exec;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static ngx_open_file_node_t *
+ngx_open_file_shared_lookup(ngx_open_file_cache_sh_t *sh, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t              rc;
+    ngx_rbtree_node_t     *node, *sentinel;
+    ngx_open_file_node_t  *fn;
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        fn = (ngx_open_file_node_t *) node;
+
+        rc = ngx_memn2cmp(name->data, fn->name, name->len, (size_t) fn->len);
+
+        if (rc == 0) {
+            return fn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_shared_expire(ngx_open_file_cache_t *cache, ngx_uint_t n)
+{
+    time_t                     now;
+    ngx_queue_t               *q;
+    ngx_slab_pool_t           *shpool;
+    ngx_open_file_node_t      *fn;
+    ngx_open_file_cache_sh_t  *sh;
+
+    sh = cache->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) cache->shm_zone->shm.addr;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two inactive entries
+     * n == 0 deletes least recently used entry by force
+     *        and one or two inactive entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&sh->queue);
+
+        fn = ngx_queue_data(q, ngx_open_file_node_t, queue);
+
+        if (n++ != 0 && now - fn->accessed <= cache->inactive) {
+            return;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "expire shared open file: \"%*s\"",
+                       (size_t) fn->len, fn->name);
+
+        ngx_queue_remove(q);
+
+        ngx_rbtree_delete(&sh->rbtree, &fn->node);
+
+        ngx_slab_free_locked(shpool, fn);
+    }
+}
+
+
+static void
+ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t     **p;
+    ngx_open_file_node_t   *fn, *fnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            fn = (ngx_open_file_node_t *) node;
+            fnt = (ngx_open_file_node_t *) temp;
+
+            p = (ngx_memn2cmp(fn->name, fnt->name, (size_t) fn->len,
+                              (size_t) fnt->len)
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_cache_sh_t  *osh = data;
+
+    size_t                     len;
+    ngx_slab_pool_t           *shpool;
+    ngx_open_file_cache_sh_t  *sh;
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_open_file_cache_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel,
+                    ngx_open_file_shared_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    len = sizeof(" in open file cache zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in open file cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
@@ -16,7 +16,9 @@
 #define NGX_OPEN_FILE_DIRECTIO_OFF  NGX_MAX_OFF_T_VALUE
 
 
-typedef struct {
+typedef struct ngx_open_file_info_s  ngx_open_file_info_t;
+
+struct ngx_open_file_info_s {
     ngx_fd_t                 fd;
     ngx_file_uniq_t          uniq;
     time_t                   mtime;
@@ -32,6 +34,13 @@ typedef struct {
 
     ngx_uint_t               min_uses;
 
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_int_t              (*thread_handler)(ngx_thread_task_t *task,
+                                             ngx_open_file_info_t *of);
+    void                    *thread_ctx;
+    ngx_thread_task_t       *thread_task;
+#endif
+
 #if (NGX_HAVE_OPENAT)
     size_t                   disable_symlinks_from;
     unsigned                 disable_symlinks:2;
@@ -48,7 +57,7 @@ typedef struct {
     unsigned                 is_link:1;
     unsigned                 is_exec:1;
     unsigned                 is_directio:1;
-} ngx_open_file_info_t;
+};
 
 
 typedef struct ngx_cached_open_file_s  ngx_cached_open_file_t;
@@ -88,6 +97,41 @@ struct ngx_cached_open_file_s {
 };
 
 
+typedef struct {
+    ngx_rbtree_node_t        node;
+    ngx_queue_t              queue;
+
+    time_t                   created;
+    time_t                   accessed;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    off_t                    fs_size;
+    ngx_err_t                err;
+
+#if (NGX_HAVE_OPENAT)
+    size_t                   disable_symlinks_from;
+    unsigned                 disable_symlinks:2;
+#endif
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    u_short                  len;
+    u_char                   name[1];
+} ngx_open_file_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+} ngx_open_file_cache_sh_t;
+
+
 typedef struct {
     ngx_rbtree_t             rbtree;
     ngx_rbtree_node_t        sentinel;
@@ -96,6 +140,8 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_shm_zone_t          *shm_zone;
 } ngx_open_file_cache_t;
 
 
@@ -124,6 +170,7 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
+ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data);
 
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
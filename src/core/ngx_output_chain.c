@@ -40,6 +40,17 @@ static ngx_int_t ngx_output_chain_align_file_buf(ngx_output_chain_ctx_t *ctx,
 static ngx_int_t ngx_output_chain_get_buf(ngx_output_chain_ctx_t *ctx,
     off_t bsize);
 static ngx_int_t ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx);
+static void ngx_output_chain_prefetch(ngx_output_chain_ctx_t *ctx,
+    ngx_buf_t *src, off_t size);
+static void ngx_output_chain_prefetch_cleanup(void *data);
+
+
+/*
+ * the number of bytes read ahead by all requests of the worker process
+ * and not yet read by them, limited by the "prefetch_budget"
+ */
+
+static off_t  ngx_output_chain_prefetch_ahead;
 
 
 ngx_int_t
@@ -646,12 +657,104 @@ ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx)
             dst->last_buf = src->last_buf;
             dst->last_in_chain = src->last_in_chain;
         }
+
+        if (ctx->prefetch_handler && !src->file->directio) {
+            ngx_output_chain_prefetch(ctx, src, n);
+        }
     }
 
     return NGX_OK;
 }
 
 
+static void
+ngx_output_chain_prefetch(ngx_output_chain_ctx_t *ctx, ngx_buf_t *src,
+    off_t size)
+{
+    off_t                start, end, ahead;
+    ngx_pool_cleanup_t  *cln;
+
+    /*
+     * the readahead window starts at one read and is doubled on each
+     * sequential read up to the "prefetch" size, while a read from
+     * another position or file restarts it
+     */
+
+    if (src->file != ctx->prefetch_file
+        || src->file_pos - size != ctx->prefetch_last)
+    {
+        ctx->prefetch_file = src->file;
+        ctx->prefetch_window = size;
+        ctx->prefetch_end = src->file_pos;
+
+    } else if (ctx->prefetch_window < ctx->prefetch) {
+        ctx->prefetch_window = ngx_min(ctx->prefetch_window * 2,
+                                       ctx->prefetch);
+    }
+
+    ctx->prefetch_last = src->file_pos;
+
+    /* release the part of the readahead which was read since */
+
+    ahead = ngx_max(ctx->prefetch_end - src->file_pos, 0);
+
+    ngx_output_chain_prefetch_ahead -= ctx->prefetch_ahead - ahead;
+    ctx->prefetch_ahead = ahead;
+
+    start = ngx_max(src->file_pos, ctx->prefetch_end);
+    end = ngx_min(src->file_pos + ctx->prefetch_window, src->file_last);
+
+    if (end - start < size && end != src->file_last) {
+        return;
+    }
+
+    if (start >= end) {
+        return;
+    }
+
+    if (ngx_output_chain_prefetch_ahead + (end - start)
+        > (off_t) ctx->prefetch_budget)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ctx->pool->log, 0,
+                       "prefetch budget exhausted: %O",
+                       ngx_output_chain_prefetch_ahead);
+        return;
+    }
+
+    if (!ctx->prefetch_cleanup) {
+        cln = ngx_pool_cleanup_add(ctx->pool, 0);
+        if (cln == NULL) {
+            return;
+        }
+
+        cln->handler = ngx_output_chain_prefetch_cleanup;
+        cln->data = ctx;
+
+        ctx->prefetch_cleanup = 1;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, ctx->pool->log, 0,
+                   "prefetch: \"%s\" %O-%O",
+                   src->file->name.data, start, end);
+
+    if (ctx->prefetch_handler(ctx, src->file, start, end - start) == NGX_OK) {
+        ctx->prefetch_end = end;
+        ctx->prefetch_ahead += end - start;
+        ngx_output_chain_prefetch_ahead += end - start;
+    }
+}
+
+
+static void
+ngx_output_chain_prefetch_cleanup(void *data)
+{
+    ngx_output_chain_ctx_t  *ctx = data;
+
+    ngx_output_chain_prefetch_ahead -= ctx->prefetch_ahead;
+    ctx->prefetch_ahead = 0;
+}
+
+
 ngx_int_t
 ngx_chain_writer(void *data, ngx_chain_t *in)
 {
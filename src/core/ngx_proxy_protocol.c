@@ -9,6 +9,81 @@
 #include <ngx_core.h>
 
 
+#define NGX_PROXY_PROTOCOL_AF_UNSPEC     0
+#define NGX_PROXY_PROTOCOL_AF_INET       1
+#define NGX_PROXY_PROTOCOL_AF_INET6      2
+
+#define NGX_PROXY_PROTOCOL_CMD_LOCAL     0
+#define NGX_PROXY_PROTOCOL_CMD_PROXY     1
+
+#define NGX_PROXY_PROTOCOL_STREAM        1
+#define NGX_PROXY_PROTOCOL_DGRAM         2
+
+#define NGX_PROXY_PROTOCOL_TLV_SSL       0x20
+
+
+#define ngx_proxy_protocol_parse_uint16(p)  ((p)[0] << 8 | (p)[1])
+
+
+typedef struct {
+    u_char        signature[12];
+    u_char        version_command;
+    u_char        family_transport;
+    u_char        len[2];
+} ngx_proxy_protocol_header_t;
+
+
+typedef struct {
+    u_char        src_addr[4];
+    u_char        dst_addr[4];
+    u_char        src_port[2];
+    u_char        dst_port[2];
+} ngx_proxy_protocol_inet_addrs_t;
+
+
+typedef struct {
+    u_char        src_addr[16];
+    u_char        dst_addr[16];
+    u_char        src_port[2];
+    u_char        dst_port[2];
+} ngx_proxy_protocol_inet6_addrs_t;
+
+
+typedef struct {
+    ngx_str_t     name;
+    ngx_uint_t    type;
+} ngx_proxy_protocol_tlv_entry_t;
+
+
+static u_char *ngx_proxy_protocol_v2_read(ngx_connection_t *c, u_char *buf,
+    u_char *last);
+static ngx_int_t ngx_proxy_protocol_find_tlv(ngx_connection_t *c,
+    ngx_str_t *tlvs, ngx_uint_t type, ngx_str_t *value);
+
+
+static u_char  ngx_proxy_protocol_v2_sig[] = "\r\n\r\n\0\r\nQUIT\n";
+
+
+static ngx_proxy_protocol_tlv_entry_t  ngx_proxy_protocol_tlv_entries[] = {
+    { ngx_string("alpn"),       0x01 },
+    { ngx_string("authority"),  0x02 },
+    { ngx_string("unique_id"),  0x05 },
+    { ngx_string("ssl"),        0x20 },
+    { ngx_string("netns"),      0x30 },
+    { ngx_null_string,          0x00 }
+};
+
+
+static ngx_proxy_protocol_tlv_entry_t  ngx_proxy_protocol_tlv_ssl_entries[] = {
+    { ngx_string("version"),    0x21 },
+    { ngx_string("cn"),         0x22 },
+    { ngx_string("cipher"),     0x23 },
+    { ngx_string("sig_alg"),    0x24 },
+    { ngx_string("key_alg"),    0x25 },
+    { ngx_null_string,          0x00 }
+};
+
+
 u_char *
 ngx_proxy_protocol_read(ngx_connection_t *c, u_char *buf, u_char *last)
 {
@@ -19,6 +94,12 @@ ngx_proxy_protocol_read(ngx_connection_t *c, u_char *buf, u_char *last)
     p = buf;
     len = last - buf;
 
+    if (len >= sizeof(ngx_proxy_protocol_header_t)
+        && ngx_memcmp(p, ngx_proxy_protocol_v2_sig, 12) == 0)
+    {
+        return ngx_proxy_protocol_v2_read(c, buf, last);
+    }
+
     if (len < 8 || ngx_strncmp(p, "PROXY ", 6) != 0) {
         goto invalid;
     }
@@ -129,7 +210,7 @@ ngx_proxy_protocol_write(ngx_connection_t *c, u_char *buf, u_char *last)
 {
     ngx_uint_t  port, lport;
 
-    if (last - buf < NGX_PROXY_PROTOCOL_MAX_HEADER) {
+    if (last - buf < NGX_PROXY_PROTOCOL_V1_MAX_HEADER) {
         return NULL;
     }
 
@@ -166,3 +247,408 @@ ngx_proxy_protocol_write(ngx_connection_t *c, u_char *buf, u_char *last)
 
     return ngx_slprintf(buf, last, " %ui %ui" CRLF, port, lport);
 }
+
+
+static u_char *
+ngx_proxy_protocol_v2_read(ngx_connection_t *c, u_char *buf, u_char *last)
+{
+    u_char                             *end;
+    size_t                              len;
+    socklen_t                           socklen;
+    ngx_uint_t                          version, command, family, transport;
+    ngx_str_t                          *tlvs;
+    ngx_sockaddr_t                      sockaddr;
+    ngx_proxy_protocol_header_t        *header;
+    ngx_proxy_protocol_inet_addrs_t    *in;
+#if (NGX_HAVE_INET6)
+    ngx_proxy_protocol_inet6_addrs_t   *in6;
+#endif
+
+    header = (ngx_proxy_protocol_header_t *) buf;
+
+    buf += sizeof(ngx_proxy_protocol_header_t);
+
+    version = header->version_command >> 4;
+
+    if (version != 2) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "unknown PROXY protocol version: %ui", version);
+        return NULL;
+    }
+
+    len = ngx_proxy_protocol_parse_uint16(header->len);
+
+    if ((size_t) (last - buf) < len) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0, "header is too large");
+        return NULL;
+    }
+
+    end = buf + len;
+
+    command = header->version_command & 0x0f;
+
+    if (command != NGX_PROXY_PROTOCOL_CMD_PROXY) {
+
+        /* e.g. health checks from the proxy itself */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                       "PROXY protocol v2 unsupported command %ui", command);
+        return end;
+    }
+
+    transport = header->family_transport & 0x0f;
+
+    if (transport != NGX_PROXY_PROTOCOL_STREAM
+        && transport != NGX_PROXY_PROTOCOL_DGRAM)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                       "PROXY protocol v2 unsupported transport %ui",
+                       transport);
+        return end;
+    }
+
+    family = header->family_transport >> 4;
+
+    switch (family) {
+
+    case NGX_PROXY_PROTOCOL_AF_INET:
+
+        if ((size_t) (end - buf) < sizeof(ngx_proxy_protocol_inet_addrs_t)) {
+            return NULL;
+        }
+
+        in = (ngx_proxy_protocol_inet_addrs_t *) buf;
+
+        sockaddr.sockaddr_in.sin_family = AF_INET;
+        sockaddr.sockaddr_in.sin_port = 0;
+        ngx_memcpy(&sockaddr.sockaddr_in.sin_addr, in->src_addr, 4);
+
+        c->proxy_protocol_port = ngx_proxy_protocol_parse_uint16(in->src_port);
+
+        socklen = sizeof(struct sockaddr_in);
+
+        buf += sizeof(ngx_proxy_protocol_inet_addrs_t);
+
+        break;
+
+#if (NGX_HAVE_INET6)
+
+    case NGX_PROXY_PROTOCOL_AF_INET6:
+
+        if ((size_t) (end - buf) < sizeof(ngx_proxy_protocol_inet6_addrs_t)) {
+            return NULL;
+        }
+
+        in6 = (ngx_proxy_protocol_inet6_addrs_t *) buf;
+
+        sockaddr.sockaddr_in6.sin6_family = AF_INET6;
+        sockaddr.sockaddr_in6.sin6_port = 0;
+        ngx_memcpy(&sockaddr.sockaddr_in6.sin6_addr, in6->src_addr, 16);
+
+        c->proxy_protocol_port = ngx_proxy_protocol_parse_uint16(in6->src_port);
+
+        socklen = sizeof(struct sockaddr_in6);
+
+        buf += sizeof(ngx_proxy_protocol_inet6_addrs_t);
+
+        break;
+
+#endif
+
+    default:
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                       "PROXY protocol v2 unsupported address family %ui",
+                       family);
+        return end;
+    }
+
+    c->proxy_protocol_addr.data = ngx_pnalloc(c->pool, NGX_SOCKADDR_STRLEN);
+    if (c->proxy_protocol_addr.data == NULL) {
+        return NULL;
+    }
+
+    c->proxy_protocol_addr.len = ngx_sock_ntop(&sockaddr.sockaddr, socklen,
+                                               c->proxy_protocol_addr.data,
+                                               NGX_SOCKADDR_STRLEN, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, c->log, 0,
+                   "PROXY protocol v2 address: %V %d",
+                   &c->proxy_protocol_addr, c->proxy_protocol_port);
+
+    if (buf < end) {
+
+        /* the header lives in a reusable read buffer, keep a copy of TLVs */
+
+        len = end - buf;
+
+        tlvs = ngx_palloc(c->pool, sizeof(ngx_str_t) + len);
+        if (tlvs == NULL) {
+            return NULL;
+        }
+
+        tlvs->len = len;
+        tlvs->data = (u_char *) tlvs + sizeof(ngx_str_t);
+        ngx_memcpy(tlvs->data, buf, len);
+
+        c->proxy_protocol_tlvs = tlvs;
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, c->log, 0,
+                       "PROXY protocol v2 TLV length: %uz", len);
+    }
+
+    return end;
+}
+
+
+u_char *
+ngx_proxy_protocol_v2_write(ngx_connection_t *c, u_char *buf, u_char *last,
+    ngx_array_t *tlvs)
+{
+    u_char                            *p;
+    size_t                             len;
+    ngx_uint_t                         i;
+    ngx_proxy_protocol_tlv_t          *tlv;
+    struct sockaddr_in                *sin, *lsin;
+    ngx_proxy_protocol_header_t       *header;
+    ngx_proxy_protocol_inet_addrs_t   *in;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6               *sin6, *lsin6;
+    ngx_proxy_protocol_inet6_addrs_t  *in6;
+#endif
+
+    len = NGX_PROXY_PROTOCOL_V2_MAX_HEADER;
+
+    tlv = tlvs ? tlvs->elts : NULL;
+
+    for (i = 0; tlvs && i < tlvs->nelts; i++) {
+        len += 3 + tlv[i].value.len;
+    }
+
+    if ((size_t) (last - buf) < len
+        || len - sizeof(ngx_proxy_protocol_header_t) > 0xffff)
+    {
+        return NULL;
+    }
+
+    if (ngx_connection_local_sockaddr(c, NULL, 0) != NGX_OK) {
+        return NULL;
+    }
+
+    header = (ngx_proxy_protocol_header_t *) buf;
+
+    ngx_memcpy(header->signature, ngx_proxy_protocol_v2_sig, 12);
+
+    header->version_command = 0x20 | NGX_PROXY_PROTOCOL_CMD_PROXY;
+    header->family_transport = (c->type == SOCK_DGRAM)
+                               ? NGX_PROXY_PROTOCOL_DGRAM
+                               : NGX_PROXY_PROTOCOL_STREAM;
+
+    p = buf + sizeof(ngx_proxy_protocol_header_t);
+
+    switch (c->sockaddr->sa_family) {
+
+    case AF_INET:
+        header->family_transport |= NGX_PROXY_PROTOCOL_AF_INET << 4;
+
+        sin = (struct sockaddr_in *) c->sockaddr;
+        lsin = (struct sockaddr_in *) c->local_sockaddr;
+
+        in = (ngx_proxy_protocol_inet_addrs_t *) p;
+
+        ngx_memcpy(in->src_addr, &sin->sin_addr, 4);
+        ngx_memcpy(in->dst_addr, &lsin->sin_addr, 4);
+        ngx_memcpy(in->src_port, &sin->sin_port, 2);
+        ngx_memcpy(in->dst_port, &lsin->sin_port, 2);
+
+        p += sizeof(ngx_proxy_protocol_inet_addrs_t);
+        break;
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        header->family_transport |= NGX_PROXY_PROTOCOL_AF_INET6 << 4;
+
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
+        lsin6 = (struct sockaddr_in6 *) c->local_sockaddr;
+
+        in6 = (ngx_proxy_protocol_inet6_addrs_t *) p;
+
+        ngx_memcpy(in6->src_addr, &sin6->sin6_addr, 16);
+        ngx_memcpy(in6->dst_addr, &lsin6->sin6_addr, 16);
+        ngx_memcpy(in6->src_port, &sin6->sin6_port, 2);
+        ngx_memcpy(in6->dst_port, &lsin6->sin6_port, 2);
+
+        p += sizeof(ngx_proxy_protocol_inet6_addrs_t);
+        break;
+#endif
+
+    default:
+
+        /* the receiver falls back to the connection addresses */
+
+        header->family_transport = NGX_PROXY_PROTOCOL_AF_UNSPEC << 4;
+        break;
+    }
+
+    for (i = 0; tlvs && i < tlvs->nelts; i++) {
+        *p++ = (u_char) tlv[i].type;
+        *p++ = (u_char) (tlv[i].value.len >> 8);
+        *p++ = (u_char) (tlv[i].value.len & 0xff);
+        p = ngx_cpymem(p, tlv[i].value.data, tlv[i].value.len);
+    }
+
+    len = p - buf - sizeof(ngx_proxy_protocol_header_t);
+
+    header->len[0] = (u_char) (len >> 8);
+    header->len[1] = (u_char) (len & 0xff);
+
+    return p;
+}
+
+
+ngx_int_t
+ngx_proxy_protocol_tlv_type(ngx_str_t *name)
+{
+    ngx_int_t                        type;
+    ngx_proxy_protocol_tlv_entry_t  *te;
+
+    if (name->len > 2
+        && name->data[0] == '0'
+        && (name->data[1] == 'x' || name->data[1] == 'X'))
+    {
+        type = ngx_hextoi(name->data + 2, name->len - 2);
+
+        if (type == NGX_ERROR || type > 0xff) {
+            return NGX_ERROR;
+        }
+
+        return type;
+    }
+
+    for (te = ngx_proxy_protocol_tlv_entries; te->name.len; te++) {
+        if (te->name.len == name->len
+            && ngx_strncmp(te->name.data, name->data, name->len) == 0)
+        {
+            return te->type;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_proxy_protocol_lookup_tlv(ngx_connection_t *c, ngx_str_t *tlvs,
+    ngx_str_t *name, ngx_str_t *value)
+{
+    u_char                          *p;
+    uint32_t                         verify;
+    ngx_int_t                        rc, type;
+    ngx_str_t                        ssl, n;
+    ngx_proxy_protocol_tlv_entry_t  *te;
+
+    /* "0x" followed by a hexadecimal type, e.g. "0xe0" */
+
+    if (name->len > 2
+        && name->data[0] == '0'
+        && (name->data[1] == 'x' || name->data[1] == 'X'))
+    {
+        type = ngx_hextoi(name->data + 2, name->len - 2);
+
+        if (type == NGX_ERROR || type > 0xff) {
+            return NGX_DECLINED;
+        }
+
+        return ngx_proxy_protocol_find_tlv(c, tlvs, type, value);
+    }
+
+    if (name->len > 4 && ngx_strncmp(name->data, "ssl_", 4) == 0) {
+
+        rc = ngx_proxy_protocol_find_tlv(c, tlvs, NGX_PROXY_PROTOCOL_TLV_SSL,
+                                         &ssl);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+
+        /* client bits and verify result precede the sub-TLVs */
+
+        if (ssl.len < 5) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "broken PROXY protocol SSL TLV");
+            return NGX_ERROR;
+        }
+
+        n.len = name->len - 4;
+        n.data = name->data + 4;
+
+        if (n.len == 6 && ngx_strncmp(n.data, "verify", 6) == 0) {
+
+            p = ngx_pnalloc(c->pool, NGX_INT32_LEN);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            verify = ((uint32_t) ssl.data[1] << 24) + (ssl.data[2] << 16)
+                     + (ssl.data[3] << 8) + ssl.data[4];
+
+            value->len = ngx_sprintf(p, "%uD", verify) - p;
+            value->data = p;
+
+            return NGX_OK;
+        }
+
+        ssl.data += 5;
+        ssl.len -= 5;
+
+        for (te = ngx_proxy_protocol_tlv_ssl_entries; te->name.len; te++) {
+            if (te->name.len == n.len
+                && ngx_strncmp(te->name.data, n.data, n.len) == 0)
+            {
+                return ngx_proxy_protocol_find_tlv(c, &ssl, te->type, value);
+            }
+        }
+
+        return NGX_DECLINED;
+    }
+
+    for (te = ngx_proxy_protocol_tlv_entries; te->name.len; te++) {
+        if (te->name.len == name->len
+            && ngx_strncmp(te->name.data, name->data, name->len) == 0)
+        {
+            return ngx_proxy_protocol_find_tlv(c, tlvs, te->type, value);
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_proxy_protocol_find_tlv(ngx_connection_t *c, ngx_str_t *tlvs,
+    ngx_uint_t type, ngx_str_t *value)
+{
+    u_char  *p, *last;
+    size_t   len;
+
+    p = tlvs->data;
+    last = p + tlvs->len;
+
+    while (last - p >= 3) {
+        len = (p[1] << 8) + p[2];
+
+        if ((size_t) (last - p - 3) < len) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "broken PROXY protocol TLV");
+            return NGX_ERROR;
+        }
+
+        if (p[0] == type) {
+            value->data = p + 3;
+            value->len = len;
+            return NGX_OK;
+        }
+
+        p += 3 + len;
+    }
+
+    return NGX_DECLINED;
+}
@@ -13,13 +13,26 @@
 #include <ngx_core.h>
 
 
-#define NGX_PROXY_PROTOCOL_MAX_HEADER  107
+#define NGX_PROXY_PROTOCOL_V1_MAX_HEADER  107
+#define NGX_PROXY_PROTOCOL_V2_MAX_HEADER  52
+#define NGX_PROXY_PROTOCOL_MAX_HEADER     4096
+
+
+typedef struct {
+    ngx_uint_t                        type;
+    ngx_str_t                         value;
+} ngx_proxy_protocol_tlv_t;
 
 
 u_char *ngx_proxy_protocol_read(ngx_connection_t *c, u_char *buf,
     u_char *last);
 u_char *ngx_proxy_protocol_write(ngx_connection_t *c, u_char *buf,
     u_char *last);
+u_char *ngx_proxy_protocol_v2_write(ngx_connection_t *c, u_char *buf,
+    u_char *last, ngx_array_t *tlvs);
+ngx_int_t ngx_proxy_protocol_tlv_type(ngx_str_t *name);
+ngx_int_t ngx_proxy_protocol_lookup_tlv(ngx_connection_t *c, ngx_str_t *tlvs,
+    ngx_str_t *name, ngx_str_t *value);
 
 
 #endif /* _NGX_PROXY_PROTOCOL_H_INCLUDED_ */
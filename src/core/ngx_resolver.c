@@ -51,6 +51,37 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+/*
+ * the resolver cache zone keeps successful name resolutions in shared
+ * memory, so an answer obtained by one worker process is reused by all
+ * of them; an entry requested shortly before it expires is refreshed
+ * in the background by a single worker, and an expired entry is still
+ * returned for "stale" seconds while such a refresh is in progress
+ */
+
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_queue_t               queue;
+
+    time_t                    valid;
+    time_t                    updating;
+    uint32_t                  ttl;
+
+    u_short                   naddrs;
+    u_short                   naddrs6;
+
+    /* IPv4 addresses, IPv6 addresses, name */
+    u_char                    data[1];
+} ngx_resolver_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+} ngx_resolver_cache_sh_t;
+
+
 #define ngx_resolver_node(n)                                                 \
     (ngx_resolver_node_t *)                                                  \
         ((u_char *) (n) - offsetof(ngx_resolver_node_t, node))
@@ -62,6 +93,20 @@ static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
 static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
+static ngx_int_t ngx_resolver_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_resolver_cache_lookup(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_str_t *name, uint32_t hash);
+static ngx_uint_t ngx_resolver_cache_expiring(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_update(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_delete(ngx_resolver_cache_sh_t *sh,
+    ngx_slab_pool_t *shpool, ngx_resolver_cache_node_t *node);
+static ngx_resolver_ctx_t *ngx_resolver_cache_refresh_start(ngx_resolver_t *r,
+    u_char *name, size_t len);
+static void ngx_resolver_cache_refresh(ngx_resolver_ctx_t *ctx);
+static void ngx_resolver_cache_refresh_handler(ngx_resolver_ctx_t *ctx);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx, ngx_str_t *name);
 static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
@@ -132,7 +177,9 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t                   s;
+    u_char                     *p;
+    ssize_t                     size;
+    ngx_str_t                   s, name;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
     ngx_resolver_t             *r;
@@ -195,6 +242,7 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
     r->tcp_timeout = 5;
     r->expire = 30;
     r->valid = 0;
+    r->stale = 10;
 
     r->log = &cf->cycle->new_log;
     r->log_level = NGX_LOG_ERR;
@@ -224,6 +272,69 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+
+            name.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = names[i].data + names[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &names[i]);
+                    return NULL;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "zone \"%V\" is too small", &names[i]);
+                    return NULL;
+                }
+
+            } else {
+                name.len = names[i].len - 5;
+                size = 0;
+            }
+
+            if (name.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone name \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                                &ngx_core_module);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            r->shm_zone->init = ngx_resolver_cache_init_zone;
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "stale=", 6) == 0) {
+            s.len = names[i].len - 6;
+            s.data = names[i].data + 6;
+
+            r->stale = ngx_parse_time(&s, 1);
+
+            if (r->stale == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
 
@@ -358,6 +469,10 @@ ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree)
                 ngx_resolver_free(r, ctx->event);
             }
 
+            if (ctx->refresh) {
+                ngx_resolver_free(r, ctx->name.data);
+            }
+
             ngx_resolver_free(r, ctx);
         }
 
@@ -588,7 +703,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     ngx_uint_t            i, naddrs;
     ngx_queue_t          *resend_queue, *expire_queue;
     ngx_rbtree_t         *tree;
-    ngx_resolver_ctx_t   *next, *last;
+    ngx_resolver_ctx_t   *next, *last, *refresh;
     ngx_resolver_addr_t  *addrs;
     ngx_resolver_node_t  *rn;
 
@@ -611,12 +726,24 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         expire_queue = &r->name_expire_queue;
     }
 
+    if (r->shm_zone
+        && ctx->service.len == 0
+        && !ctx->refresh
+        && (rn == NULL || rn->valid < ngx_time()))
+    {
+        rc = ngx_resolver_cache_lookup(r, ctx, name, hash);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
     if (rn) {
 
         /* ctx can be a list after NGX_RESOLVE_CNAME */
         for (last = ctx; last->next; last = last->next);
 
-        if (rn->valid >= ngx_time()) {
+        if (rn->valid >= ngx_time() && !ctx->refresh) {
 
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
@@ -643,6 +770,16 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                     }
                 }
 
+                refresh = NULL;
+
+                if (r->shm_zone
+                    && ctx->service.len == 0
+                    && ngx_resolver_cache_expiring(r, rn))
+                {
+                    refresh = ngx_resolver_cache_refresh_start(r, rn->name,
+                                                               rn->nlen);
+                }
+
                 last->next = rn->waiting;
                 rn->waiting = NULL;
 
@@ -677,6 +814,10 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                     ngx_resolver_free(r, addrs);
                 }
 
+                if (refresh) {
+                    ngx_resolver_cache_refresh(refresh);
+                }
+
                 return NGX_OK;
             }
 
@@ -2412,6 +2553,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->shm_zone) {
+            ngx_resolver_cache_update(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -3632,6 +3777,414 @@ ngx_resolver_rbtree_insert_addr6_value(ngx_rbtree_node_t *temp,
 #endif
 
 
+static ngx_int_t
+ngx_resolver_cache_lookup(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_str_t *name, uint32_t hash)
+{
+    u_char                     *p;
+    time_t                      now, valid;
+    ngx_uint_t                  naddrs, update;
+    ngx_str_node_t             *sn;
+    ngx_slab_pool_t            *shpool;
+    ngx_resolver_ctx_t         *next, *refresh;
+    ngx_resolver_addr_t        *addrs;
+    ngx_resolver_node_t         rn;
+    ngx_resolver_cache_sh_t    *sh;
+    ngx_resolver_cache_node_t  *node;
+
+    sh = r->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_str_rbtree_lookup(&sh->rbtree, name, hash);
+
+    if (sn == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    node = (ngx_resolver_cache_node_t *) sn;
+
+    if (node->valid + r->stale < now) {
+        ngx_resolver_cache_delete(sh, shpool, node);
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(&rn, sizeof(ngx_resolver_node_t));
+
+    p = node->data;
+
+    rn.naddrs = node->naddrs;
+
+    if (rn.naddrs == 1) {
+        rn.u.addr = *(in_addr_t *) p;
+
+    } else {
+        rn.u.addrs = (in_addr_t *) p;
+    }
+
+    naddrs = rn.naddrs;
+
+#if (NGX_HAVE_INET6)
+    if (r->ipv6) {
+        p += node->naddrs * sizeof(in_addr_t);
+
+        rn.naddrs6 = node->naddrs6;
+
+        if (rn.naddrs6 == 1) {
+            ngx_memcpy(&rn.u6.addr6, p, sizeof(struct in6_addr));
+
+        } else {
+            rn.u6.addrs6 = (struct in6_addr *) p;
+        }
+
+        naddrs += rn.naddrs6;
+    }
+#endif
+
+    if (naddrs == 0) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    addrs = ngx_resolver_export(r, &rn, 1);
+    if (addrs == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    valid = node->valid;
+    update = 0;
+
+    if (node->valid - now <= (time_t) (node->ttl / 4)
+        && node->updating + r->resend_timeout < now)
+    {
+        node->updating = now;
+        update = 1;
+    }
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve cached in zone: \"%V\" %s%s", name,
+                   valid < now ? "stale" : "valid",
+                   update ? ", updating" : "");
+
+    refresh = update ? ngx_resolver_cache_refresh_start(r, name->data,
+                                                        name->len)
+                     : NULL;
+
+    /* unlock name mutex */
+
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = valid;
+        ctx->naddrs = naddrs;
+        ctx->addrs = addrs;
+
+        next = ctx->next;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    } while (ctx);
+
+    ngx_resolver_free(r, addrs->sockaddr);
+    ngx_resolver_free(r, addrs);
+
+    if (refresh) {
+        ngx_resolver_cache_refresh(refresh);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_resolver_cache_expiring(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    time_t                      now;
+    ngx_str_t                   name;
+    ngx_uint_t                  update;
+    ngx_str_node_t             *sn;
+    ngx_slab_pool_t            *shpool;
+    ngx_resolver_cache_sh_t    *sh;
+    ngx_resolver_cache_node_t  *node;
+
+    sh = r->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    now = ngx_time();
+    update = 0;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_str_rbtree_lookup(&sh->rbtree, &name, rn->node.key);
+
+    if (sn) {
+        node = (ngx_resolver_cache_node_t *) sn;
+
+        if (node->valid - now <= (time_t) (node->ttl / 4)
+            && node->updating + r->resend_timeout < now)
+        {
+            node->updating = now;
+            update = 1;
+        }
+
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&sh->queue, &node->queue);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    return update;
+}
+
+
+static void
+ngx_resolver_cache_update(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                     *p;
+    size_t                      size;
+    time_t                      now;
+    ngx_str_t                   name;
+    ngx_uint_t                  n, naddrs6;
+    ngx_queue_t                *q;
+    ngx_str_node_t             *sn;
+    ngx_slab_pool_t            *shpool;
+    ngx_resolver_cache_sh_t    *sh;
+    ngx_resolver_cache_node_t  *node;
+
+    now = ngx_time();
+
+    if (rn->valid <= now) {
+        return;
+    }
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = rn->naddrs6;
+#else
+    naddrs6 = 0;
+#endif
+
+    sh = r->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) r->shm_zone->shm.addr;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    size = offsetof(ngx_resolver_cache_node_t, data)
+           + rn->naddrs * sizeof(in_addr_t)
+#if (NGX_HAVE_INET6)
+           + naddrs6 * sizeof(struct in6_addr)
+#endif
+           + name.len;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = ngx_str_rbtree_lookup(&sh->rbtree, &name, rn->node.key);
+
+    if (sn) {
+        ngx_resolver_cache_delete(sh, shpool, (ngx_resolver_cache_node_t *) sn);
+    }
+
+    /* evict least recently used entries, but no more than 16 at once */
+
+    for (n = 0; n < 16; n++) {
+
+        node = ngx_slab_alloc_locked(shpool, size);
+
+        if (node) {
+            break;
+        }
+
+        if (ngx_queue_empty(&sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&sh->queue);
+        node = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        ngx_resolver_cache_delete(sh, shpool, node);
+        node = NULL;
+    }
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    node->valid = rn->valid;
+    node->updating = 0;
+    node->ttl = (uint32_t) (rn->valid - now);
+    node->naddrs = rn->naddrs;
+    node->naddrs6 = (u_short) naddrs6;
+
+    p = node->data;
+
+    if (rn->naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else {
+        p = ngx_cpymem(p, rn->u.addrs, rn->naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+    if (naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, sizeof(struct in6_addr));
+
+    } else {
+        p = ngx_cpymem(p, rn->u6.addrs6, naddrs6 * sizeof(struct in6_addr));
+    }
+#endif
+
+    ngx_memcpy(p, name.data, name.len);
+
+    node->sn.node.key = rn->node.key;
+    node->sn.str.len = name.len;
+    node->sn.str.data = p;
+
+    ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_resolver_cache_delete(ngx_resolver_cache_sh_t *sh, ngx_slab_pool_t *shpool,
+    ngx_resolver_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&sh->rbtree, &node->sn.node);
+    ngx_slab_free_locked(shpool, node);
+}
+
+
+static ngx_resolver_ctx_t *
+ngx_resolver_cache_refresh_start(ngx_resolver_t *r, u_char *name, size_t len)
+{
+    ngx_resolver_ctx_t  *ctx;
+
+    ctx = ngx_resolve_start(r, NULL);
+    if (ctx == NULL || ctx == NGX_NO_RESOLVER) {
+        return NULL;
+    }
+
+    ctx->name.data = ngx_resolver_dup(r, name, len);
+    if (ctx->name.data == NULL) {
+        ngx_resolver_free(r, ctx);
+        return NULL;
+    }
+
+    ctx->name.len = len;
+    ctx->handler = ngx_resolver_cache_refresh_handler;
+    ctx->timeout = (ngx_msec_t) (r->resend_timeout * 1000);
+    ctx->refresh = 1;
+
+    return ctx;
+}
+
+
+static void
+ngx_resolver_cache_refresh(ngx_resolver_ctx_t *ctx)
+{
+    u_char          *name;
+    ngx_resolver_t  *r;
+
+    r = ctx->resolver;
+    name = ctx->name.data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver cache refresh: \"%V\"", &ctx->name);
+
+    if (ngx_resolve_name(ctx) != NGX_OK) {
+
+        /* ctx is freed by ngx_resolve_name() */
+
+        ngx_resolver_free(r, name);
+    }
+}
+
+
+static void
+ngx_resolver_cache_refresh_handler(ngx_resolver_ctx_t *ctx)
+{
+    u_char          *name;
+    ngx_resolver_t  *r;
+
+    r = ctx->resolver;
+    name = ctx->name.data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver cache refresh done: \"%V\" %i",
+                   &ctx->name, ctx->state);
+
+    ngx_resolve_name_done(ctx);
+
+    ngx_resolver_free(r, name);
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_sh_t  *osh = data;
+
+    size_t                    len;
+    ngx_slab_pool_t          *shpool;
+    ngx_resolver_cache_sh_t  *sh;
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_resolver_cache_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    len = sizeof(" in resolver cache zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in resolver cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_resolver_create_name_query(ngx_resolver_t *r, ngx_resolver_node_t *rn,
     ngx_str_t *name)
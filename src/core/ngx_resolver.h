@@ -188,6 +188,9 @@ struct ngx_resolver_s {
     time_t                    expire;
     time_t                    valid;
 
+    ngx_shm_zone_t           *shm_zone;
+    time_t                    stale;
+
     ngx_uint_t                log_level;
 };
 
@@ -219,6 +222,7 @@ struct ngx_resolver_ctx_s {
     ngx_msec_t                timeout;
 
     ngx_uint_t                quick;  /* unsigned  quick:1; */
+    ngx_uint_t                refresh;  /* unsigned  refresh:1; */
     ngx_uint_t                recursion;
     ngx_event_t              *event;
 };
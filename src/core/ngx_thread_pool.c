@@ -16,20 +16,27 @@ typedef struct {
 } ngx_thread_pool_conf_t;
 
 
-typedef struct {
-    ngx_thread_task_t        *first;
-    ngx_thread_task_t       **last;
-} ngx_thread_pool_queue_t;
+/*
+ * the submission queue is a bounded lock-free ring: a cell is free
+ * for the position p if its sequence number is p, and holds a task
+ * for the position p if its sequence number is p + 1
+ */
 
-#define ngx_thread_pool_queue_init(q)                                         \
-    (q)->first = NULL;                                                        \
-    (q)->last = &(q)->first
+typedef struct {
+    ngx_atomic_t              seq;
+    ngx_thread_task_t        *task;
+} ngx_thread_pool_cell_t;
 
 
 struct ngx_thread_pool_s {
+    ngx_thread_pool_cell_t   *cells;
+    ngx_atomic_uint_t         mask;
+    ngx_atomic_t              head;
+    ngx_atomic_t              tail;
+
+    /* only used to put idle threads to sleep */
     ngx_thread_mutex_t        mtx;
-    ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
+    ngx_atomic_t              sleeping;
     ngx_thread_cond_t         cond;
 
     ngx_log_t                *log;
@@ -37,6 +44,14 @@ struct ngx_thread_pool_s {
     ngx_str_t                 name;
     ngx_uint_t                threads;
     ngx_int_t                 max_queue;
+    ngx_uint_t                spin;
+    ngx_uint_t                helper;  /* unsigned  helper:1; */
+
+    ngx_uint_t                posted;
+    ngx_int_t                 max_waiting;
+    ngx_atomic_t              completed;
+    ngx_atomic_t              wait_time;
+    ngx_atomic_t              run_time;
 
     u_char                   *file;
     ngx_uint_t                line;
@@ -48,8 +63,15 @@ static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
 static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
+static ngx_int_t ngx_thread_pool_queue_add(ngx_thread_pool_t *tp,
+    ngx_thread_task_t *task);
+static ngx_thread_task_t *ngx_thread_pool_queue_get(ngx_thread_pool_t *tp);
 static void *ngx_thread_pool_cycle(void *data);
+static ngx_uint_t ngx_thread_pool_spin(ngx_thread_pool_t *tp,
+    ngx_uint_t spin);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
+static ngx_uint_t ngx_thread_pool_usec(void);
+static void ngx_thread_pool_log_stats(ngx_thread_pool_t *tp, ngx_log_t *log);
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -63,7 +85,7 @@ static void ngx_thread_pool_exit_worker(ngx_cycle_t *cycle);
 static ngx_command_t  ngx_thread_pool_commands[] = {
 
     { ngx_string("thread_pool"),
-      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE23,
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1234,
       ngx_thread_pool,
       0,
       0,
@@ -99,8 +121,12 @@ ngx_module_t  ngx_thread_pool_module = {
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
 static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;
-static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+
+/*
+ * completed tasks are pushed by threads to a lock-free stack,
+ * which is taken as a whole by the event loop
+ */
+static ngx_atomic_t             ngx_thread_pool_done;
 
 
 static ngx_int_t
@@ -108,7 +134,7 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 {
     int             err;
     pthread_t       tid;
-    ngx_uint_t      n;
+    ngx_uint_t      n, size;
     pthread_attr_t  attr;
 
     if (ngx_notify == NULL) {
@@ -117,7 +143,33 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
+    /* the ring size is max_queue rounded up to a power of two */
+
+    for (size = 1; size < (ngx_uint_t) tp->max_queue; size <<= 1) {
+        /* void */
+    }
+
+    tp->cells = ngx_palloc(pool, size * sizeof(ngx_thread_pool_cell_t));
+    if (tp->cells == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < size; n++) {
+        tp->cells[n].seq = n;
+        tp->cells[n].task = NULL;
+    }
+
+    tp->mask = size - 1;
+    tp->head = 0;
+    tp->tail = 0;
+
+    tp->sleeping = 0;
+
+    tp->posted = 0;
+    tp->max_waiting = 0;
+    tp->completed = 0;
+    tp->wait_time = 0;
+    tp->run_time = 0;
 
     if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
         return NGX_ERROR;
@@ -230,22 +282,20 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 ngx_int_t
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
+    ngx_int_t  waiting;
+
     if (task->event.active) {
         ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
                       "task #%ui already active", task->id);
         return NGX_ERROR;
     }
 
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    waiting = (ngx_int_t) (tp->tail - tp->head);
 
+    if (waiting >= tp->max_queue) {
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
                       "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      &tp->name, waiting);
         return NGX_ERROR;
     }
 
@@ -253,18 +303,41 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 
     task->id = ngx_thread_pool_task_id++;
     task->next = NULL;
+    task->posted = ngx_thread_pool_usec();
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if (ngx_thread_pool_queue_add(tp, task) != NGX_OK) {
+        task->event.active = 0;
+
+        ngx_log_error(NGX_LOG_ERR, tp->log, 0,
+                      "thread pool \"%V\" queue overflow: %i tasks waiting",
+                      &tp->name, waiting);
         return NGX_ERROR;
     }
 
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    /*
+     * the tail is advanced with a full memory barrier, so either
+     * a thread going to sleep sees the task, or we see the thread;
+     * spinning threads pick up the task without a wakeup
+     */
+
+    if (tp->sleeping) {
+        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
+            (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+            return NGX_ERROR;
+        }
+
+        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    }
 
-    tp->waiting++;
+    tp->posted++;
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if (waiting + 1 > tp->max_waiting) {
+        tp->max_waiting = waiting + 1;
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                    "task #%ui added to thread pool \"%V\"",
@@ -274,6 +347,70 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 }
 
 
+static ngx_int_t
+ngx_thread_pool_queue_add(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    ngx_atomic_uint_t        pos;
+    ngx_thread_pool_cell_t  *cell;
+
+    /* tasks are only posted by the worker thread, so no cas is needed */
+
+    pos = tp->tail;
+    cell = &tp->cells[pos & tp->mask];
+
+    if (cell->seq != pos) {
+        /* the cell is not yet released by a thread */
+        return NGX_DECLINED;
+    }
+
+    cell->task = task;
+
+    ngx_memory_barrier();
+
+    cell->seq = pos + 1;
+
+    (void) ngx_atomic_fetch_add(&tp->tail, 1);
+
+    return NGX_OK;
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_queue_get(ngx_thread_pool_t *tp)
+{
+    ngx_atomic_uint_t        pos, seq;
+    ngx_thread_task_t       *task;
+    ngx_thread_pool_cell_t  *cell;
+
+    for ( ;; ) {
+        pos = tp->head;
+        cell = &tp->cells[pos & tp->mask];
+
+        seq = cell->seq;
+
+        ngx_memory_barrier();
+
+        if (seq == pos + 1) {
+            task = cell->task;
+
+            if (ngx_atomic_cmp_set(&tp->head, pos, pos + 1)) {
+                cell->seq = pos + tp->mask + 1;
+                return task;
+            }
+
+            continue;
+        }
+
+        if ((ngx_atomic_int_t) (seq - (pos + 1)) < 0) {
+            /* empty */
+            return NULL;
+        }
+
+        /* another thread took the task, retry with the new head */
+    }
+}
+
+
 static void *
 ngx_thread_pool_cycle(void *data)
 {
@@ -281,6 +418,8 @@ ngx_thread_pool_cycle(void *data)
 
     int                 err;
     sigset_t            set;
+    ngx_uint_t          spin, start, end;
+    ngx_atomic_uint_t   head;
     ngx_thread_task_t  *task;
 
 #if 0
@@ -290,6 +429,8 @@ ngx_thread_pool_cycle(void *data)
     ngx_log_debug1(NGX_LOG_DEBUG_CORE, tp->log, 0,
                    "thread in pool \"%V\" started", &tp->name);
 
+    spin = tp->spin;
+
     sigfillset(&set);
 
     sigdelset(&set, SIGILL);
@@ -304,31 +445,41 @@ ngx_thread_pool_cycle(void *data)
     }
 
     for ( ;; ) {
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+        if (tp->spin) {
+            spin = ngx_thread_pool_spin(tp, spin);
         }
 
-        /* the number may become negative */
-        tp->waiting--;
+        task = ngx_thread_pool_queue_get(tp);
 
-        while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
-            {
-                (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+        if (task == NULL) {
+            if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
                 return NULL;
             }
-        }
 
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            /* pairs with the barrier on the tail advance in the worker */
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
-        }
+            (void) ngx_atomic_fetch_add(&tp->sleeping, 1);
 
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+            for ( ;; ) {
+                task = ngx_thread_pool_queue_get(tp);
+
+                if (task) {
+                    break;
+                }
+
+                if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
+                    != NGX_OK)
+                {
+                    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+                    return NULL;
+                }
+            }
+
+            (void) ngx_atomic_fetch_add(&tp->sleeping, -1);
+
+            if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
         }
 
 #if 0
@@ -339,25 +490,66 @@ ngx_thread_pool_cycle(void *data)
                        "run task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
+        start = ngx_thread_pool_usec();
+
         task->handler(task->ctx, tp->log);
 
-        ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                       "complete task #%ui in thread pool \"%V\"",
-                       task->id, &tp->name);
+        end = ngx_thread_pool_usec();
 
-        task->next = NULL;
+        ngx_log_debug4(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                       "complete task #%ui in thread pool \"%V\", "
+                       "wait:%uius run:%uius",
+                       task->id, &tp->name, start - task->posted, end - start);
 
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+        (void) ngx_atomic_fetch_add(&tp->completed, 1);
+        (void) ngx_atomic_fetch_add(&tp->wait_time, start - task->posted);
+        (void) ngx_atomic_fetch_add(&tp->run_time, end - start);
 
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+        do {
+            head = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) head;
 
-        ngx_memory_barrier();
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head,
+                                     (ngx_atomic_uint_t) task));
+
+        /*
+         * the event loop is only notified about the first task
+         * in a batch, the rest are taken along with it
+         */
+
+        if (head == 0) {
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_thread_pool_spin(ngx_thread_pool_t *tp, ngx_uint_t spin)
+{
+    ngx_uint_t               i;
+    ngx_atomic_uint_t        pos;
+    ngx_thread_pool_cell_t  *cell;
 
-        ngx_unlock(&ngx_thread_pool_done_lock);
+    /*
+     * adaptive spinning before going to sleep: the number of iterations
+     * is doubled each time a task arrives while spinning, and halved
+     * otherwise
+     */
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+    for (i = 0; i < spin; i++) {
+
+        pos = tp->head;
+        cell = &tp->cells[pos & tp->mask];
+
+        if (cell->seq == pos + 1) {
+            return ngx_min(spin * 2, tp->spin);
+        }
+
+        ngx_cpu_pause();
     }
+
+    return ngx_max(spin / 2, 1);
 }
 
 
@@ -365,19 +557,29 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   head;
+    ngx_thread_task_t  *task, *next, *prev;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        head = ngx_thread_pool_done;
 
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, head, 0));
 
-    ngx_memory_barrier();
+    /* restore the completion order */
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    task = (ngx_thread_task_t *) head;
+    prev = NULL;
+
+    while (task) {
+        next = task->next;
+        task->next = prev;
+        prev = task;
+        task = next;
+    }
+
+    task = prev;
 
     while (task) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -394,6 +596,32 @@ ngx_thread_pool_handler(ngx_event_t *ev)
 }
 
 
+static ngx_uint_t
+ngx_thread_pool_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_uint_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void
+ngx_thread_pool_log_stats(ngx_thread_pool_t *tp, ngx_log_t *log)
+{
+    ngx_uint_t  n;
+
+    n = tp->completed;
+
+    ngx_log_error(NGX_LOG_INFO, log, 0,
+                  "thread pool \"%V\": %ui tasks, %uA completed, "
+                  "max queue %i, avg wait %uAus, avg run %uAus",
+                  &tp->name, tp->posted, tp->completed, tp->max_waiting,
+                  n ? tp->wait_time / n : 0, n ? tp->run_time / n : 0);
+}
+
+
 static void *
 ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
 {
@@ -502,6 +730,19 @@ ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
             continue;
         }
+
+        if (ngx_strncmp(value[i].data, "spin=", 5) == 0) {
+
+            tp->spin = ngx_atoi(value[i].data + 5, value[i].len - 5);
+
+            if (tp->spin == (ngx_uint_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid spin value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
     }
 
     if (tp->threads == 0) {
@@ -554,6 +795,24 @@ ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
 }
 
 
+ngx_thread_pool_t *
+ngx_thread_pool_add_helper(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_thread_pool_t  *tp;
+
+    tp = ngx_thread_pool_add(cf, name);
+    if (tp == NULL) {
+        return NULL;
+    }
+
+    /* the pool is also started in cache manager and loader processes */
+
+    tp->helper = 1;
+
+    return tp;
+}
+
+
 ngx_thread_pool_t *
 ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
 {
@@ -587,7 +846,8 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
     ngx_thread_pool_conf_t   *tcf;
 
     if (ngx_process != NGX_PROCESS_WORKER
-        && ngx_process != NGX_PROCESS_SINGLE)
+        && ngx_process != NGX_PROCESS_SINGLE
+        && ngx_process != NGX_PROCESS_HELPER)
     {
         return NGX_OK;
     }
@@ -599,11 +859,16 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
 
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) {
+
+        if (ngx_process == NGX_PROCESS_HELPER && !tpp[i]->helper) {
+            continue;
+        }
+
         if (ngx_thread_pool_init(tpp[i], cycle->log, cycle->pool) != NGX_OK) {
             return NGX_ERROR;
         }
@@ -636,6 +901,7 @@ ngx_thread_pool_exit_worker(ngx_cycle_t *cycle)
     tpp = tcf->pools.elts;
 
     for (i = 0; i < tcf->pools.nelts; i++) {
+        ngx_thread_pool_log_stats(tpp[i], cycle->log);
         ngx_thread_pool_destroy(tpp[i]);
     }
 }
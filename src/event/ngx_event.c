@@ -502,6 +502,7 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+    shm.huge_pages = NGX_HUGE_PAGES_OFF;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -681,15 +682,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 #endif
 
     cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
+        ngx_alloc_huge(sizeof(ngx_connection_t) * cycle->connection_n,
+                       ccf->huge_pages, cycle->log);
     if (cycle->connections == NULL) {
         return NGX_ERROR;
     }
 
     c = cycle->connections;
 
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
+    cycle->read_events = ngx_alloc_huge(sizeof(ngx_event_t)
+                                        * cycle->connection_n,
+                                        ccf->huge_pages, cycle->log);
     if (cycle->read_events == NULL) {
         return NGX_ERROR;
     }
@@ -700,8 +703,9 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         rev[i].instance = 1;
     }
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
+    cycle->write_events = ngx_alloc_huge(sizeof(ngx_event_t)
+                                         * cycle->connection_n,
+                                         ccf->huge_pages, cycle->log);
     if (cycle->write_events == NULL) {
         return NGX_ERROR;
     }
@@ -739,6 +743,12 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+        if (ls[i].incoming_cpu) {
+            ngx_set_listening_cpu(cycle, &ls[i]);
+        }
+#endif
+
         c = ngx_get_connection(ls[i].fd, cycle->log);
 
         if (c == NULL) {
@@ -821,6 +831,11 @@ ngx_event_process_init(ngx_cycle_t *cycle)
         rev->handler = (c->type == SOCK_STREAM) ? ngx_event_accept
                                                 : ngx_event_recvmsg;
 
+        if (c->type == SOCK_DGRAM) {
+            ngx_rbtree_init(&ls[i].rbtree, &ls[i].sentinel,
+                            ngx_udp_rbtree_insert_value);
+        }
+
 #if (NGX_HAVE_REUSEPORT)
 
         if (ls[i].reuseport) {
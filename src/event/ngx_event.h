@@ -504,8 +504,12 @@ extern ngx_module_t           ngx_event_core_module;
 
 
 void ngx_event_accept(ngx_event_t *ev);
+void ngx_event_handoff(ngx_cycle_t *cycle, ngx_socket_t s);
 #if !(NGX_WIN32)
 void ngx_event_recvmsg(ngx_event_t *ev);
+ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf, size_t size);
+void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 #endif
 ngx_int_t ngx_trylock_accept_mutex(ngx_cycle_t *cycle);
 u_char *ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len);
@@ -10,9 +10,72 @@
 #include <ngx_event.h>
 
 
+#if !(NGX_WIN32)
+
+#define NGX_EVENT_UDP_SIZE  65535
+
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+typedef union {
+#if (NGX_HAVE_IP_RECVDSTADDR)
+    u_char                    addr[CMSG_SPACE(sizeof(struct in_addr))];
+#elif (NGX_HAVE_IP_PKTINFO)
+    u_char                    addr[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#endif
+#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+    u_char                    addr6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+#endif
+    struct cmsghdr            cmsg;
+} ngx_event_udp_control_t;
+
+#endif
+
+
+typedef struct {
+    ngx_sockaddr_t            sockaddr;
+    struct iovec              iov;
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_event_udp_control_t   control;
+#endif
+} ngx_event_udp_msg_t;
+
+
+#if (NGX_HAVE_RECVMMSG)
+
+#define NGX_EVENT_RECVMMSG_BATCH  16
+
+typedef struct {
+    struct mmsghdr            msgs[NGX_EVENT_RECVMMSG_BATCH];
+    ngx_event_udp_msg_t       um[NGX_EVENT_RECVMMSG_BATCH];
+    u_char                    buffers[NGX_EVENT_RECVMMSG_BATCH]
+                                     [NGX_EVENT_UDP_SIZE];
+} ngx_event_recvmmsg_t;
+
+#endif
+
+#endif
+
+
 static ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
+#if !(NGX_WIN32)
+static void ngx_event_recvmsg_init(ngx_listening_t *ls, struct msghdr *msg,
+    ngx_event_udp_msg_t *um, u_char *buf, size_t size);
+#if (NGX_HAVE_RECVMMSG)
+static ngx_event_recvmmsg_t *ngx_event_recvmmsg_buffers(ngx_log_t *log);
+#endif
+static ngx_int_t ngx_event_udp_accept(ngx_event_t *ev, struct msghdr *msg,
+    u_char *buf, size_t n);
+static ngx_int_t ngx_udp_cmp_sockaddr(struct sockaddr *sa1, socklen_t len1,
+    struct sockaddr *sa2, socklen_t len2);
+static ngx_int_t ngx_insert_udp_connection(ngx_connection_t *c);
+static void ngx_delete_udp_connection(void *data);
+static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
+    struct sockaddr *sockaddr, socklen_t socklen,
+    struct sockaddr *local_sockaddr, socklen_t local_socklen);
+#endif
 #if (NGX_DEBUG)
 static void ngx_debug_accepted_connection(ngx_event_conf_t *ecf,
     ngx_connection_t *c);
@@ -316,35 +379,208 @@ ngx_event_accept(ngx_event_t *ev)
 }
 
 
-#if !(NGX_WIN32)
-
 void
-ngx_event_recvmsg(ngx_event_t *ev)
+ngx_event_handoff(ngx_cycle_t *cycle, ngx_socket_t s)
 {
-    ssize_t            n;
+    socklen_t          socklen, local_socklen;
     ngx_log_t         *log;
-    ngx_err_t          err;
-    ngx_event_t       *rev, *wev;
-    struct iovec       iov[1];
-    struct msghdr      msg;
-    ngx_sockaddr_t     sa;
-    ngx_listening_t   *ls;
-    ngx_event_conf_t  *ecf;
-    ngx_connection_t  *c, *lc;
-    static u_char      buffer[65535];
+    ngx_uint_t         i;
+    ngx_sockaddr_t     sa, local;
+    ngx_listening_t   *ls, *found;
+    ngx_connection_t  *c;
 
-#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    /* a connection passed by an exiting worker process */
 
-#if (NGX_HAVE_IP_RECVDSTADDR)
-    u_char             msg_control[CMSG_SPACE(sizeof(struct in_addr))];
-#elif (NGX_HAVE_IP_PKTINFO)
-    u_char             msg_control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    socklen = sizeof(ngx_sockaddr_t);
+
+    if (getpeername(s, &sa.sockaddr, &socklen) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, ngx_socket_errno,
+                       "handoff getpeername() failed");
+        goto close;
+    }
+
+    local_socklen = sizeof(ngx_sockaddr_t);
+
+    if (getsockname(s, &local.sockaddr, &local_socklen) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, ngx_socket_errno,
+                       "handoff getsockname() failed");
+        goto close;
+    }
+
+    found = NULL;
+    ls = cycle->listening.elts;
+
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        /* only idle http connections are handed off */
+
+        if (ls[i].fd == (ngx_socket_t) -1
+            || ls[i].type != SOCK_STREAM
+            || !ls[i].handoff)
+        {
+            continue;
+        }
+
+#if (NGX_HAVE_REUSEPORT)
+        if (ls[i].reuseport && ls[i].worker != ngx_worker) {
+            continue;
+        }
 #endif
 
-#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
-    u_char             msg_control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+        if (ngx_cmp_sockaddr(ls[i].sockaddr, ls[i].socklen,
+                             &local.sockaddr, local_socklen, 1)
+            == NGX_OK)
+        {
+            found = &ls[i];
+            break;
+        }
+
+        if (found == NULL
+            && ls[i].wildcard
+            && ls[i].sockaddr->sa_family == local.sockaddr.sa_family
+            && ngx_inet_get_port(ls[i].sockaddr)
+               == ngx_inet_get_port(&local.sockaddr))
+        {
+            found = &ls[i];
+        }
+    }
+
+    if (found == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "no listening socket for handoff");
+        goto close;
+    }
+
+    ls = found;
+
+    ngx_accept_disabled = cycle->connection_n / 8 - cycle->free_connection_n;
+
+    c = ngx_get_connection(s, cycle->log);
+
+    if (c == NULL) {
+        goto close;
+    }
+
+    c->type = SOCK_STREAM;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
 #endif
 
+    c->pool = ngx_create_pool(ls->pool_size, cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    ngx_memcpy(c->sockaddr, &sa, socklen);
+
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_accepted_connection(c);
+        return;
+    }
+
+    *log = ls->log;
+
+    c->recv = ngx_recv;
+    c->send = ngx_send;
+    c->recv_chain = ngx_recv_chain;
+    c->send_chain = ngx_send_chain;
+
+    c->log = log;
+    c->pool->log = log;
+
+    c->socklen = socklen;
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (c->sockaddr->sa_family == AF_UNIX) {
+        c->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+        c->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+#if (NGX_SOLARIS)
+        c->sendfile = 0;
+#endif
+    }
+#endif
+
+    c->read->log = log;
+    c->write->log = log;
+    c->write->ready = 1;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "*%uA handoff: %V fd:%d", c->number, &c->addr_text, s);
+
+    if (ngx_add_conn && (ngx_event_flags & NGX_USE_EPOLL_EVENT) == 0) {
+        if (ngx_add_conn(c) == NGX_ERROR) {
+            ngx_close_accepted_connection(c);
+            return;
+        }
+    }
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    /* the protocol module resets the flag once the connection is checked */
+
+    c->handoff = 1;
+
+    ls->handler(c);
+
+    return;
+
+close:
+
+    if (ngx_close_socket(s) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_close_socket_n " failed");
+    }
+}
+
+
+#if !(NGX_WIN32)
+
+void
+ngx_event_recvmsg(ngx_event_t *ev)
+{
+    ssize_t               n;
+    ngx_err_t             err;
+    struct msghdr         msg;
+    ngx_listening_t      *ls;
+    ngx_event_conf_t     *ecf;
+    ngx_connection_t     *lc;
+    ngx_event_udp_msg_t   um;
+    static u_char         buffer[65535];
+
+#if (NGX_HAVE_RECVMMSG)
+    ngx_uint_t            i;
+    ngx_event_recvmmsg_t *mm;
 #endif
 
     if (ev->timedout) {
@@ -368,38 +604,66 @@ ngx_event_recvmsg(ngx_event_t *ev)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "recvmsg on %V, ready: %d", &ls->addr_text, ev->available);
 
+#if (NGX_HAVE_RECVMMSG)
+
+    mm = ngx_event_recvmmsg_buffers(ev->log);
+
+#endif
+
     do {
-        ngx_memzero(&msg, sizeof(struct msghdr));
 
-        iov[0].iov_base = (void *) buffer;
-        iov[0].iov_len = sizeof(buffer);
+#if (NGX_HAVE_RECVMMSG)
 
-        msg.msg_name = &sa;
-        msg.msg_namelen = sizeof(ngx_sockaddr_t);
-        msg.msg_iov = iov;
-        msg.msg_iovlen = 1;
+        if (mm) {
+            for (i = 0; i < NGX_EVENT_RECVMMSG_BATCH; i++) {
+                ngx_event_recvmsg_init(ls, &mm->msgs[i].msg_hdr, &mm->um[i],
+                                       mm->buffers[i], NGX_EVENT_UDP_SIZE);
+                mm->msgs[i].msg_len = 0;
+            }
 
-#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+            n = recvmmsg(lc->fd, mm->msgs, NGX_EVENT_RECVMMSG_BATCH, 0, NULL);
 
-        if (ls->wildcard) {
+            if (n == -1) {
+                err = ngx_socket_errno;
 
-#if (NGX_HAVE_IP_RECVDSTADDR || NGX_HAVE_IP_PKTINFO)
-            if (ls->sockaddr->sa_family == AF_INET) {
-                msg.msg_control = &msg_control;
-                msg.msg_controllen = sizeof(msg_control);
+                if (err == NGX_EAGAIN) {
+                    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err,
+                                   "recvmmsg() not ready");
+                    return;
+                }
+
+                ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                              "recvmmsg() failed");
+
+                return;
             }
-#endif
 
-#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
-            if (ls->sockaddr->sa_family == AF_INET6) {
-                msg.msg_control = &msg_control6;
-                msg.msg_controllen = sizeof(msg_control6);
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "recvmmsg: %z datagrams", n);
+
+            for (i = 0; i < (ngx_uint_t) n; i++) {
+                if (ngx_event_udp_accept(ev, &mm->msgs[i].msg_hdr,
+                                         mm->buffers[i], mm->msgs[i].msg_len)
+                    != NGX_OK)
+                {
+                    return;
+                }
             }
-#endif
+
+            if (n < NGX_EVENT_RECVMMSG_BATCH) {
+
+                /* the socket is drained */
+
+                return;
+            }
+
+            continue;
         }
 
 #endif
 
+        ngx_event_recvmsg_init(ls, &msg, &um, buffer, sizeof(buffer));
+
         n = recvmsg(lc->fd, &msg, 0);
 
         if (n == -1) {
@@ -416,220 +680,632 @@ ngx_event_recvmsg(ngx_event_t *ev)
             return;
         }
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
-#endif
+        if (ngx_event_udp_accept(ev, &msg, buffer, n) != NGX_OK) {
+            return;
+        }
+
+    } while (ev->available);
+}
+
+
+static void
+ngx_event_recvmsg_init(ngx_listening_t *ls, struct msghdr *msg,
+    ngx_event_udp_msg_t *um, u_char *buf, size_t size)
+{
+    ngx_memzero(msg, sizeof(struct msghdr));
+
+    um->iov.iov_base = (void *) buf;
+    um->iov.iov_len = size;
+
+    msg->msg_name = &um->sockaddr;
+    msg->msg_namelen = sizeof(ngx_sockaddr_t);
+    msg->msg_iov = &um->iov;
+    msg->msg_iovlen = 1;
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
-        if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
-            ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
-                          "recvmsg() truncated data");
-            continue;
-        }
-#endif
 
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
+    if (ls->wildcard) {
 
-        c = ngx_get_connection(lc->fd, ev->log);
-        if (c == NULL) {
-            return;
+#if (NGX_HAVE_IP_RECVDSTADDR || NGX_HAVE_IP_PKTINFO)
+        if (ls->sockaddr->sa_family == AF_INET) {
+            msg->msg_control = &um->control;
+            msg->msg_controllen = sizeof(um->control.addr);
         }
+#endif
 
-        c->shared = 1;
-        c->type = SOCK_DGRAM;
-        c->socklen = msg.msg_namelen;
+#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+        if (ls->sockaddr->sa_family == AF_INET6) {
+            msg->msg_control = &um->control;
+            msg->msg_controllen = sizeof(um->control.addr6);
+        }
+#endif
+    }
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
 #endif
+}
 
-        c->pool = ngx_create_pool(ls->pool_size, ev->log);
-        if (c->pool == NULL) {
-            ngx_close_accepted_connection(c);
-            return;
-        }
 
-        c->sockaddr = ngx_palloc(c->pool, c->socklen);
-        if (c->sockaddr == NULL) {
-            ngx_close_accepted_connection(c);
-            return;
-        }
+#if (NGX_HAVE_RECVMMSG)
 
-        ngx_memcpy(c->sockaddr, msg.msg_name, c->socklen);
+static ngx_event_recvmmsg_t *
+ngx_event_recvmmsg_buffers(ngx_log_t *log)
+{
+    static ngx_event_recvmmsg_t  *mm;
+    static ngx_uint_t             failed;
 
-        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
-        if (log == NULL) {
-            ngx_close_accepted_connection(c);
-            return;
+    /*
+     * the buffers are allocated on first use, so worker processes
+     * without UDP listening sockets do not waste memory on them
+     */
+
+    if (mm == NULL && !failed) {
+        mm = ngx_alloc(sizeof(ngx_event_recvmmsg_t), log);
+
+        if (mm == NULL) {
+            failed = 1;
         }
+    }
 
-        *log = ls->log;
+    return mm;
+}
 
-        c->send = ngx_udp_send;
-        c->send_chain = ngx_udp_send_chain;
+#endif
 
-        c->log = log;
-        c->pool->log = log;
 
-        c->listening = ls;
-        c->local_sockaddr = ls->sockaddr;
-        c->local_socklen = ls->socklen;
+static ngx_int_t
+ngx_event_udp_accept(ngx_event_t *ev, struct msghdr *msg, u_char *buf,
+    size_t n)
+{
+    u_char            *p;
+    size_t             size;
+    socklen_t          local_socklen;
+    ngx_buf_t         *b, sb;
+    ngx_log_t         *log;
+    ngx_event_t       *rev, *wev;
+    struct sockaddr   *local_sockaddr;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c, *lc;
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_sockaddr_t     lsa;
+#endif
 
-        if (ls->wildcard) {
-            struct cmsghdr   *cmsg;
-            struct sockaddr  *sockaddr;
+    lc = ev->data;
+    ls = lc->listening;
 
-            sockaddr = ngx_palloc(c->pool, c->local_socklen);
-            if (sockaddr == NULL) {
-                ngx_close_accepted_connection(c);
-                return;
-            }
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    if (msg->msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, 0,
+                      "recvmsg() truncated data");
+        return NGX_OK;
+    }
+#endif
 
-            ngx_memcpy(sockaddr, c->local_sockaddr, c->local_socklen);
-            c->local_sockaddr = sockaddr;
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        ev->available -= n;
+    }
 
-            for (cmsg = CMSG_FIRSTHDR(&msg);
-                 cmsg != NULL;
-                 cmsg = CMSG_NXTHDR(&msg, cmsg))
-            {
+    local_sockaddr = ls->sockaddr;
+    local_socklen = ls->socklen;
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+    if (ls->wildcard) {
+        struct cmsghdr  *cmsg;
+
+        ngx_memcpy(&lsa, ls->sockaddr, ls->socklen);
+        local_sockaddr = &lsa.sockaddr;
+
+        for (cmsg = CMSG_FIRSTHDR(msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(msg, cmsg))
+        {
 
 #if (NGX_HAVE_IP_RECVDSTADDR)
 
-                if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_RECVDSTADDR
-                    && sockaddr->sa_family == AF_INET)
-                {
-                    struct in_addr      *addr;
-                    struct sockaddr_in  *sin;
+            if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_RECVDSTADDR
+                && local_sockaddr->sa_family == AF_INET)
+            {
+                struct in_addr      *addr;
+                struct sockaddr_in  *sin;
 
-                    addr = (struct in_addr *) CMSG_DATA(cmsg);
-                    sin = (struct sockaddr_in *) sockaddr;
-                    sin->sin_addr = *addr;
+                addr = (struct in_addr *) CMSG_DATA(cmsg);
+                sin = (struct sockaddr_in *) local_sockaddr;
+                sin->sin_addr = *addr;
 
-                    break;
-                }
+                break;
+            }
 
 #elif (NGX_HAVE_IP_PKTINFO)
 
-                if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_PKTINFO
-                    && sockaddr->sa_family == AF_INET)
-                {
-                    struct in_pktinfo   *pkt;
-                    struct sockaddr_in  *sin;
+            if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_PKTINFO
+                && local_sockaddr->sa_family == AF_INET)
+            {
+                struct in_pktinfo   *pkt;
+                struct sockaddr_in  *sin;
 
-                    pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-                    sin = (struct sockaddr_in *) sockaddr;
-                    sin->sin_addr = pkt->ipi_addr;
+                pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+                sin = (struct sockaddr_in *) local_sockaddr;
+                sin->sin_addr = pkt->ipi_addr;
 
-                    break;
-                }
+                break;
+            }
 
 #endif
 
 #if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
 
-                if (cmsg->cmsg_level == IPPROTO_IPV6
-                    && cmsg->cmsg_type == IPV6_PKTINFO
-                    && sockaddr->sa_family == AF_INET6)
-                {
-                    struct in6_pktinfo   *pkt6;
-                    struct sockaddr_in6  *sin6;
+            if (cmsg->cmsg_level == IPPROTO_IPV6
+                && cmsg->cmsg_type == IPV6_PKTINFO
+                && local_sockaddr->sa_family == AF_INET6)
+            {
+                struct in6_pktinfo   *pkt6;
+                struct sockaddr_in6  *sin6;
 
-                    pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-                    sin6 = (struct sockaddr_in6 *) sockaddr;
-                    sin6->sin6_addr = pkt6->ipi6_addr;
+                pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+                sin6 = (struct sockaddr_in6 *) local_sockaddr;
+                sin6->sin6_addr = pkt6->ipi6_addr;
 
-                    break;
-                }
+                break;
+            }
 
 #endif
 
-            }
         }
+    }
+
+#endif
+
+    c = ngx_lookup_udp_connection(ls, msg->msg_name, msg->msg_namelen,
+                                  local_sockaddr, local_socklen);
+
+    if (c) {
+
+        /* a datagram of an existing session */
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "*%uA recvmsg: fd:%d n:%z", c->number, c->fd, n);
+
+        ngx_memzero(&sb, sizeof(ngx_buf_t));
+
+        sb.pos = buf;
+        sb.last = buf + n;
+
+        rev = c->read;
+
+        c->udp->buffer = &sb;
+        rev->ready = 1;
+
+        rev->handler(rev);
+
+        if (c->udp) {
+
+            /* the session is still alive */
+
+            c->udp->buffer = NULL;
+            rev->ready = 0;
+        }
+
+        return NGX_OK;
+    }
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+#endif
+
+    if (ls->max_sessions && ls->sessions >= ls->max_sessions) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                      "%ui udp sessions are not enough on %V",
+                      ls->max_sessions, &ls->addr_text);
+        return NGX_OK;
+    }
+
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
+
+    c = ngx_get_connection(lc->fd, ev->log);
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
+
+    c->shared = 1;
+    c->type = SOCK_DGRAM;
+    c->socklen = msg->msg_namelen;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+#endif
+
+    c->pool = ngx_create_pool(ls->pool_size, ev->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    /*
+     * the session table entry, the log, the buffer, the addresses,
+     * and the datagram itself are allocated from the pool at once
+     */
+
+    size = sizeof(ngx_udp_connection_t) + sizeof(ngx_log_t)
+           + sizeof(ngx_buf_t) + ngx_align(c->socklen, NGX_ALIGNMENT);
+
+    if (local_sockaddr != ls->sockaddr) {
+        size += ngx_align(local_socklen, NGX_ALIGNMENT);
+    }
+
+    size += n;
+
+    if (ls->addr_ntop) {
+        size += ls->addr_text_max_len;
+    }
 
+    p = ngx_palloc(c->pool, size);
+    if (p == NULL) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
+
+    c->udp = (ngx_udp_connection_t *) p;
+    p += sizeof(ngx_udp_connection_t);
+
+    log = (ngx_log_t *) p;
+    p += sizeof(ngx_log_t);
+
+    b = (ngx_buf_t *) p;
+    p += sizeof(ngx_buf_t);
+
+    c->sockaddr = (struct sockaddr *) p;
+    p += ngx_align(c->socklen, NGX_ALIGNMENT);
+
+    ngx_memcpy(c->sockaddr, msg->msg_name, c->socklen);
+
+    *log = ls->log;
+
+    c->recv = ngx_udp_shared_recv;
+    c->send = ngx_udp_send;
+    c->send_chain = ngx_udp_send_chain;
+
+    c->log = log;
+    c->pool->log = log;
+
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
+
+    if (local_sockaddr != ls->sockaddr) {
+        c->local_sockaddr = (struct sockaddr *) p;
+        p += ngx_align(local_socklen, NGX_ALIGNMENT);
+
+        ngx_memcpy(c->local_sockaddr, local_sockaddr, local_socklen);
+    }
+
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    b->start = p;
+    b->pos = p;
+    b->last = ngx_cpymem(p, buf, n);
+    b->end = b->last;
+    b->temporary = 1;
+
+    p += n;
+
+    c->buffer = b;
+
+    rev = c->read;
+    wev = c->write;
+
+    /* the listening socket is already in the event loop */
+
+    rev->active = 1;
+    wev->ready = 1;
+
+    rev->log = log;
+    wev->log = log;
+
+    /*
+     * TODO: MT: - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     *
+     * TODO: MP: - allocated in a shared memory
+     *           - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     */
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
 #endif
 
-        c->buffer = ngx_create_temp_buf(c->pool, n);
-        if (c->buffer == NULL) {
+    if (ls->addr_ntop) {
+        c->addr_text.data = p;
+
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
             ngx_close_accepted_connection(c);
-            return;
+            return NGX_ERROR;
         }
+    }
 
-        c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
+    if (ngx_insert_udp_connection(c) != NGX_OK) {
+        ngx_close_accepted_connection(c);
+        return NGX_ERROR;
+    }
 
-        rev = c->read;
-        wev = c->write;
+#if (NGX_DEBUG)
+    {
+    ngx_str_t          addr;
+    u_char             text[NGX_SOCKADDR_STRLEN];
+    ngx_event_conf_t  *ecf;
 
-        wev->ready = 1;
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
-        rev->log = log;
-        wev->log = log;
+    ngx_debug_accepted_connection(ecf, c);
+
+    if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+        addr.data = text;
+        addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
+                                 NGX_SOCKADDR_STRLEN, 1);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "*%uA recvmsg: %V fd:%d n:%z",
+                       c->number, &addr, c->fd, n);
+    }
+
+    }
+#endif
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    ls->handler(c);
+
+    return NGX_OK;
+}
+
+
+ssize_t
+ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t     n;
+    ngx_buf_t  *b;
+
+    if (c->udp == NULL || c->udp->buffer == NULL) {
+        c->read->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    b = c->udp->buffer;
+
+    n = b->last - b->pos;
+
+    c->udp->buffer = NULL;
+    c->read->ready = 0;
+
+    if ((size_t) n > size) {
 
         /*
-         * TODO: MT: - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         *
-         * TODO: MP: - allocated in a shared memory
-         *           - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
+         * a datagram is never passed partially; the one which does not
+         * fit is dropped, as it cannot be kept until there is room
          */
 
-        c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "udp datagram of %z bytes does not fit "
+                      "into %uz bytes of buffer, dropped", n, size);
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
-#endif
+        return NGX_AGAIN;
+    }
 
-        if (ls->addr_ntop) {
-            c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
-            if (c->addr_text.data == NULL) {
-                ngx_close_accepted_connection(c);
-                return;
-            }
+    ngx_memcpy(buf, b->pos, n);
 
-            c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
-                                             c->addr_text.data,
-                                             ls->addr_text_max_len, 0);
-            if (c->addr_text.len == 0) {
-                ngx_close_accepted_connection(c);
-                return;
+    return n;
+}
+
+
+void
+ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t               rc;
+    ngx_connection_t       *c, *ct;
+    ngx_rbtree_node_t     **p;
+    ngx_udp_connection_t   *udp, *udpt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            udp = (ngx_udp_connection_t *) node;
+            c = udp->connection;
+
+            udpt = (ngx_udp_connection_t *) temp;
+            ct = udpt->connection;
+
+            rc = ngx_udp_cmp_sockaddr(c->sockaddr, c->socklen,
+                                      ct->sockaddr, ct->socklen);
+
+            if (rc == 0 && c->listening->wildcard) {
+                rc = ngx_udp_cmp_sockaddr(c->local_sockaddr, c->local_socklen,
+                                          ct->local_sockaddr,
+                                          ct->local_socklen);
             }
+
+            p = (rc < 0) ? &temp->left : &temp->right;
         }
 
-#if (NGX_DEBUG)
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_udp_cmp_sockaddr(struct sockaddr *sa1, socklen_t len1,
+    struct sockaddr *sa2, socklen_t len2)
+{
+    /*
+     * addresses returned by recvmsg() are compared as is to order
+     * sessions with colliding hashes
+     */
+
+    if (len1 != len2) {
+        return (len1 < len2) ? -1 : 1;
+    }
+
+    return ngx_memcmp(sa1, sa2, len1);
+}
+
+
+static ngx_int_t
+ngx_insert_udp_connection(ngx_connection_t *c)
+{
+    uint32_t               hash;
+    ngx_pool_cleanup_t    *cln;
+    ngx_udp_connection_t  *udp;
+
+    udp = c->udp;
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, (u_char *) c->sockaddr, c->socklen);
+
+    if (c->listening->wildcard) {
+        ngx_crc32_update(&hash, (u_char *) c->local_sockaddr,
+                         c->local_socklen);
+    }
+
+    ngx_crc32_final(hash);
+
+    udp->node.key = hash;
+    udp->connection = c;
+    udp->buffer = NULL;
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        c->udp = NULL;
+        return NGX_ERROR;
+    }
+
+    cln->data = c;
+    cln->handler = ngx_delete_udp_connection;
+
+    ngx_rbtree_insert(&c->listening->rbtree, &udp->node);
+
+    c->listening->sessions++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_delete_udp_connection(void *data)
+{
+    ngx_connection_t  *c = data;
+
+    if (c->udp == NULL) {
+        return;
+    }
+
+    ngx_rbtree_delete(&c->listening->rbtree, &c->udp->node);
+
+    c->listening->sessions--;
+
+    c->udp = NULL;
+}
+
+
+static ngx_connection_t *
+ngx_lookup_udp_connection(ngx_listening_t *ls, struct sockaddr *sockaddr,
+    socklen_t socklen, struct sockaddr *local_sockaddr, socklen_t local_socklen)
+{
+    uint32_t               hash;
+    ngx_int_t              rc;
+    ngx_connection_t      *c;
+    ngx_rbtree_node_t     *node, *sentinel;
+    ngx_udp_connection_t  *udp;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+    if (sockaddr->sa_family == AF_UNIX) {
+        struct sockaddr_un *saun = (struct sockaddr_un *) sockaddr;
+
+        if (socklen <= (socklen_t) offsetof(struct sockaddr_un, sun_path)
+            || saun->sun_path[0] == '\0')
         {
-        ngx_str_t  addr;
-        u_char     text[NGX_SOCKADDR_STRLEN];
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                           "unbound unix socket");
+            return NULL;
+        }
+    }
 
-        ngx_debug_accepted_connection(ecf, c);
+#endif
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            addr.data = text;
-            addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
-                                     NGX_SOCKADDR_STRLEN, 1);
+    node = ls->rbtree.root;
+    sentinel = ls->rbtree.sentinel;
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, (u_char *) sockaddr, socklen);
+
+    if (ls->wildcard) {
+        ngx_crc32_update(&hash, (u_char *) local_sockaddr, local_socklen);
+    }
+
+    ngx_crc32_final(hash);
+
+    while (node != sentinel) {
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                           "*%uA recvmsg: %V fd:%d n:%z",
-                           c->number, &addr, c->fd, n);
+        if (hash < node->key) {
+            node = node->left;
+            continue;
         }
 
+        if (hash > node->key) {
+            node = node->right;
+            continue;
         }
-#endif
 
-        log->data = NULL;
-        log->handler = NULL;
+        /* hash == node->key */
 
-        ls->handler(c);
+        udp = (ngx_udp_connection_t *) node;
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-            ev->available -= n;
+        c = udp->connection;
+
+        rc = ngx_udp_cmp_sockaddr(sockaddr, socklen, c->sockaddr, c->socklen);
+
+        if (rc == 0 && ls->wildcard) {
+            rc = ngx_udp_cmp_sockaddr(local_sockaddr, local_socklen,
+                                      c->local_sockaddr, c->local_socklen);
         }
 
-    } while (ev->available);
+        if (rc == 0) {
+            return c;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
 }
 
 #endif
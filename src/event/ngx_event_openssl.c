@@ -53,6 +53,8 @@ static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
+static ngx_int_t ngx_ssl_session_ticket_key_create(
+    ngx_ssl_session_ticket_key_t *key);
 #endif
 
 #ifndef X509_CHECK_FLAG_ALWAYS_CHECK_SUBJECT
@@ -387,6 +389,8 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(cert);
+
     /*
      * we can't use SSL_CTX_use_certificate_chain_file() as it doesn't
      * allow to access certificate later from SSL_CTX, so we reimplement
@@ -565,6 +569,8 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(key);
+
     if (passwords) {
         tries = passwords->nelts;
         pwd = passwords->elts;
@@ -671,6 +677,8 @@ ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(cert);
+
     if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
         == 0)
     {
@@ -722,6 +730,8 @@ ngx_ssl_trusted_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(cert);
+
     if (SSL_CTX_load_verify_locations(ssl->ctx, (char *) cert->data, NULL)
         == 0)
     {
@@ -756,6 +766,8 @@ ngx_ssl_crl(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *crl)
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(crl);
+
     store = SSL_CTX_get_cert_store(ssl->ctx);
 
     if (store == NULL) {
@@ -913,6 +925,8 @@ ngx_ssl_read_password_file(ngx_conf_t *cf, ngx_str_t *file)
         return NULL;
     }
 
+    ngx_conf_digest_file(file);
+
     cln = ngx_pool_cleanup_add(cf->temp_pool, 0);
     passwords = ngx_array_create(cf->temp_pool, 4, sizeof(ngx_str_t));
 
@@ -1053,6 +1067,8 @@ ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
         return NGX_ERROR;
     }
 
+    ngx_conf_digest_file(file);
+
     bio = BIO_new_file((char *) file->data, "r");
     if (bio == NULL) {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
@@ -2215,6 +2231,18 @@ ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
 
     SSL_CTX_set_timeout(ssl->ctx, (long) timeout);
 
+    if (shm_zone) {
+
+        /*
+         * a shared cache may be used by several protocols, e.g. by http
+         * and stream servers with the same certificates, so the session
+         * context is derived from the cache name to allow resumption
+         * across them
+         */
+
+        sess_ctx = &shm_zone->shm.name;
+    }
+
     if (ngx_ssl_session_id_context(ssl, sess_ctx) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -2274,6 +2302,18 @@ ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
                           "SSL_CTX_set_ex_data() failed");
             return NGX_ERROR;
         }
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+        /*
+         * unless keys are loaded with "ssl_session_ticket_key",
+         * session tickets are protected by keys kept in the cache zone,
+         * which are rotated every "ssl_session_timeout"
+         */
+
+        SSL_CTX_set_tlsext_ticket_key_cb(ssl->ctx,
+                                         ngx_ssl_session_ticket_key_callback);
+#endif
     }
 
     return NGX_OK;
@@ -2408,6 +2448,23 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     ngx_queue_init(&cache->expire_queue);
 
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+    /* the keys are rotated on first use */
+
+    cache->ticket_keys_rotate = 0;
+
+    if (ngx_ssl_session_ticket_key_create(&cache->ticket_keys[0]) != NGX_OK
+        || ngx_ssl_session_ticket_key_create(&cache->ticket_keys[1])
+           != NGX_OK)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "RAND_bytes() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
     shpool->log_ctx = ngx_slab_alloc(shpool, len);
@@ -2901,6 +2958,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
             return NGX_ERROR;
         }
 
+        ngx_conf_digest_file(&path[i]);
+
         ngx_memzero(&file, sizeof(ngx_file_t));
         file.name = path[i];
         file.log = cf->log;
@@ -3004,10 +3063,13 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
 {
     size_t                         size;
     SSL_CTX                       *ssl_ctx;
-    ngx_uint_t                     i;
+    ngx_uint_t                     i, nkeys;
     ngx_array_t                   *keys;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_slab_pool_t               *shpool;
     ngx_connection_t              *c;
-    ngx_ssl_session_ticket_key_t  *key;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key, shkeys[2], newkey;
     const EVP_MD                  *digest;
     const EVP_CIPHER              *cipher;
 #if (NGX_DEBUG)
@@ -3024,11 +3086,49 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
 #endif
 
     keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
-    if (keys == NULL) {
-        return -1;
-    }
 
-    key = keys->elts;
+    if (keys) {
+        key = keys->elts;
+        nkeys = keys->nelts;
+
+    } else {
+        shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+        if (shm_zone == NULL) {
+            return -1;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+        cache = shm_zone->data;
+
+        ngx_shmtx_lock(&shpool->mutex);
+
+        if (cache->ticket_keys_rotate <= ngx_time()) {
+
+            if (ngx_ssl_session_ticket_key_create(&newkey) != NGX_OK) {
+                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "RAND_bytes() failed");
+                return -1;
+            }
+
+            /* the previous key is only used to decrypt tickets */
+
+            cache->ticket_keys[1] = cache->ticket_keys[0];
+            cache->ticket_keys[0] = newkey;
+
+            cache->ticket_keys_rotate = ngx_time()
+                                        + SSL_CTX_get_timeout(ssl_ctx);
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "ssl session ticket keys rotated");
+        }
+
+        ngx_memcpy(shkeys, cache->ticket_keys, sizeof(shkeys));
+
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        key = shkeys;
+        nkeys = 2;
+    }
 
     if (enc == 1) {
         /* encrypt session ticket */
@@ -3074,7 +3174,7 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     } else {
         /* decrypt session ticket */
 
-        for (i = 0; i < keys->nelts; i++) {
+        for (i = 0; i < nkeys; i++) {
             if (ngx_memcmp(name, key[i].name, 16) == 0) {
                 goto found;
             }
@@ -3121,6 +3221,22 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     }
 }
 
+
+static ngx_int_t
+ngx_ssl_session_ticket_key_create(ngx_ssl_session_ticket_key_t *key)
+{
+    key->size = 80;
+
+    if (RAND_bytes(key->name, 16) != 1
+        || RAND_bytes(key->hmac_key, 32) != 1
+        || RAND_bytes(key->aes_key, 32) != 1)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
 #else
 
 ngx_int_t
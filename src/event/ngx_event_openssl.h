@@ -112,13 +112,6 @@ struct ngx_ssl_sess_id_s {
 };
 
 
-typedef struct {
-    ngx_rbtree_t                session_rbtree;
-    ngx_rbtree_node_t           sentinel;
-    ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
-
-
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct {
@@ -131,6 +124,17 @@ typedef struct {
 #endif
 
 
+typedef struct {
+    ngx_rbtree_t                session_rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    ngx_ssl_session_ticket_key_t  ticket_keys[2];
+    time_t                        ticket_keys_rotate;
+#endif
+} ngx_ssl_session_cache_t;
+
+
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
 #define NGX_SSL_TLSv1    0x0008
@@ -256,5 +260,7 @@ extern int  ngx_ssl_next_certificate_index;
 extern int  ngx_ssl_certificate_name_index;
 extern int  ngx_ssl_stapling_index;
 
+extern ngx_module_t  ngx_openssl_module;
+
 
 #endif /* _NGX_EVENT_OPENSSL_H_INCLUDED_ */
@@ -695,6 +695,8 @@ ngx_http_geoip_country(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->country, GEOIP_CHARSET_UTF8);
@@ -750,6 +752,8 @@ ngx_http_geoip_org(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->org, GEOIP_CHARSET_UTF8);
@@ -811,6 +815,8 @@ ngx_http_geoip_city(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->city, GEOIP_CHARSET_UTF8);
@@ -264,17 +264,26 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = 0;
-    b->file_last = of.size;
-
-    b->in_file = b->file_last ? 1 : 0;
     b->last_buf = (r == r->main) ? 1 : 0;
     b->last_in_chain = 1;
 
-    b->file->fd = of.fd;
-    b->file->name = path;
-    b->file->log = log;
-    b->file->directio = of.is_directio;
+    rc = ngx_http_static_cache_body(r, &path, &of, b);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        b->file_pos = 0;
+        b->file_last = of.size;
+
+        b->in_file = b->file_last ? 1 : 0;
+
+        b->file->fd = of.fd;
+        b->file->name = path;
+        b->file->log = log;
+        b->file->directio = of.is_directio;
+    }
 
     out.buf = b;
     out.next = NULL;
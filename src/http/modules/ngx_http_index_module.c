@@ -23,6 +23,14 @@ typedef struct {
 } ngx_http_index_loc_conf_t;
 
 
+typedef struct {
+    ngx_uint_t               index;
+    ngx_err_t                err;
+    char                    *failed;
+    ngx_uint_t               dir_tested;  /* unsigned  dir_tested:1; */
+} ngx_http_index_ctx_t;
+
+
 #define NGX_HTTP_DEFAULT_INDEX   "index.html"
 
 
@@ -30,6 +38,8 @@ static ngx_int_t ngx_http_index_test_dir(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, u_char *path, u_char *last);
 static ngx_int_t ngx_http_index_error(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, u_char *file, ngx_err_t err);
+static ngx_int_t ngx_http_index_suspend(ngx_http_request_t *r,
+    ngx_uint_t index, ngx_uint_t dir_tested, ngx_open_file_info_t *of);
 
 static ngx_int_t ngx_http_index_init(ngx_conf_t *cf);
 static void *ngx_http_index_create_loc_conf(ngx_conf_t *cf);
@@ -104,6 +114,7 @@ ngx_http_index_handler(ngx_http_request_t *r)
     ngx_http_index_t             *index;
     ngx_open_file_info_t          of;
     ngx_http_script_code_pt       code;
+    ngx_http_index_ctx_t         *ctx;
     ngx_http_script_engine_t      e;
     ngx_http_core_loc_conf_t     *clcf;
     ngx_http_index_loc_conf_t    *ilcf;
@@ -120,15 +131,26 @@ ngx_http_index_handler(ngx_http_request_t *r)
     ilcf = ngx_http_get_module_loc_conf(r, ngx_http_index_module);
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
+    ctx = ngx_http_get_module_ctx(r, ngx_http_index_module);
+
+    if (ctx) {
+        /* resumed after an open() in a thread */
+        i = ctx->index;
+        dir_tested = ctx->dir_tested;
+
+    } else {
+        i = 0;
+        dir_tested = 0;
+    }
+
     allocated = 0;
     root = 0;
-    dir_tested = 0;
     name = NULL;
     /* suppress MSVC warning */
     path.data = NULL;
 
     index = ilcf->indices->elts;
-    for (i = 0; i < ilcf->indices->nelts; i++) {
+    for ( /* void */ ; i < ilcf->indices->nelts; i++) {
 
         if (index[i].lengths == NULL) {
 
@@ -214,9 +236,29 @@ ngx_http_index_handler(ngx_http_request_t *r)
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-            != NGX_OK)
-        {
+        ngx_http_set_aio_open(r, clcf, &of);
+
+        if (ctx && ctx->err) {
+
+            /* the file was tested, but the directory test was not complete */
+
+            of.err = ctx->err;
+            of.failed = ctx->failed;
+
+            ctx->err = 0;
+
+            rc = NGX_ERROR;
+
+        } else {
+            rc = ngx_open_cached_file(clcf->open_file_cache, &path, &of,
+                                      r->pool);
+        }
+
+        if (rc == NGX_AGAIN) {
+            return ngx_http_index_suspend(r, i, dir_tested, NULL);
+        }
+
+        if (rc != NGX_OK) {
             if (of.err == 0) {
                 return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
@@ -242,6 +284,10 @@ ngx_http_index_handler(ngx_http_request_t *r)
             if (!dir_tested) {
                 rc = ngx_http_index_test_dir(r, clcf, path.data, name - 1);
 
+                if (rc == NGX_AGAIN) {
+                    return ngx_http_index_suspend(r, i, 0, &of);
+                }
+
                 if (rc != NGX_OK) {
                     return rc;
                 }
@@ -286,6 +332,7 @@ ngx_http_index_test_dir(ngx_http_request_t *r, ngx_http_core_loc_conf_t *clcf,
     u_char *path, u_char *last)
 {
     u_char                c;
+    ngx_int_t             rc;
     ngx_str_t             dir;
     ngx_open_file_info_t  of;
 
@@ -313,9 +360,16 @@ ngx_http_index_test_dir(ngx_http_request_t *r, ngx_http_core_loc_conf_t *clcf,
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &dir, &of, r->pool)
-        != NGX_OK)
-    {
+    ngx_http_set_aio_open(r, clcf, &of);
+
+    rc = ngx_open_cached_file(clcf->open_file_cache, &dir, &of, r->pool);
+
+    if (rc == NGX_AGAIN) {
+        /* the path is still used by a thread and is not restored */
+        return NGX_AGAIN;
+    }
+
+    if (rc != NGX_OK) {
         if (of.err) {
 
 #if (NGX_HAVE_OPENAT)
@@ -384,6 +438,37 @@ ngx_http_index_error(ngx_http_request_t *r, ngx_http_core_loc_conf_t  *clcf,
 }
 
 
+static ngx_int_t
+ngx_http_index_suspend(ngx_http_request_t *r, ngx_uint_t index,
+    ngx_uint_t dir_tested, ngx_open_file_info_t *of)
+{
+    ngx_http_index_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_index_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_index_ctx_t));
+        if (ctx == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_index_module);
+    }
+
+    ctx->index = index;
+    ctx->dir_tested = dir_tested;
+
+    if (of) {
+        ctx->err = of->err;
+        ctx->failed = of->failed;
+    }
+
+    r->main->count++;
+
+    return NGX_DONE;
+}
+
+
 static void *
 ngx_http_index_create_loc_conf(ngx_conf_t *cf)
 {
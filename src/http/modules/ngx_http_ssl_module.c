@@ -931,7 +931,7 @@ ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             }
 
             sscf->shm_zone = ngx_shared_memory_add(cf, &name, n,
-                                                   &ngx_http_ssl_module);
+                                                   &ngx_openssl_module);
             if (sscf->shm_zone == NULL) {
                 return NGX_CONF_ERROR;
             }
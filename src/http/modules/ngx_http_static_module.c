@@ -99,9 +99,16 @@ ngx_http_static_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-        != NGX_OK)
-    {
+    ngx_http_set_aio_open(r, clcf, &of);
+
+    rc = ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool);
+
+    if (rc == NGX_AGAIN) {
+        r->main->count++;
+        return NGX_DONE;
+    }
+
+    if (rc != NGX_OK) {
         switch (of.err) {
 
         case 0:
@@ -250,17 +257,26 @@ ngx_http_static_handler(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = 0;
-    b->file_last = of.size;
-
-    b->in_file = b->file_last ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = of.fd;
-    b->file->name = path;
-    b->file->log = log;
-    b->file->directio = of.is_directio;
+    rc = ngx_http_static_cache_body(r, &path, &of, b);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        b->file_pos = 0;
+        b->file_last = of.size;
+
+        b->in_file = b->file_last ? 1: 0;
+
+        b->file->fd = of.fd;
+        b->file->name = path;
+        b->file->log = log;
+        b->file->directio = of.is_directio;
+    }
 
     out.buf = b;
     out.next = NULL;
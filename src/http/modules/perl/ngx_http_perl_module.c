@@ -495,6 +495,10 @@ ngx_http_perl_init_interpreter(ngx_conf_t *cf, ngx_http_perl_main_conf_t *pmcf)
         }
     }
 
+    /* required modules and their dependencies are not tracked */
+
+    ngx_conf_digest_untracked = 1;
+
 #if !(NGX_HAVE_PERL_MULTIPLICITY)
 
     if (perl) {
@@ -1716,6 +1716,7 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->addr_ntop = 1;
 
     ls->handler = ngx_http_init_connection;
+    ls->handoff = 1;
 
     cscf = addr->default_server;
     ls->pool_size = cscf->connection_pool_size;
@@ -1775,6 +1776,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->reuseport = addr->opt.reuseport;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    ls->incoming_cpu = addr->opt.incoming_cpu;
+#endif
+
     return ls;
 }
 
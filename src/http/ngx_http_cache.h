@@ -161,6 +161,7 @@ struct ngx_http_file_cache_s {
     ngx_path_t                      *path;
 
     off_t                            max_size;
+    off_t                            dontcache;
     size_t                           bsize;
 
     time_t                           inactive;
@@ -177,6 +178,20 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_pool_t               *thread_pool;
+    ngx_thread_task_t               *unlink_task;
+    ngx_thread_task_t               *unlink_ready;
+    ngx_thread_task_t               *unlink_free;
+    ngx_uint_t                       unlink_batch;
+    ngx_uint_t                       unlink_budget;
+    ngx_uint_t                       unlinking;
+#endif
+
+    ngx_uint_t                       evicted;
+    off_t                            evicted_size;
+    ngx_msec_t                       stats_time;
+
     ngx_shm_zone_t                  *shm_zone;
 
     ngx_uint_t                       use_temp_path;
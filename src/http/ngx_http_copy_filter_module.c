@@ -12,9 +12,23 @@
 
 typedef struct {
     ngx_bufs_t  bufs;
+    off_t       prefetch;
+    size_t      prefetch_budget;
 } ngx_http_copy_filter_conf_t;
 
 
+#if (NGX_THREADS && NGX_HAVE_PREFETCH)
+
+typedef struct {
+    ngx_fd_t    fd;
+    off_t       offset;
+    off_t       size;
+    ngx_err_t   err;
+} ngx_http_copy_prefetch_ctx_t;
+
+#endif
+
+
 #if (NGX_HAVE_FILE_AIO)
 static void ngx_http_copy_aio_handler(ngx_output_chain_ctx_t *ctx,
     ngx_file_t *file);
@@ -25,14 +39,27 @@ static void ngx_http_copy_aio_sendfile_event_handler(ngx_event_t *ev);
 #endif
 #endif
 #if (NGX_THREADS)
+static ngx_thread_pool_t *ngx_http_copy_thread_pool(ngx_http_request_t *r);
 static ngx_int_t ngx_http_copy_thread_handler(ngx_thread_task_t *task,
     ngx_file_t *file);
 static void ngx_http_copy_thread_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_HAVE_PREFETCH)
+static ngx_int_t ngx_http_copy_prefetch_handler(ngx_output_chain_ctx_t *ctx,
+    ngx_file_t *file, off_t offset, off_t size);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_copy_thread_prefetch(ngx_http_request_t *r,
+    ngx_file_t *file, off_t offset, off_t size);
+static void ngx_http_copy_prefetch_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_copy_prefetch_event_handler(ngx_event_t *ev);
+#endif
+#endif
 
 static void *ngx_http_copy_filter_create_conf(ngx_conf_t *cf);
 static char *ngx_http_copy_filter_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static char *ngx_http_copy_filter_prefetch(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_copy_filter_init(ngx_conf_t *cf);
 
 
@@ -45,6 +72,20 @@ static ngx_command_t  ngx_http_copy_filter_commands[] = {
       offsetof(ngx_http_copy_filter_conf_t, bufs),
       NULL },
 
+    { ngx_string("prefetch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_copy_filter_prefetch,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("prefetch_budget"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_copy_filter_conf_t, prefetch_budget),
+      NULL },
+
       ngx_null_command
 };
 
@@ -82,6 +123,10 @@ ngx_module_t  ngx_http_copy_filter_module = {
 
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
+#if (NGX_THREADS && NGX_HAVE_PREFETCH)
+static ngx_thread_task_t                *ngx_http_copy_prefetch_free;
+#endif
+
 
 static ngx_int_t
 ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
@@ -140,6 +185,14 @@ ngx_http_copy_filter(ngx_http_request_t *r, ngx_chain_t *in)
         }
 #endif
 
+#if (NGX_HAVE_PREFETCH)
+        if (conf->prefetch) {
+            ctx->prefetch = conf->prefetch;
+            ctx->prefetch_budget = conf->prefetch_budget;
+            ctx->prefetch_handler = ngx_http_copy_prefetch_handler;
+        }
+#endif
+
         if (in && in->buf && ngx_buf_size(in->buf)) {
             r->request_output = 1;
         }
@@ -259,17 +312,13 @@ ngx_http_copy_aio_sendfile_event_handler(ngx_event_t *ev)
 
 #if (NGX_THREADS)
 
-static ngx_int_t
-ngx_http_copy_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+static ngx_thread_pool_t *
+ngx_http_copy_thread_pool(ngx_http_request_t *r)
 {
     ngx_str_t                  name;
     ngx_thread_pool_t         *tp;
-    ngx_http_request_t        *r;
-    ngx_output_chain_ctx_t    *ctx;
     ngx_http_core_loc_conf_t  *clcf;
 
-    r = file->thread_ctx;
-
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
     tp = clcf->thread_pool;
 
@@ -277,7 +326,7 @@ ngx_http_copy_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
         if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
             != NGX_OK)
         {
-            return NGX_ERROR;
+            return NULL;
         }
 
         tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
@@ -285,10 +334,28 @@ ngx_http_copy_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
         if (tp == NULL) {
             ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
                           "thread pool \"%V\" not found", &name);
-            return NGX_ERROR;
+            return NULL;
         }
     }
 
+    return tp;
+}
+
+
+static ngx_int_t
+ngx_http_copy_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_thread_pool_t       *tp;
+    ngx_http_request_t      *r;
+    ngx_output_chain_ctx_t  *ctx;
+
+    r = file->thread_ctx;
+
+    tp = ngx_http_copy_thread_pool(r);
+    if (tp == NULL) {
+        return NGX_ERROR;
+    }
+
     task->event.data = r;
     task->event.handler = ngx_http_copy_thread_event_handler;
 
@@ -341,6 +408,150 @@ ngx_http_copy_thread_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_HAVE_PREFETCH)
+
+static ngx_int_t
+ngx_http_copy_prefetch_handler(ngx_output_chain_ctx_t *ctx, ngx_file_t *file,
+    off_t offset, off_t size)
+{
+    ngx_http_request_t        *r;
+#if (NGX_THREADS)
+    ngx_http_core_loc_conf_t  *clcf;
+#endif
+
+    r = ctx->filter_ctx;
+
+#if (NGX_THREADS)
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        return ngx_http_copy_thread_prefetch(r, file, offset, size);
+    }
+#endif
+
+    if (ngx_prefetch(file->fd, offset, size) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_prefetch_n " \"%s\" failed", file->name.data);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * readahead is submitted from a thread as it may block on file metadata
+ * and on a congested disk queue; the task uses its own copy of the file
+ * descriptor as the request may be finalized before the task is run
+ */
+
+static ngx_int_t
+ngx_http_copy_thread_prefetch(ngx_http_request_t *r, ngx_file_t *file,
+    off_t offset, off_t size)
+{
+    ngx_thread_task_t             *task;
+    ngx_thread_pool_t             *tp;
+    ngx_http_copy_prefetch_ctx_t  *ctx;
+
+    tp = ngx_http_copy_thread_pool(r);
+    if (tp == NULL) {
+        return NGX_ERROR;
+    }
+
+    task = ngx_http_copy_prefetch_free;
+
+    if (task) {
+        ngx_http_copy_prefetch_free = task->next;
+
+    } else {
+        task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                     sizeof(ngx_http_copy_prefetch_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_copy_prefetch_thread_handler;
+        task->event.data = task;
+        task->event.handler = ngx_http_copy_prefetch_event_handler;
+        task->event.log = ngx_cycle->log;
+    }
+
+    ctx = task->ctx;
+
+    ctx->fd = dup(file->fd);
+
+    if (ctx->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "dup() \"%s\" failed", file->name.data);
+        goto failed;
+    }
+
+    ctx->offset = offset;
+    ctx->size = size;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        (void) ngx_close_file(ctx->fd);
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    task->next = ngx_http_copy_prefetch_free;
+    ngx_http_copy_prefetch_free = task;
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_copy_prefetch_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_copy_prefetch_ctx_t *ctx = data;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "prefetch thread: fd:%d %O-%O",
+                   ctx->fd, ctx->offset, ctx->offset + ctx->size);
+
+    if (ngx_prefetch(ctx->fd, ctx->offset, ctx->size) == NGX_FILE_ERROR) {
+        ctx->err = ngx_errno;
+
+    } else {
+        ctx->err = 0;
+    }
+
+    if (ngx_close_file(ctx->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " prefetch file failed");
+    }
+}
+
+
+static void
+ngx_http_copy_prefetch_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t             *task;
+    ngx_http_copy_prefetch_ctx_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+
+    if (ctx->err) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_prefetch_n " failed");
+    }
+
+    task->next = ngx_http_copy_prefetch_free;
+    ngx_http_copy_prefetch_free = task;
+}
+
+#endif
+#endif
+
+
 static void *
 ngx_http_copy_filter_create_conf(ngx_conf_t *cf)
 {
@@ -352,6 +563,8 @@ ngx_http_copy_filter_create_conf(ngx_conf_t *cf)
     }
 
     conf->bufs.num = 0;
+    conf->prefetch = NGX_CONF_UNSET;
+    conf->prefetch_budget = NGX_CONF_UNSET_SIZE;
 
     return conf;
 }
@@ -365,10 +578,51 @@ ngx_http_copy_filter_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_bufs_value(conf->bufs, prev->bufs, 2, 32768);
 
+    ngx_conf_merge_off_value(conf->prefetch, prev->prefetch, 0);
+    ngx_conf_merge_size_value(conf->prefetch_budget, prev->prefetch_budget,
+                              16 * 1024 * 1024);
+
     return NULL;
 }
 
 
+static char *
+ngx_http_copy_filter_prefetch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_copy_filter_conf_t *pcf = conf;
+
+    ngx_str_t  *value;
+
+    if (pcf->prefetch != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        pcf->prefetch = 0;
+        return NGX_CONF_OK;
+    }
+
+    pcf->prefetch = ngx_parse_offset(&value[1]);
+    if (pcf->prefetch == NGX_ERROR) {
+        return "invalid value";
+    }
+
+#if !(NGX_HAVE_PREFETCH)
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "\"prefetch\" is not supported "
+                       "on this platform, ignored");
+
+    pcf->prefetch = 0;
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_copy_filter_init(ngx_conf_t *cf)
 {
@@ -79,6 +79,7 @@ typedef struct {
 #endif
     unsigned                   deferred_accept:1;
     unsigned                   reuseport:1;
+    unsigned                   incoming_cpu:1;
     unsigned                   so_keepalive:2;
     unsigned                   proxy_protocol:1;
 
@@ -357,10 +358,12 @@ struct ngx_http_core_loc_conf_s {
 
     size_t        client_body_buffer_size; /* client_body_buffer_size */
     size_t        send_lowat;              /* send_lowat */
+    size_t        zerocopy;                /* zerocopy */
     size_t        postpone_output;         /* postpone_output */
     size_t        limit_rate;              /* limit_rate */
     size_t        limit_rate_after;        /* limit_rate_after */
     size_t        sendfile_max_chunk;      /* sendfile_max_chunk */
+    size_t        send_budget;             /* send_budget */
     size_t        read_ahead;              /* read_ahead */
 
     ngx_msec_t    client_body_timeout;     /* client_body_timeout */
@@ -388,6 +391,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_flag_t    sendfile;                /* sendfile */
     ngx_flag_t    aio;                     /* aio */
     ngx_flag_t    aio_write;               /* aio_write */
+    ngx_flag_t    aio_open;                /* aio_open */
     ngx_flag_t    tcp_nopush;              /* tcp_nopush */
     ngx_flag_t    tcp_nodelay;             /* tcp_nodelay */
     ngx_flag_t    reset_timedout_connection; /* reset_timedout_connection */
@@ -435,6 +439,9 @@ struct ngx_http_core_loc_conf_s {
     ngx_flag_t    open_file_cache_errors;
     ngx_flag_t    open_file_cache_events;
 
+    ngx_shm_zone_t  *static_cache;         /* static_cache */
+    size_t        static_cache_max_size;
+
     ngx_log_t    *error_log;
 
     ngx_uint_t    types_hash_max_size;
@@ -533,6 +540,12 @@ ngx_int_t ngx_http_request_body_save_filter(ngx_http_request_t *r,
 
 ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of);
+void ngx_http_set_aio_open(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_open_file_info_t *of);
+
+ngx_int_t ngx_http_static_cache_body(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of, ngx_buf_t *b);
+char *ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 ngx_int_t ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
     ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
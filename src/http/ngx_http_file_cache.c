@@ -11,6 +11,26 @@
 #include <ngx_md5.h>
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_node_t          *node;
+    u_char                              *name;
+    off_t                                fs_size;
+    ngx_file_uniq_t                      uniq;
+} ngx_http_file_cache_unlink_entry_t;
+
+
+typedef struct {
+    ngx_http_file_cache_t               *cache;
+    ngx_http_file_cache_unlink_entry_t  *entries;
+    u_char                              *names;
+    ngx_uint_t                           nelts;
+} ngx_http_file_cache_unlink_t;
+
+#endif
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -45,10 +65,25 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
+#if (NGX_HAVE_DONTCACHE)
+static void ngx_http_file_cache_dontcache(void *data);
+#endif
 static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_unlink(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *name);
+static void ngx_http_file_cache_unlink_post(ngx_http_file_cache_t *cache,
+    ngx_uint_t flush);
+static void ngx_http_file_cache_unlink_handler(void *data, ngx_log_t *log);
+static ngx_int_t ngx_http_file_cache_unlink_flush(void *data);
+static void ngx_http_file_cache_unlink_event_handler(ngx_event_t *ev);
+static int ngx_libc_cdecl ngx_http_file_cache_unlink_cmp(const void *one,
+    const void *two);
+#endif
+static void ngx_http_file_cache_stats(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
@@ -353,9 +388,16 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     of.directio = NGX_OPEN_FILE_DIRECTIO_OFF;
     of.read_ahead = clcf->read_ahead;
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &c->file.name, &of, r->pool)
-        != NGX_OK)
-    {
+    ngx_http_set_aio_open(r, clcf, &of);
+
+    rc = ngx_open_cached_file(clcf->open_file_cache, &c->file.name, &of,
+                              r->pool);
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
+    if (rc != NGX_OK) {
         switch (of.err) {
 
         case 0:
@@ -618,7 +660,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
         ngx_shmtx_lock(&cache->shpool->mutex);
 
-        if (!c->node->exists) {
+        if (!c->node->exists && !c->node->deleting) {
             c->node->uses = 1;
             c->node->body_start = c->body_start;
             c->node->exists = 1;
@@ -837,6 +879,16 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
             fcn->count++;
         }
 
+        if (fcn->deleting) {
+
+            /*
+             * the file is being deleted by the cache manager, so it is
+             * a miss, and a new file will be cached under the same node
+             */
+
+            goto renew;
+        }
+
         if (fcn->error) {
 
             if (fcn->valid_sec < ngx_time()) {
@@ -1561,10 +1613,13 @@ done:
 ngx_int_t
 ngx_http_cache_send(ngx_http_request_t *r)
 {
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_http_cache_t  *c;
+    ngx_int_t            rc;
+    ngx_buf_t           *b;
+    ngx_chain_t          out;
+    ngx_http_cache_t    *c;
+#if (NGX_HAVE_DONTCACHE)
+    ngx_pool_cleanup_t  *cln;
+#endif
 
     c = r->cache;
 
@@ -1587,6 +1642,20 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+#if (NGX_HAVE_DONTCACHE)
+
+    if (c->file_cache->dontcache && c->length >= c->file_cache->dontcache) {
+        cln = ngx_pool_cleanup_add(r->pool, 0);
+        if (cln == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        cln->handler = ngx_http_file_cache_dontcache;
+        cln->data = c;
+    }
+
+#endif
+
     rc = ngx_http_send_header(r);
 
     if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
@@ -1611,6 +1680,31 @@ ngx_http_cache_send(ngx_http_request_t *r)
 }
 
 
+#if (NGX_HAVE_DONTCACHE)
+
+static void
+ngx_http_file_cache_dontcache(void *data)
+{
+    ngx_http_cache_t  *c = data;
+
+    /* the cache file is closed by a cleanup registered earlier */
+
+    if (c->file.fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache dontcache: %s", c->file.name.data);
+
+    if (ngx_dontcache(c->file.fd, 0, c->length) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, c->file.log, ngx_errno,
+                      ngx_dontcache_n " \"%s\" failed", c->file.name.data);
+    }
+}
+
+#endif
+
+
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
@@ -1853,6 +1947,15 @@ next:
             break;
         }
 
+#if (NGX_THREADS)
+        if (cache->thread_pool
+            && cache->unlinking >= cache->unlink_budget)
+        {
+            wait = 0;
+            break;
+        }
+#endif
+
         ngx_time_update();
 
         elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
@@ -1876,6 +1979,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     u_char *name)
 {
     u_char                      *p;
+    off_t                        fs_size;
     size_t                       len;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
@@ -1893,8 +1997,21 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         p = ngx_hex_dump(p, fcn->key, len);
         *p = '\0';
 
+#if (NGX_THREADS)
+        if (cache->thread_pool
+            && ngx_process == NGX_PROCESS_HELPER
+            && ngx_http_file_cache_unlink(cache, fcn, name) == NGX_OK)
+        {
+            return;
+        }
+#endif
+
+        fs_size = fcn->fs_size;
+
         fcn->count++;
         fcn->deleting = 1;
+        fcn->exists = 0;
+        fcn->fs_size = 0;
         ngx_shmtx_unlock(&cache->shpool->mutex);
 
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
@@ -1911,9 +2028,12 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         ngx_shmtx_lock(&cache->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
+
+        cache->evicted++;
+        cache->evicted_size += fs_size;
     }
 
-    if (fcn->count == 0) {
+    if (fcn->count == 0 && !fcn->exists) {
         ngx_queue_remove(q);
         ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
         ngx_slab_free_locked(cache->shpool, fcn);
@@ -1935,6 +2055,13 @@ ngx_http_file_cache_manager(void *data)
     cache->last = ngx_current_msec;
     cache->files = 0;
 
+#if (NGX_THREADS)
+    if (cache->thread_pool && cache->unlinking >= cache->unlink_budget) {
+        next = cache->manager_sleep;
+        goto done;
+    }
+#endif
+
     next = (ngx_msec_t) ngx_http_file_cache_expire(cache) * 1000;
 
     if (next == 0) {
@@ -1975,6 +2102,15 @@ ngx_http_file_cache_manager(void *data)
             break;
         }
 
+#if (NGX_THREADS)
+        if (cache->thread_pool && cache->unlinking >= cache->unlink_budget) {
+            next = cache->manager_sleep;
+            break;
+        }
+
+        ngx_http_file_cache_unlink_post(cache, 0);
+#endif
+
         ngx_time_update();
 
         elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
@@ -1987,6 +2123,12 @@ ngx_http_file_cache_manager(void *data)
 
 done:
 
+#if (NGX_THREADS)
+    ngx_http_file_cache_unlink_post(cache, 1);
+#endif
+
+    ngx_http_file_cache_stats(cache);
+
     elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -1997,6 +2139,295 @@ done:
 }
 
 
+#if (NGX_THREADS)
+
+/*
+ * with "manager_thread_pool", files are unlinked by threads in batches
+ * of "manager_batch" files; the nodes are removed from the inactive queue
+ * and are freed once the batch is completed, and no more than
+ * "manager_budget" files are queued for deletion at once
+ */
+
+static ngx_int_t
+ngx_http_file_cache_unlink(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn, u_char *name)
+{
+    size_t                               len;
+    ngx_path_t                          *path;
+    ngx_thread_task_t                   *task;
+    ngx_http_file_cache_unlink_t        *un;
+    ngx_http_file_cache_unlink_entry_t  *e;
+
+    path = cache->path;
+    len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
+
+    task = cache->unlink_task;
+
+    if (task == NULL) {
+        task = cache->unlink_free;
+
+        if (task) {
+            cache->unlink_free = task->next;
+            un = task->ctx;
+
+        } else {
+            task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                        sizeof(ngx_http_file_cache_unlink_t));
+            if (task == NULL) {
+                return NGX_ERROR;
+            }
+
+            un = task->ctx;
+
+            un->entries = ngx_palloc(ngx_cycle->pool, cache->unlink_batch
+                                  * sizeof(ngx_http_file_cache_unlink_entry_t));
+            if (un->entries == NULL) {
+                return NGX_ERROR;
+            }
+
+            un->names = ngx_palloc(ngx_cycle->pool,
+                                   cache->unlink_batch * (len + 1));
+            if (un->names == NULL) {
+                return NGX_ERROR;
+            }
+
+            un->cache = cache;
+
+            task->handler = ngx_http_file_cache_unlink_handler;
+            task->event.handler = ngx_http_file_cache_unlink_event_handler;
+            task->event.data = task;
+            task->event.log = ngx_cycle->log;
+        }
+
+        un->nelts = 0;
+        cache->unlink_task = task;
+    }
+
+    un = task->ctx;
+
+    e = &un->entries[un->nelts];
+
+    e->node = fcn;
+    e->name = un->names + un->nelts * (len + 1);
+
+    ngx_memcpy(e->name, name, len + 1);
+    ngx_create_hashed_filename(path, e->name, len);
+
+    e->fs_size = fcn->fs_size;
+    e->uniq = fcn->uniq;
+
+    /*
+     * the size was already subtracted by the caller, and the node
+     * is no longer considered existing until the file is unlinked
+     */
+
+    fcn->count++;
+    fcn->deleting = 1;
+    fcn->exists = 0;
+    fcn->fs_size = 0;
+
+    ngx_queue_remove(&fcn->queue);
+    ngx_queue_init(&fcn->queue);
+
+    cache->unlinking++;
+
+    if (++un->nelts == cache->unlink_batch) {
+        task->next = cache->unlink_ready;
+        cache->unlink_ready = task;
+        cache->unlink_task = NULL;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_unlink_post(ngx_http_file_cache_t *cache,
+    ngx_uint_t flush)
+{
+    ngx_thread_task_t  *task;
+
+    if (flush && cache->unlink_task) {
+        cache->unlink_task->next = cache->unlink_ready;
+        cache->unlink_ready = cache->unlink_task;
+        cache->unlink_task = NULL;
+    }
+
+    while (cache->unlink_ready) {
+        task = cache->unlink_ready;
+        cache->unlink_ready = task->next;
+
+        if (ngx_thread_task_post(cache->thread_pool, task) != NGX_OK) {
+            ngx_http_file_cache_unlink_handler(task->ctx, ngx_cycle->log);
+            ngx_http_file_cache_unlink_event_handler(&task->event);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_unlink_flush(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    /*
+     * called by the exiting cache manager until all the files queued
+     * for deletion are unlinked and their nodes are released
+     */
+
+    if (cache->thread_pool == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_http_file_cache_unlink_post(cache, 1);
+
+    return cache->unlinking ? NGX_AGAIN : NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_unlink_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_file_cache_unlink_t *un = data;
+
+    ngx_uint_t                           i;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_unlink_entry_t  *e;
+
+    /* files from the same directory are deleted one after another */
+
+    ngx_qsort(un->entries, un->nelts,
+              sizeof(ngx_http_file_cache_unlink_entry_t),
+              ngx_http_file_cache_unlink_cmp);
+
+    e = un->entries;
+
+    for (i = 0; i < un->nelts; i++) {
+
+        /* a new file might be already cached under the same name */
+
+        if (e[i].uniq
+            && ngx_file_info(e[i].name, &fi) != NGX_FILE_ERROR
+            && ngx_file_uniq(&fi) != e[i].uniq)
+        {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                           "http file cache expire skipped: \"%s\"",
+                           e[i].name);
+            continue;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http file cache expire: \"%s\"", e[i].name);
+
+        if (ngx_delete_file(e[i].name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", e[i].name);
+        }
+    }
+}
+
+
+static void
+ngx_http_file_cache_unlink_event_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                           i;
+    ngx_thread_task_t                   *task;
+    ngx_http_file_cache_t               *cache;
+    ngx_http_file_cache_node_t          *fcn;
+    ngx_http_file_cache_unlink_t        *un;
+    ngx_http_file_cache_unlink_entry_t  *e;
+
+    task = ev->data;
+    un = task->ctx;
+    cache = un->cache;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http file cache unlink done: %ui", un->nelts);
+
+    e = un->entries;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (i = 0; i < un->nelts; i++) {
+        fcn = e[i].node;
+
+        fcn->count--;
+        fcn->deleting = 0;
+
+        cache->evicted_size += e[i].fs_size;
+
+        /* the node might have been reused for a new file meanwhile */
+
+        if (fcn->count == 0 && !fcn->exists) {
+            ngx_queue_remove(&fcn->queue);
+            ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
+            ngx_slab_free_locked(cache->shpool, fcn);
+            cache->sh->count--;
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    cache->evicted += un->nelts;
+    cache->unlinking -= un->nelts;
+
+    task->next = cache->unlink_free;
+    cache->unlink_free = task;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_file_cache_unlink_cmp(const void *one, const void *two)
+{
+    ngx_http_file_cache_unlink_entry_t *first, *second;
+
+    first = (ngx_http_file_cache_unlink_entry_t *) one;
+    second = (ngx_http_file_cache_unlink_entry_t *) two;
+
+    return ngx_strcmp(first->name, second->name);
+}
+
+#endif
+
+
+static void
+ngx_http_file_cache_stats(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t  pending;
+    ngx_msec_t  elapsed;
+
+    if (cache->stats_time == 0) {
+        cache->stats_time = ngx_current_msec;
+        return;
+    }
+
+    elapsed = ngx_current_msec - cache->stats_time;
+
+    if (elapsed < 60000) {
+        return;
+    }
+
+#if (NGX_THREADS)
+    pending = cache->unlinking;
+#else
+    pending = 0;
+#endif
+
+    if (cache->evicted || pending) {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "http file cache \"%V\": %ui files, %O bytes "
+                      "evicted in %M ms, %ui files/s, %ui pending",
+                      &cache->shm_zone->shm.name,
+                      cache->evicted, cache->evicted_size * cache->bsize,
+                      elapsed, cache->evicted * 1000 / elapsed, pending);
+    }
+
+    cache->evicted = 0;
+    cache->evicted_size = 0;
+    cache->stats_time = ngx_current_msec;
+}
+
+
 static void
 ngx_http_file_cache_loader(void *data)
 {
@@ -2282,6 +2713,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                             manager_threshold;
     ngx_uint_t              i, n, use_temp_path;
     ngx_array_t            *caches;
+#if (NGX_THREADS)
+    ngx_str_t               tp;
+    ngx_int_t               batch, budget;
+#endif
     ngx_http_file_cache_t  *cache, **ce;
 
     cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_t));
@@ -2306,6 +2741,12 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     manager_sleep = 50;
     manager_threshold = 200;
 
+#if (NGX_THREADS)
+    ngx_str_null(&tp);
+    batch = 64;
+    budget = 1024;
+#endif
+
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
@@ -2435,6 +2876,29 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "dontcache=", 10) == 0) {
+
+            s.len = value[i].len - 10;
+            s.data = value[i].data + 10;
+
+            cache->dontcache = ngx_parse_offset(&s);
+            if (cache->dontcache < 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid dontcache value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_DONTCACHE)
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                               "\"dontcache\" is not supported "
+                               "on this platform, ignored");
+            cache->dontcache = 0;
+#endif
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "loader_files=", 13) == 0) {
 
             loader_files = ngx_atoi(value[i].data + 13, value[i].len - 13);
@@ -2504,6 +2968,55 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "manager_thread_pool=", 20) == 0) {
+#if (NGX_THREADS)
+            tp.len = value[i].len - 20;
+            tp.data = value[i].data + 20;
+
+            if (tp.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_thread_pool value \"%V\"",
+                           &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"manager_thread_pool\" requires "
+                               "thread pools support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+#if (NGX_THREADS)
+
+        if (ngx_strncmp(value[i].data, "manager_batch=", 14) == 0) {
+
+            batch = ngx_atoi(value[i].data + 14, value[i].len - 14);
+            if (batch == NGX_ERROR || batch == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_batch value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "manager_budget=", 15) == 0) {
+
+            budget = ngx_atoi(value[i].data + 15, value[i].len - 15);
+            if (budget == NGX_ERROR || budget == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid manager_budget value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+#endif
+
         if (ngx_strncmp(value[i].data, "manager_threshold=", 18) == 0) {
 
             s.len = value[i].len - 18;
@@ -2533,6 +3046,9 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cache->path->manager = ngx_http_file_cache_manager;
     cache->path->loader = ngx_http_file_cache_loader;
+#if (NGX_THREADS)
+    cache->path->flusher = ngx_http_file_cache_unlink_flush;
+#endif
     cache->path->data = cache;
     cache->path->conf_file = cf->conf_file->file.name.data;
     cache->path->line = cf->conf_file->line;
@@ -2543,6 +3059,18 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
 
+#if (NGX_THREADS)
+    if (tp.len) {
+        cache->thread_pool = ngx_thread_pool_add_helper(cf, &tp);
+        if (cache->thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->unlink_batch = batch;
+        cache->unlink_budget = budget;
+    }
+#endif
+
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
@@ -355,6 +355,25 @@ ngx_http_init_connection(ngx_connection_t *c)
         c->log->action = "reading PROXY protocol";
     }
 
+    if (c->handoff) {
+        c->handoff = 0;
+
+        /* an idle connection passed from an exiting worker process */
+
+        if (hc->ssl
+            || hc->proxy_protocol
+#if (NGX_HTTP_V2)
+            || hc->addr_conf->http2
+#endif
+           )
+        {
+            ngx_http_close_connection(c);
+            return;
+        }
+
+        c->log->action = "keepalive";
+    }
+
     if (rev->ready) {
         /* the deferred accept(), iocp */
 
@@ -3074,6 +3093,10 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     c->idle = 1;
     ngx_reusable_connection(c, 1);
 
+    /* a plain connection may be passed to a new worker process on reload */
+
+    c->handoff = !hc->ssl && !hc->addr_conf->proxy_protocol;
+
     ngx_add_timer(rev, clcf->keepalive_timeout);
 
     if (rev->ready) {
@@ -3504,6 +3527,14 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         }
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    if (r->connection->zerocopy && r->connection->zerocopy->inflight) {
+        ngx_linux_zerocopy_abort(r->connection);
+    }
+
+#endif
+
     /* the various request strings were allocated from r->pool */
     ctx = log->data;
     ctx->request = NULL;
@@ -431,6 +431,8 @@ struct ngx_http_request_s {
     size_t                            limit_rate;
     size_t                            limit_rate_after;
 
+    ngx_msec_t                        send_tick;
+
     /* used to learn the Apache compatible response length without a header */
     size_t                            header_size;
 
@@ -445,6 +447,10 @@ struct ngx_http_request_s {
 
     ngx_http_cleanup_t               *cleanup;
 
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_task_t                *open_file_task;
+#endif
+
     unsigned                          count:16;
     unsigned                          subrequests:8;
     unsigned                          blocked:8;
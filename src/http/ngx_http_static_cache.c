@@ -0,0 +1,693 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * the static cache keeps contents of small files in a shared memory zone,
+ * so hot files are sent from memory by all worker processes; entries are
+ * keyed by file name and are only used while file uniq, mtime and size
+ * match the ones returned by ngx_open_cached_file()
+ *
+ * a hit is sent with a buffer pointing to the zone, and the entry is
+ * pinned by a reference count until the request is finalized; entries
+ * which are replaced or evicted while referenced are only removed from
+ * the tree, and are freed when the last reference is released
+ */
+
+
+typedef struct {
+    ngx_str_node_t               sn;
+    ngx_queue_t                  queue;
+
+    ngx_file_uniq_t              uniq;
+    time_t                       mtime;
+    size_t                       size;
+
+    ngx_uint_t                   count;
+    time_t                       read_time;
+
+    unsigned                     exists:1;
+    unsigned                     deleted:1;
+
+    u_char                       data[1];
+} ngx_http_static_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+    ngx_queue_t                  queue;
+} ngx_http_static_cache_sh_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                *shm_zone;
+    ngx_http_static_cache_node_t  *node;
+} ngx_http_static_cache_cleanup_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_shm_zone_t                *shm_zone;
+    ngx_http_static_cache_node_t  *node;
+    ngx_fd_t                       fd;
+    ssize_t                        n;
+    ngx_err_t                      err;
+} ngx_http_static_cache_fill_t;
+
+#endif
+
+
+static ngx_int_t ngx_http_static_cache_read(ngx_http_request_t *r,
+    ngx_str_t *path, ngx_open_file_info_t *of,
+    ngx_http_static_cache_node_t *node);
+static void ngx_http_static_cache_release(ngx_shm_zone_t *shm_zone,
+    ngx_http_static_cache_node_t *node, ngx_uint_t exists);
+static void ngx_http_static_cache_cleanup(void *data);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_static_cache_thread_read(ngx_http_request_t *r,
+    ngx_open_file_info_t *of, ngx_http_static_cache_node_t *node);
+static void ngx_http_static_cache_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_static_cache_thread_event_handler(ngx_event_t *ev);
+#endif
+static ngx_int_t ngx_http_static_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_http_static_cache_node_t *ngx_http_static_cache_lookup(
+    ngx_http_static_cache_sh_t *sh, ngx_str_t *name, uint32_t hash);
+static void ngx_http_static_cache_delete(ngx_http_static_cache_sh_t *sh,
+    ngx_slab_pool_t *shpool, ngx_http_static_cache_node_t *node);
+static ngx_http_static_cache_node_t *ngx_http_static_cache_alloc(
+    ngx_http_static_cache_sh_t *sh, ngx_slab_pool_t *shpool, size_t size);
+
+
+static ngx_uint_t  ngx_http_static_cache_tag;
+
+#if (NGX_THREADS)
+static ngx_thread_task_t  *ngx_http_static_cache_free;
+#endif
+
+
+ngx_int_t
+ngx_http_static_cache_body(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of, ngx_buf_t *b)
+{
+    size_t                            size;
+    uint32_t                          hash;
+    ngx_int_t                         rc;
+    ngx_slab_pool_t                  *shpool;
+    ngx_pool_cleanup_t               *cln;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_static_cache_sh_t       *sh;
+    ngx_http_static_cache_node_t     *node;
+    ngx_http_static_cache_cleanup_t  *scc;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->static_cache == NULL
+        || of->size == 0
+        || of->size > (off_t) clcf->static_cache_max_size
+        || of->is_directio)
+    {
+        return NGX_DECLINED;
+    }
+
+    size = (size_t) of->size;
+
+    /* allocated before the zone is locked */
+
+    cln = ngx_pool_cleanup_add(r->pool,
+                               sizeof(ngx_http_static_cache_cleanup_t));
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh = clcf->static_cache->data;
+    shpool = (ngx_slab_pool_t *) clcf->static_cache->shm.addr;
+
+    hash = ngx_crc32_long(path->data, path->len);
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node = ngx_http_static_cache_lookup(sh, path, hash);
+
+    if (node) {
+
+        if (node->uniq == of->uniq
+            && node->mtime == of->mtime
+            && node->size == size)
+        {
+            if (!node->exists && ngx_time() - node->read_time < 60) {
+
+                /* the file is being read by another request */
+
+                ngx_shmtx_unlock(&shpool->mutex);
+                return NGX_DECLINED;
+            }
+
+            if (node->exists) {
+                node->count++;
+
+                ngx_queue_remove(&node->queue);
+                ngx_queue_insert_head(&sh->queue, &node->queue);
+
+                ngx_shmtx_unlock(&shpool->mutex);
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "http static cache hit: \"%s\"", path->data);
+
+                goto found;
+            }
+
+            /*
+             * the entry was left unfilled, e.g., by an exited worker;
+             * it is replaced, and freed if a thread still reads it
+             */
+        }
+
+        ngx_http_static_cache_delete(sh, shpool, node);
+    }
+
+    /*
+     * an entry is added before the file is read, so the file is only
+     * read once; it is not used until the contents are in place
+     */
+
+    node = ngx_http_static_cache_alloc(sh, shpool, path->len + size);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    node->sn.node.key = hash;
+    node->sn.str.len = path->len;
+    node->sn.str.data = node->data;
+
+    node->uniq = of->uniq;
+    node->mtime = of->mtime;
+    node->size = size;
+
+    node->count = 1;
+    node->read_time = ngx_time();
+    node->exists = 0;
+    node->deleted = 0;
+
+    ngx_memcpy(node->data, path->data, path->len);
+
+    ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache miss: \"%s\"", path->data);
+
+#if (NGX_THREADS)
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+
+        /*
+         * the file is read into the entry by a thread, while this
+         * response is sent from the file
+         */
+
+        rc = ngx_http_static_cache_thread_read(r, of, node);
+
+        if (rc != NGX_OK) {
+            ngx_http_static_cache_release(clcf->static_cache, node, 0);
+        }
+
+        return (rc == NGX_ERROR) ? NGX_ERROR : NGX_DECLINED;
+    }
+
+#endif
+
+    rc = ngx_http_static_cache_read(r, path, of, node);
+
+    if (rc != NGX_OK) {
+        ngx_http_static_cache_release(clcf->static_cache, node, 0);
+        return rc;
+    }
+
+    ngx_shmtx_lock(&shpool->mutex);
+    node->exists = 1;
+    ngx_shmtx_unlock(&shpool->mutex);
+
+found:
+
+    scc = cln->data;
+    scc->shm_zone = clcf->static_cache;
+    scc->node = node;
+
+    cln->handler = ngx_http_static_cache_cleanup;
+
+    b->pos = node->data + node->sn.str.len;
+    b->last = b->pos + size;
+    b->memory = 1;
+    b->in_file = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_read(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of, ngx_http_static_cache_node_t *node)
+{
+    ssize_t     n;
+    ngx_file_t  file;
+
+    /* the entry is not yet used by others, and can be written unlocked */
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = of->fd;
+    file.name = *path;
+    file.log = r->connection->log;
+
+    n = ngx_read_file(&file, node->data + path->len, node->size, 0);
+
+    if (n == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if ((size_t) n != node->size) {
+
+        /* the file is being changed, do not cache it */
+
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_static_cache_release(ngx_shm_zone_t *shm_zone,
+    ngx_http_static_cache_node_t *node, ngx_uint_t exists)
+{
+    ngx_slab_pool_t             *shpool;
+    ngx_http_static_cache_sh_t  *sh;
+
+    sh = shm_zone->data;
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node->count--;
+
+    if (node->deleted) {
+        if (node->count == 0) {
+            ngx_slab_free_locked(shpool, node);
+        }
+
+    } else if (exists) {
+        node->exists = 1;
+
+    } else if (!node->exists) {
+
+        /* the entry was not filled */
+
+        ngx_http_static_cache_delete(sh, shpool, node);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_http_static_cache_cleanup(void *data)
+{
+    ngx_http_static_cache_cleanup_t  *scc = data;
+
+    ngx_http_static_cache_release(scc->shm_zone, scc->node, 0);
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_static_cache_thread_read(ngx_http_request_t *r,
+    ngx_open_file_info_t *of, ngx_http_static_cache_node_t *node)
+{
+    ngx_str_t                      name;
+    ngx_thread_pool_t             *tp;
+    ngx_thread_task_t             *task;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_static_cache_fill_t  *ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
+
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
+    }
+
+    task = ngx_http_static_cache_free;
+
+    if (task) {
+        ngx_http_static_cache_free = task->next;
+
+    } else {
+        task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                     sizeof(ngx_http_static_cache_fill_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_static_cache_thread_handler;
+        task->event.data = task;
+        task->event.handler = ngx_http_static_cache_thread_event_handler;
+        task->event.log = ngx_cycle->log;
+    }
+
+    ctx = task->ctx;
+
+    /* the descriptor may be closed before the task is completed */
+
+    ctx->fd = dup(of->fd);
+
+    if (ctx->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      "dup() failed");
+        goto failed;
+    }
+
+    ctx->shm_zone = clcf->static_cache;
+    ctx->node = node;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        (void) ngx_close_file(ctx->fd);
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    task->next = ngx_http_static_cache_free;
+    ngx_http_static_cache_free = task;
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_static_cache_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_static_cache_fill_t *ctx = data;
+
+    ngx_http_static_cache_node_t  *node;
+
+    node = ctx->node;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "static cache thread: fd:%d size:%uz", ctx->fd, node->size);
+
+    ctx->n = pread(ctx->fd, node->data + node->sn.str.len, node->size, 0);
+    ctx->err = (ctx->n == -1) ? ngx_errno : 0;
+
+    if (ngx_close_file(ctx->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " static cache file failed");
+    }
+}
+
+
+static void
+ngx_http_static_cache_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t             *task;
+    ngx_http_static_cache_fill_t  *ctx;
+
+    task = ev->data;
+    ctx = task->ctx;
+
+    if (ctx->err) {
+        ngx_log_error(NGX_LOG_CRIT, ev->log, ctx->err,
+                      "pread() \"%*s\" failed",
+                      ctx->node->sn.str.len, ctx->node->sn.str.data);
+    }
+
+    /* a short read means that the file is being changed */
+
+    ngx_http_static_cache_release(ctx->shm_zone, ctx->node,
+                                  (size_t) ctx->n == ctx->node->size);
+
+    task->next = ngx_http_static_cache_free;
+    ngx_http_static_cache_free = task;
+}
+
+#endif
+
+
+static ngx_http_static_cache_node_t *
+ngx_http_static_cache_lookup(ngx_http_static_cache_sh_t *sh, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_str_node_t  *sn;
+
+    sn = ngx_str_rbtree_lookup(&sh->rbtree, name, hash);
+
+    if (sn == NULL) {
+        return NULL;
+    }
+
+    return (ngx_http_static_cache_node_t *) sn;
+}
+
+
+static void
+ngx_http_static_cache_delete(ngx_http_static_cache_sh_t *sh,
+    ngx_slab_pool_t *shpool, ngx_http_static_cache_node_t *node)
+{
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&sh->rbtree, &node->sn.node);
+
+    if (node->count) {
+
+        /* referenced by responses being sent or by a thread reading it */
+
+        node->deleted = 1;
+        return;
+    }
+
+    ngx_slab_free_locked(shpool, node);
+}
+
+
+static ngx_http_static_cache_node_t *
+ngx_http_static_cache_alloc(ngx_http_static_cache_sh_t *sh,
+    ngx_slab_pool_t *shpool, size_t size)
+{
+    ngx_uint_t                     n;
+    ngx_queue_t                   *q;
+    ngx_http_static_cache_node_t  *node;
+
+    size += offsetof(ngx_http_static_cache_node_t, data);
+
+    /* evict least recently used entries, but no more than 16 at once */
+
+    for (n = 0; n < 16; n++) {
+
+        node = ngx_slab_alloc_locked(shpool, size);
+
+        if (node) {
+            return node;
+        }
+
+        if (ngx_queue_empty(&sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&sh->queue);
+        node = ngx_queue_data(q, ngx_http_static_cache_node_t, queue);
+
+        ngx_http_static_cache_delete(sh, shpool, node);
+    }
+
+    return NULL;
+}
+
+
+char *
+ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t *clcf = conf;
+
+    u_char           *p;
+    ssize_t           size, max_size;
+    ngx_str_t        *value, name, s;
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+
+    if (clcf->static_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has invalid parameters";
+        }
+
+        clcf->static_cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    name.len = 0;
+    size = 0;
+    max_size = 16384;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[i].data + value[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "zone \"%V\" is too small", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+            } else {
+                name.len = value[i].len - 5;
+            }
+
+            if (name.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone name \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_size(&s);
+            if (max_size == NGX_ERROR || max_size == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_static_cache_tag);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_static_cache_init_zone;
+
+    clcf->static_cache = shm_zone;
+    clcf->static_cache_max_size = max_size;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_static_cache_sh_t  *osh = data;
+
+    size_t                       len;
+    ngx_slab_pool_t             *shpool;
+    ngx_http_static_cache_sh_t  *sh;
+
+    if (osh) {
+        shm_zone->data = osh;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_http_static_cache_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = sh;
+    shm_zone->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    len = sizeof(" in static cache zone \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in static cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
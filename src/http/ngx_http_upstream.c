@@ -69,6 +69,10 @@ static void ngx_http_upstream_upgraded_write_upstream(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_http_upstream_splice_upgraded(ngx_http_request_t *r,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_uint_t from_upstream);
+#endif
 static void
     ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r);
 static void
@@ -3076,9 +3080,13 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
         p->temp_file->persistent = 1;
 
 #if (NGX_HTTP_CACHE)
-        if (r->cache && !r->cache->file_cache->use_temp_path) {
-            p->temp_file->path = r->cache->file_cache->path;
-            p->temp_file->file.name = r->cache->file.name;
+        if (r->cache) {
+            p->temp_file->dontcache = r->cache->file_cache->dontcache;
+
+            if (!r->cache->file_cache->use_temp_path) {
+                p->temp_file->path = r->cache->file_cache->path;
+                p->temp_file->file.name = r->cache->file.name;
+            }
         }
 #endif
 
@@ -3193,6 +3201,20 @@ ngx_http_upstream_upgrade(ngx_http_request_t *r, ngx_http_upstream_t *u)
     r->read_event_handler = ngx_http_upstream_upgraded_read_downstream;
     r->write_event_handler = ngx_http_upstream_upgraded_write_downstream;
 
+#if (NGX_HAVE_SPLICE)
+
+    if (u->conf->splice
+#if (NGX_SSL)
+        && c->ssl == NULL
+        && u->peer.connection->ssl == NULL
+#endif
+        )
+    {
+        u->splice = 1;
+    }
+
+#endif
+
     if (clcf->tcp_nodelay) {
         tcp_nodelay = 1;
 
@@ -3282,6 +3304,7 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
     size_t                     size;
     ssize_t                    n;
     ngx_buf_t                 *b;
+    ngx_uint_t                 upstream_done, downstream_done;
     ngx_connection_t          *c, *downstream, *upstream, *dst, *src;
     ngx_http_upstream_t       *u;
     ngx_http_core_loc_conf_t  *clcf;
@@ -3341,6 +3364,24 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
 
     for ( ;; ) {
 
+#if (NGX_HAVE_SPLICE)
+
+        /* switch to splice() once all buffered data are sent */
+
+        if (u->splice && b->pos == b->last && b != r->header_in) {
+
+            if (ngx_http_upstream_splice_upgraded(r, src, dst, from_upstream)
+                != NGX_OK)
+            {
+                ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+                return;
+            }
+
+            break;
+        }
+
+#endif
+
         if (do_write) {
 
             size = b->last - b->pos;
@@ -3394,8 +3435,23 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
         break;
     }
 
-    if ((upstream->read->eof && u->buffer.pos == u->buffer.last)
-        || (downstream->read->eof && u->from_client.pos == u->from_client.last)
+    upstream_done = (u->buffer.pos == u->buffer.last);
+    downstream_done = (u->from_client.pos == u->from_client.last);
+
+#if (NGX_HAVE_SPLICE)
+
+    if (u->upstream_pipe && u->upstream_pipe->size) {
+        upstream_done = 0;
+    }
+
+    if (u->downstream_pipe && u->downstream_pipe->size) {
+        downstream_done = 0;
+    }
+
+#endif
+
+    if ((upstream->read->eof && upstream_done)
+        || (downstream->read->eof && downstream_done)
         || (downstream->read->eof && upstream->read->eof))
     {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
@@ -3453,6 +3509,61 @@ ngx_http_upstream_process_upgraded(ngx_http_request_t *r,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_http_upstream_splice_upgraded(ngx_http_request_t *r,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_uint_t from_upstream)
+{
+    ssize_t               n;
+    ngx_splice_pipe_t    *p, **pp;
+    ngx_http_upstream_t  *u;
+
+    u = r->upstream;
+
+    pp = from_upstream ? &u->upstream_pipe : &u->downstream_pipe;
+
+    if (*pp == NULL) {
+        *pp = ngx_linux_splice_pipe(r->pool, r->connection->log);
+        if (*pp == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    p = *pp;
+
+    for ( ;; ) {
+
+        if (p->size && dst->write->ready) {
+            if (ngx_linux_splice_send(dst, p) == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (p->size || !src->read->ready) {
+            return NGX_OK;
+        }
+
+        n = ngx_linux_splice_recv(src, p, u->conf->buffer_size);
+
+        if (n == NGX_AGAIN || n == 0) {
+            return NGX_OK;
+        }
+
+        if (n == NGX_ERROR) {
+            src->read->eof = 1;
+            return NGX_OK;
+        }
+
+        if (from_upstream) {
+            u->state->bytes_received += n;
+        }
+    }
+}
+
+#endif
+
+
 static void
 ngx_http_upstream_process_non_buffered_downstream(ngx_http_request_t *r)
 {
@@ -179,6 +179,7 @@ typedef struct {
     ngx_flag_t                       intercept_errors;
     ngx_flag_t                       cyclic_temp_file;
     ngx_flag_t                       force_ranges;
+    ngx_flag_t                       splice;
 
     ngx_path_t                      *temp_path;
 
@@ -338,6 +339,11 @@ struct ngx_http_upstream_s {
     ngx_buf_t                        buffer;
     off_t                            length;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_splice_pipe_t               *upstream_pipe;
+    ngx_splice_pipe_t               *downstream_pipe;
+#endif
+
     ngx_chain_t                     *out_bufs;
     ngx_chain_t                     *busy_bufs;
     ngx_chain_t                     *free_bufs;
@@ -385,6 +391,7 @@ struct ngx_http_upstream_s {
     unsigned                         buffering:1;
     unsigned                         keepalive:1;
     unsigned                         upgrade:1;
+    unsigned                         splice:1;
 
     unsigned                         request_sent:1;
     unsigned                         request_body_sent:1;
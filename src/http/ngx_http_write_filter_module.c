@@ -10,7 +10,10 @@
 #include <ngx_http.h>
 
 
+static off_t ngx_http_write_filter_share(ngx_http_request_t *r,
+    size_t budget);
 static ngx_int_t ngx_http_write_filter_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_write_filter_init_process(ngx_cycle_t *cycle);
 
 
 static ngx_http_module_t  ngx_http_write_filter_module_ctx = {
@@ -35,7 +38,7 @@ ngx_module_t  ngx_http_write_filter_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_write_filter_init_process,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -44,10 +47,20 @@ ngx_module_t  ngx_http_write_filter_module = {
 };
 
 
+/*
+ * "send_budget" state of the worker process: the tick and the number
+ * of requests which sent data during the current and previous ticks
+ */
+
+static ngx_msec_t  ngx_http_write_filter_tick;
+static ngx_uint_t  ngx_http_write_filter_senders;
+static ngx_uint_t  ngx_http_write_filter_prev_senders;
+
+
 ngx_int_t
 ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
-    off_t                      size, sent, nsent, limit;
+    off_t                      size, sent, nsent, limit, share;
     ngx_uint_t                 last, flush, sync;
     ngx_msec_t                 delay;
     ngx_chain_t               *cl, *ln, **ll, *chain;
@@ -246,6 +259,14 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         limit = clcf->sendfile_max_chunk;
     }
 
+    if (clcf->send_budget) {
+        share = ngx_http_write_filter_share(r, clcf->send_budget);
+
+        if (limit == 0 || share < limit) {
+            limit = share;
+        }
+    }
+
     sent = c->sent;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
@@ -318,6 +339,67 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+/*
+ * "send_budget" is shared between the requests which send data during
+ * a millisecond tick; the number of senders is estimated by the larger
+ * of the current and the previous ticks, and data already queued in
+ * the socket but not yet sent count against the share
+ */
+
+static off_t
+ngx_http_write_filter_share(ngx_http_request_t *r, size_t budget)
+{
+    off_t                 share, min;
+    ngx_uint_t            senders;
+#if (NGX_HAVE_SIOCOUTQNSD)
+    int                   unsent;
+    ngx_connection_t     *c;
+#endif
+
+    if (ngx_http_write_filter_tick != ngx_current_msec) {
+        ngx_http_write_filter_tick = ngx_current_msec;
+        ngx_http_write_filter_prev_senders = ngx_http_write_filter_senders;
+        ngx_http_write_filter_senders = 0;
+    }
+
+    if (r->main->send_tick != ngx_http_write_filter_tick) {
+        r->main->send_tick = ngx_http_write_filter_tick;
+        ngx_http_write_filter_senders++;
+    }
+
+    senders = ngx_max(ngx_http_write_filter_senders,
+                      ngx_http_write_filter_prev_senders);
+
+    share = budget / senders;
+    min = 4 * ngx_pagesize;
+
+#if (NGX_HAVE_SIOCOUTQNSD)
+
+    c = r->connection;
+
+    if (r->stream == NULL && c->fd != (ngx_socket_t) -1) {
+
+        /* not supported for unix domain sockets */
+
+        if (ngx_socket_unsent(c->fd, &unsent) == -1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, ngx_socket_errno,
+                           ngx_socket_unsent_n " failed");
+            unsent = 0;
+        }
+
+        share -= unsent;
+    }
+
+#endif
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http write filter share:%O senders:%ui",
+                   share, senders);
+
+    return ngx_max(share, min);
+}
+
+
 static ngx_int_t
 ngx_http_write_filter_init(ngx_conf_t *cf)
 {
@@ -325,3 +407,14 @@ ngx_http_write_filter_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_write_filter_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_write_filter_tick = 0;
+    ngx_http_write_filter_senders = 0;
+    ngx_http_write_filter_prev_senders = 0;
+
+    return NGX_OK;
+}
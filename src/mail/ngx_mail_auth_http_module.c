@@ -10,6 +10,46 @@
 #include <ngx_event.h>
 #include <ngx_event_connect.h>
 #include <ngx_mail.h>
+#include <ngx_md5.h>
+
+
+typedef struct {
+    ngx_queue_t                     cache;
+    ngx_queue_t                     free;
+} ngx_mail_auth_http_idle_t;
+
+
+typedef struct {
+    ngx_queue_t                     queue;
+    ngx_connection_t               *connection;
+    ngx_mail_auth_http_idle_t      *idle;
+} ngx_mail_auth_http_idle_conn_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+} ngx_mail_auth_http_cache_sh_t;
+
+
+typedef struct {
+    ngx_mail_auth_http_cache_sh_t  *sh;
+    ngx_slab_pool_t                *shpool;
+} ngx_mail_auth_http_cache_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t               node;
+    ngx_queue_t                     queue;
+    time_t                          expire;
+    u_char                          key[16];
+    u_short                         addr_len;
+    u_short                         port_len;
+    u_short                         user_len;
+    u_short                         pass_len;
+    u_char                          data[1];
+} ngx_mail_auth_http_cache_node_t;
 
 
 typedef struct {
@@ -18,6 +58,13 @@ typedef struct {
     ngx_msec_t                      timeout;
     ngx_flag_t                      pass_client_cert;
 
+    ngx_uint_t                      keepalive;
+    ngx_msec_t                      keepalive_timeout;
+    ngx_mail_auth_http_idle_t      *idle;
+
+    ngx_shm_zone_t                 *cache_zone;
+    time_t                          cache_valid;
+
     ngx_str_t                       host_header;
     ngx_str_t                       uri;
     ngx_str_t                       header;
@@ -53,19 +100,39 @@ struct ngx_mail_auth_http_ctx_s {
     ngx_str_t                       err;
     ngx_str_t                       errmsg;
     ngx_str_t                       errcode;
+    ngx_str_t                       user;
+    ngx_str_t                       pass;
+
+    u_char                         *version;
+    off_t                           content_length;
 
     time_t                          sleep;
+    time_t                          cache_valid;
+
+    u_char                          cache_key[16];
+
+    unsigned                        keepalive:1;
+    unsigned                        cacheable:1;
 
     ngx_pool_t                     *pool;
 };
 
 
+static void ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached);
+static ngx_int_t ngx_mail_auth_http_get_cached_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_http_free_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_http_close_handler(ngx_event_t *ev);
 static void ngx_mail_auth_http_write_handler(ngx_event_t *wev);
 static void ngx_mail_auth_http_read_handler(ngx_event_t *rev);
 static void ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
+static ngx_addr_t *ngx_mail_auth_http_peer(ngx_mail_session_t *s,
+    ngx_str_t *name, ngx_str_t *addr, ngx_str_t *port);
 static void ngx_mail_auth_sleep_handler(ngx_event_t *rev);
 static ngx_int_t ngx_mail_auth_http_parse_header_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
@@ -76,12 +143,32 @@ static ngx_buf_t *ngx_mail_auth_http_create_request(ngx_mail_session_t *s,
 static ngx_int_t ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text,
     ngx_str_t *escaped);
 
+static ngx_int_t ngx_mail_auth_http_cache_key(ngx_mail_session_t *s,
+    ngx_mail_auth_http_conf_t *ahcf, u_char *key);
+static ngx_int_t ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_conf_t *ahcf, u_char *key);
+static void ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
+static ngx_mail_auth_http_cache_node_t *ngx_mail_auth_http_cache_find(
+    ngx_mail_auth_http_cache_t *cache, u_char *key, uint32_t hash);
+static void ngx_mail_auth_http_cache_expire(ngx_mail_auth_http_cache_t *cache,
+    ngx_uint_t n);
+static void ngx_mail_auth_http_cache_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_mail_auth_http_cache_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+
 static void *ngx_mail_auth_http_create_conf(ngx_conf_t *cf);
 static char *ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_mail_auth_http_idle_t *ngx_mail_auth_http_create_idle(
+    ngx_conf_t *cf, ngx_uint_t n);
 
 
 static ngx_command_t  ngx_mail_auth_http_commands[] = {
@@ -114,6 +201,27 @@ static ngx_command_t  ngx_mail_auth_http_commands[] = {
       offsetof(ngx_mail_auth_http_conf_t, pass_client_cert),
       NULL },
 
+    { ngx_string("auth_http_keepalive"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive),
+      NULL },
+
+    { ngx_string("auth_http_keepalive_timeout"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_auth_http_conf_t, keepalive_timeout),
+      NULL },
+
+    { ngx_string("auth_http_cache"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE12,
+      ngx_mail_auth_http_cache,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -161,13 +269,36 @@ static ngx_str_t   ngx_mail_smtp_errcode = ngx_string("535 5.7.0");
 void
 ngx_mail_auth_http_init(ngx_mail_session_t *s)
 {
+    u_char                      key[16];
     ngx_int_t                   rc;
+    ngx_uint_t                  cacheable;
     ngx_pool_t                 *pool;
     ngx_mail_auth_http_ctx_t   *ctx;
     ngx_mail_auth_http_conf_t  *ahcf;
 
     s->connection->log->action = "in http auth state";
 
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    cacheable = 0;
+
+    if (ahcf->cache_zone
+        && ngx_mail_auth_http_cache_key(s, ahcf, key) == NGX_OK)
+    {
+        rc = ngx_mail_auth_http_cache_lookup(s, ahcf, key);
+
+        if (rc == NGX_OK) {
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
+
+        cacheable = 1;
+    }
+
     pool = ngx_create_pool(2048, s->connection->log);
     if (pool == NULL) {
         ngx_mail_session_internal_server_error(s);
@@ -182,8 +313,13 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     }
 
     ctx->pool = pool;
+    ctx->content_length = -1;
+    ctx->cache_valid = NGX_CONF_UNSET;
 
-    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+    if (cacheable) {
+        ctx->cacheable = 1;
+        ngx_memcpy(ctx->cache_key, key, 16);
+    }
 
     ctx->request = ngx_mail_auth_http_create_request(s, pool, ahcf);
     if (ctx->request == NULL) {
@@ -201,16 +337,36 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     ctx->peer.log = s->connection->log;
     ctx->peer.log_error = NGX_ERROR_ERR;
 
-    rc = ngx_event_connect_peer(&ctx->peer);
+    ngx_mail_auth_http_connect(s, ctx, 1);
+}
 
-    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
-        if (ctx->peer.connection) {
-            ngx_close_connection(ctx->peer.connection);
-        }
 
-        ngx_destroy_pool(ctx->pool);
-        ngx_mail_session_internal_server_error(s);
-        return;
+static void
+ngx_mail_auth_http_connect(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_uint_t cached)
+{
+    ngx_int_t                   rc;
+    ngx_mail_auth_http_conf_t  *ahcf;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    if (cached && ngx_mail_auth_http_get_cached_peer(s, ctx, ahcf) == NGX_OK) {
+        rc = NGX_OK;
+
+    } else {
+        ctx->peer.cached = 0;
+
+        rc = ngx_event_connect_peer(&ctx->peer);
+
+        if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+            if (ctx->peer.connection) {
+                ngx_close_connection(ctx->peer.connection);
+            }
+
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
     }
 
     ctx->peer.connection->data = s;
@@ -232,6 +388,169 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
 }
 
 
+static ngx_int_t
+ngx_mail_auth_http_get_cached_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_idle_conn_t  *item;
+
+    if (ahcf->idle == NULL || ngx_queue_empty(&ahcf->idle->cache)) {
+        return NGX_DECLINED;
+    }
+
+    q = ngx_queue_head(&ahcf->idle->cache);
+    ngx_queue_remove(q);
+
+    item = ngx_queue_data(q, ngx_mail_auth_http_idle_conn_t, queue);
+
+    ngx_queue_insert_head(&ahcf->idle->free, q);
+
+    c = item->connection;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    c->idle = 0;
+    c->log = s->connection->log;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    ctx->peer.connection = c;
+    ctx->peer.cached = 1;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http get keepalive connection: %p", c);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_http_free_peer(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    ngx_queue_t                     *q;
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_conf_t       *ahcf;
+    ngx_mail_auth_http_idle_conn_t  *item;
+
+    c = ctx->peer.connection;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    /*
+     * the connection is kept only if the response was fully read,
+     * that is, an HTTP/1.1 response with a known empty or received body
+     */
+
+    if (ahcf->idle == NULL
+        || !ctx->keepalive
+        || ctx->request->pos != ctx->request->last
+        || ctx->content_length != ctx->response->last - ctx->response->pos
+        || c->read->eof
+        || c->read->error
+        || c->write->error)
+    {
+        ngx_close_connection(c);
+        return;
+    }
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_close_connection(c);
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http free keepalive connection: %p", c);
+
+    if (ngx_queue_empty(&ahcf->idle->free)) {
+        q = ngx_queue_last(&ahcf->idle->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_idle_conn_t, queue);
+
+        ngx_close_connection(item->connection);
+
+    } else {
+        q = ngx_queue_head(&ahcf->idle->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_auth_http_idle_conn_t, queue);
+    }
+
+    ngx_queue_insert_head(&ahcf->idle->cache, q);
+
+    item->connection = c;
+
+    c->data = item;
+    c->idle = 1;
+    c->pool = NULL;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+
+    c->read->handler = ngx_mail_auth_http_close_handler;
+    c->write->handler = ngx_mail_auth_http_dummy_handler;
+
+    ngx_add_timer(c->read, ahcf->keepalive_timeout);
+
+    if (c->read->ready) {
+        ngx_mail_auth_http_close_handler(c->read);
+    }
+}
+
+
+static void
+ngx_mail_auth_http_close_handler(ngx_event_t *ev)
+{
+    int                              n;
+    char                             buf[1];
+    ngx_connection_t                *c;
+    ngx_mail_auth_http_idle_conn_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail auth http keepalive close handler");
+
+    c = ev->data;
+
+    if (c->close || ev->timedout) {
+        goto close;
+    }
+
+    n = recv(c->fd, buf, 1, MSG_PEEK);
+
+    if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            goto close;
+        }
+
+        return;
+    }
+
+close:
+
+    item = c->data;
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->idle->free, &item->queue);
+
+    ngx_close_connection(c);
+}
+
+
 static void
 ngx_mail_auth_http_write_handler(ngx_event_t *wev)
 {
@@ -263,6 +582,17 @@ ngx_mail_auth_http_write_handler(ngx_event_t *wev)
     n = ngx_send(c, ctx->request->pos, size);
 
     if (n == NGX_ERROR) {
+
+        if (ctx->peer.cached) {
+
+            /* the keepalive connection was closed, retry with a new one */
+
+            ngx_close_connection(c);
+            ctx->request->pos = ctx->request->start;
+            ngx_mail_auth_http_connect(s, ctx, 0);
+            return;
+        }
+
         ngx_close_connection(c);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
@@ -346,6 +676,16 @@ ngx_mail_auth_http_read_handler(ngx_event_t *rev)
         return;
     }
 
+    if (ctx->peer.cached && ctx->response->last == ctx->response->start) {
+        ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0,
+                       "mail auth http keepalive connection closed");
+
+        ngx_close_connection(c);
+        ctx->request->pos = ctx->request->start;
+        ngx_mail_auth_http_connect(s, ctx, 0);
+        return;
+    }
+
     ngx_close_connection(c);
     ngx_destroy_pool(ctx->pool);
     ngx_mail_session_internal_server_error(s);
@@ -408,6 +748,7 @@ ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
 
         case sw_HTTP:
             if (ch == '/') {
+                ctx->version = p + 1;
                 state = sw_skip;
                 break;
             }
@@ -452,6 +793,13 @@ next:
 
 done:
 
+    if (ctx->version
+        && p - ctx->version >= 3
+        && ngx_strncmp(ctx->version, "1.1", 3) == 0)
+    {
+        ctx->keepalive = 1;
+    }
+
     ctx->response->pos = p + 1;
     ctx->state = 0;
     ctx->handler = ngx_mail_auth_http_process_headers;
@@ -466,7 +814,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     u_char      *p;
     time_t       timer;
     size_t       len, size;
-    ngx_int_t    rc, port, n;
+    ngx_int_t    rc, n;
     ngx_addr_t  *peer;
 
     ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
@@ -603,6 +951,9 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
             {
                 s->login.len = ctx->header_end - ctx->header_start;
 
+                ctx->user.len = s->login.len;
+                ctx->user.data = ctx->header_start;
+
                 s->login.data = ngx_pnalloc(s->connection->pool, s->login.len);
                 if (s->login.data == NULL) {
                     ngx_close_connection(ctx->peer.connection);
@@ -624,6 +975,9 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
             {
                 s->passwd.len = ctx->header_end - ctx->header_start;
 
+                ctx->pass.len = s->passwd.len;
+                ctx->pass.data = ctx->header_start;
+
                 s->passwd.data = ngx_pnalloc(s->connection->pool,
                                              s->passwd.len);
                 if (s->passwd.data == NULL) {
@@ -677,6 +1031,60 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 continue;
             }
 
+            if (len == sizeof("Auth-Cache-Valid") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Auth-Cache-Valid",
+                                   sizeof("Auth-Cache-Valid") - 1)
+                   == 0)
+            {
+                n = ngx_atoi(ctx->header_start,
+                             ctx->header_end - ctx->header_start);
+
+                if (n != NGX_ERROR) {
+                    ctx->cache_valid = n;
+                }
+
+                continue;
+            }
+
+            if (len == sizeof("Content-Length") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Content-Length",
+                                   sizeof("Content-Length") - 1)
+                   == 0)
+            {
+                ctx->content_length = ngx_atoof(ctx->header_start,
+                                         ctx->header_end - ctx->header_start);
+                continue;
+            }
+
+            if (len == sizeof("Connection") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Connection",
+                                   sizeof("Connection") - 1)
+                   == 0)
+            {
+                if (ctx->header_end - ctx->header_start == 5
+                    && ngx_strncasecmp(ctx->header_start,
+                                       (u_char *) "close", 5)
+                       == 0)
+                {
+                    ctx->keepalive = 0;
+                }
+
+                continue;
+            }
+
+            if (len == sizeof("Transfer-Encoding") - 1
+                && ngx_strncasecmp(ctx->header_name_start,
+                                   (u_char *) "Transfer-Encoding",
+                                   sizeof("Transfer-Encoding") - 1)
+                   == 0)
+            {
+                ctx->keepalive = 0;
+                continue;
+            }
+
             /* ignore other headers */
 
             continue;
@@ -686,7 +1094,7 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
             ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                            "mail auth http header done");
 
-            ngx_close_connection(ctx->peer.connection);
+            ngx_mail_auth_http_free_peer(s, ctx);
 
             if (ctx->err.len) {
 
@@ -772,65 +1180,18 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
                 return;
             }
 
-            peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
+            peer = ngx_mail_auth_http_peer(s, ctx->peer.name, &ctx->addr,
+                                           &ctx->port);
             if (peer == NULL) {
                 ngx_destroy_pool(ctx->pool);
                 ngx_mail_session_internal_server_error(s);
                 return;
             }
 
-            rc = ngx_parse_addr(s->connection->pool, peer,
-                                ctx->addr.data, ctx->addr.len);
-
-            switch (rc) {
-            case NGX_OK:
-                break;
-
-            case NGX_DECLINED:
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "address:\"%V\"",
-                              ctx->peer.name, &ctx->addr);
-                /* fall through */
-
-            default:
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
-
-            port = ngx_atoi(ctx->port.data, ctx->port.len);
-            if (port == NGX_ERROR || port < 1 || port > 65535) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "port:\"%V\"",
-                              ctx->peer.name, &ctx->port);
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
-
-            ngx_inet_set_port(peer->sockaddr, (in_port_t) port);
-
-            len = ctx->addr.len + 1 + ctx->port.len;
-
-            peer->name.len = len;
-
-            peer->name.data = ngx_pnalloc(s->connection->pool, len);
-            if (peer->name.data == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
+            if (ctx->cacheable) {
+                ngx_mail_auth_http_cache_store(s, ctx);
             }
 
-            len = ctx->addr.len;
-
-            ngx_memcpy(peer->name.data, ctx->addr.data, len);
-
-            peer->name.data[len++] = ':';
-
-            ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
-
             ngx_destroy_pool(ctx->pool);
             ngx_mail_proxy_init(s, peer);
 
@@ -855,33 +1216,93 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 }
 
 
-static void
-ngx_mail_auth_sleep_handler(ngx_event_t *rev)
+static ngx_addr_t *
+ngx_mail_auth_http_peer(ngx_mail_session_t *s, ngx_str_t *name,
+    ngx_str_t *addr, ngx_str_t *port)
 {
-    ngx_connection_t          *c;
-    ngx_mail_session_t        *s;
-    ngx_mail_core_srv_conf_t  *cscf;
+    size_t       len;
+    ngx_int_t    rc, n;
+    ngx_addr_t  *peer;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0, "mail auth sleep handler");
+    peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
+    if (peer == NULL) {
+        return NULL;
+    }
 
-    c = rev->data;
-    s = c->data;
+    rc = ngx_parse_addr(s->connection->pool, peer, addr->data, addr->len);
 
-    if (rev->timedout) {
+    switch (rc) {
+    case NGX_OK:
+        break;
 
-        rev->timedout = 0;
+    case NGX_DECLINED:
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "address:\"%V\"", name, addr);
+        /* fall through */
 
-        if (s->auth_wait) {
-            s->auth_wait = 0;
-            ngx_mail_auth_http_init(s);
-            return;
-        }
+    default:
+        return NULL;
+    }
 
-        cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+    n = ngx_atoi(port->data, port->len);
+    if (n == NGX_ERROR || n < 1 || n > 65535) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "port:\"%V\"", name, port);
+        return NULL;
+    }
 
-        rev->handler = cscf->protocol->auth_state;
+    ngx_inet_set_port(peer->sockaddr, (in_port_t) n);
 
-        s->mail_state = 0;
+    len = addr->len + 1 + port->len;
+
+    peer->name.len = len;
+
+    peer->name.data = ngx_pnalloc(s->connection->pool, len);
+    if (peer->name.data == NULL) {
+        return NULL;
+    }
+
+    len = addr->len;
+
+    ngx_memcpy(peer->name.data, addr->data, len);
+
+    peer->name.data[len++] = ':';
+
+    ngx_memcpy(peer->name.data + len, port->data, port->len);
+
+    return peer;
+}
+
+
+static void
+ngx_mail_auth_sleep_handler(ngx_event_t *rev)
+{
+    ngx_connection_t          *c;
+    ngx_mail_session_t        *s;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0, "mail auth sleep handler");
+
+    c = rev->data;
+    s = c->data;
+
+    if (rev->timedout) {
+
+        rev->timedout = 0;
+
+        if (s->auth_wait) {
+            s->auth_wait = 0;
+            ngx_mail_auth_http_init(s);
+            return;
+        }
+
+        cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+        rev->handler = cscf->protocol->auth_state;
+
+        s->mail_state = 0;
         s->auth_method = NGX_MAIL_AUTH_PLAIN;
 
         c->log->action = "in auth state";
@@ -1247,8 +1668,15 @@ ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
 
     b->last = ngx_cpymem(b->last, "GET ", sizeof("GET ") - 1);
     b->last = ngx_copy(b->last, ahcf->uri.data, ahcf->uri.len);
-    b->last = ngx_cpymem(b->last, " HTTP/1.0" CRLF,
-                         sizeof(" HTTP/1.0" CRLF) - 1);
+
+    if (ahcf->keepalive) {
+        b->last = ngx_cpymem(b->last, " HTTP/1.1" CRLF,
+                             sizeof(" HTTP/1.1" CRLF) - 1);
+
+    } else {
+        b->last = ngx_cpymem(b->last, " HTTP/1.0" CRLF,
+                             sizeof(" HTTP/1.0" CRLF) - 1);
+    }
 
     b->last = ngx_cpymem(b->last, "Host: ", sizeof("Host: ") - 1);
     b->last = ngx_copy(b->last, ahcf->host_header.data,
@@ -1415,6 +1843,379 @@ ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text, ngx_str_t *escaped)
 }
 
 
+static ngx_int_t
+ngx_mail_auth_http_cache_key(ngx_mail_session_t *s,
+    ngx_mail_auth_http_conf_t *ahcf, u_char *key)
+{
+    ngx_md5_t                  md5;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    /*
+     * only plain text passwords can be reused, APOP and CRAM-MD5
+     * digests depend on the salt sent in the session greeting
+     */
+
+    if (s->auth_method > NGX_MAIL_AUTH_LOGIN_USERNAME
+        || s->login.len == 0
+        || s->passwd.len == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+    ngx_md5_init(&md5);
+    ngx_md5_update(&md5, cscf->protocol->name.data, cscf->protocol->name.len);
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, ahcf->peer->name.data, ahcf->peer->name.len);
+    ngx_md5_update(&md5, ahcf->uri.data, ahcf->uri.len);
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, s->login.data, s->login.len);
+    ngx_md5_update(&md5, "", 1);
+    ngx_md5_update(&md5, s->passwd.data, s->passwd.len);
+    ngx_md5_final(key, &md5);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mail_auth_http_cache_lookup(ngx_mail_session_t *s,
+    ngx_mail_auth_http_conf_t *ahcf, u_char *key)
+{
+    u_char                           *p;
+    uint32_t                          hash;
+    ngx_str_t                         addr, port, user, pass;
+    ngx_addr_t                       *peer;
+    ngx_mail_auth_http_cache_t       *cache;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    cache = ahcf->cache_zone->data;
+
+    hash = ngx_crc32_short(key, 16);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_mail_auth_http_cache_find(cache, key, hash);
+
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (cn->expire < ngx_time()) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    p = ngx_pnalloc(s->connection->pool, cn->addr_len + cn->port_len
+                                         + cn->user_len + cn->pass_len);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, cn->data, cn->addr_len + cn->port_len
+                            + cn->user_len + cn->pass_len);
+
+    addr.len = cn->addr_len;
+    addr.data = p;
+    p += addr.len;
+
+    port.len = cn->port_len;
+    port.data = p;
+    p += port.len;
+
+    user.len = cn->user_len;
+    user.data = p;
+    p += user.len;
+
+    pass.len = cn->pass_len;
+    pass.data = p;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http cache hit: \"%V\" %V", &s->login, &addr);
+
+    if (user.len) {
+        s->login = user;
+    }
+
+    if (pass.len) {
+        s->passwd = pass;
+    }
+
+    peer = ngx_mail_auth_http_peer(s, &ahcf->peer->name, &addr, &port);
+    if (peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_mail_proxy_init(s, peer);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_http_cache_store(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    u_char                           *p;
+    size_t                            n;
+    time_t                            valid;
+    uint32_t                          hash;
+    ngx_mail_auth_http_conf_t        *ahcf;
+    ngx_mail_auth_http_cache_t       *cache;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    valid = (ctx->cache_valid != NGX_CONF_UNSET) ? ctx->cache_valid
+                                                 : ahcf->cache_valid;
+
+    if (valid <= 0) {
+        return;
+    }
+
+    cache = ahcf->cache_zone->data;
+
+    n = offsetof(ngx_mail_auth_http_cache_node_t, data)
+        + ctx->addr.len + ctx->port.len + ctx->user.len + ctx->pass.len;
+
+    hash = ngx_crc32_short(ctx->cache_key, 16);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_mail_auth_http_cache_find(cache, ctx->cache_key, hash);
+
+    if (cn) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+
+    ngx_mail_auth_http_cache_expire(cache, 1);
+
+    cn = ngx_slab_alloc_locked(cache->shpool, n);
+
+    if (cn == NULL) {
+        ngx_mail_auth_http_cache_expire(cache, 0);
+
+        cn = ngx_slab_alloc_locked(cache->shpool, n);
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, s->connection->log, 0,
+                          "could not allocate node%s",
+                          cache->shpool->log_ctx);
+            return;
+        }
+    }
+
+    cn->node.key = hash;
+    cn->expire = ngx_time() + valid;
+
+    ngx_memcpy(cn->key, ctx->cache_key, 16);
+
+    cn->addr_len = (u_short) ctx->addr.len;
+    cn->port_len = (u_short) ctx->port.len;
+    cn->user_len = (u_short) ctx->user.len;
+    cn->pass_len = (u_short) ctx->pass.len;
+
+    p = ngx_cpymem(cn->data, ctx->addr.data, ctx->addr.len);
+    p = ngx_cpymem(p, ctx->port.data, ctx->port.len);
+    p = ngx_cpymem(p, ctx->user.data, ctx->user.len);
+    ngx_memcpy(p, ctx->pass.data, ctx->pass.len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth http cache store: %T", valid);
+}
+
+
+static ngx_mail_auth_http_cache_node_t *
+ngx_mail_auth_http_cache_find(ngx_mail_auth_http_cache_t *cache, u_char *key,
+    uint32_t hash)
+{
+    ngx_int_t                         rc;
+    ngx_rbtree_node_t                *node, *sentinel;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_mail_auth_http_cache_node_t *) node;
+
+        rc = ngx_memcmp(key, cn->key, 16);
+
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_mail_auth_http_cache_expire(ngx_mail_auth_http_cache_t *cache,
+    ngx_uint_t n)
+{
+    time_t                            now;
+    ngx_queue_t                      *q;
+    ngx_mail_auth_http_cache_node_t  *cn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two expired entries
+     * n == 0 deletes oldest entry by force and one or two expired entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        cn = ngx_queue_data(q, ngx_mail_auth_http_cache_node_t, queue);
+
+        if (n++ != 0 && cn->expire >= now) {
+            return;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+    }
+}
+
+
+static void
+ngx_mail_auth_http_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                **p;
+    ngx_mail_auth_http_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_mail_auth_http_cache_node_t *) node;
+            cnt = (ngx_mail_auth_http_cache_node_t *) temp;
+
+            p = (ngx_memcmp(cn->key, cnt->key, 16) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_mail_auth_http_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_mail_auth_http_cache_t  *ocache = data;
+
+    size_t                       len;
+    ngx_mail_auth_http_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_mail_auth_http_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_mail_auth_http_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in auth_http cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in auth_http cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
 {
@@ -1427,6 +2228,9 @@ ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
 
     ahcf->timeout = NGX_CONF_UNSET_MSEC;
     ahcf->pass_client_cert = NGX_CONF_UNSET;
+    ahcf->keepalive = NGX_CONF_UNSET_UINT;
+    ahcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
+    ahcf->cache_zone = NGX_CONF_UNSET_PTR;
 
     ahcf->file = cf->conf_file->file.name.data;
     ahcf->line = cf->conf_file->line;
@@ -1464,6 +2268,48 @@ ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->pass_client_cert, prev->pass_client_cert, 0);
 
+    ngx_conf_merge_uint_value(conf->keepalive, prev->keepalive, 0);
+    ngx_conf_merge_msec_value(conf->keepalive_timeout,
+                              prev->keepalive_timeout, 60000);
+
+    if (conf->keepalive) {
+
+        /*
+         * servers inheriting both auth_http and auth_http_keepalive
+         * share the idle connections cache of the mail block
+         */
+
+        if (conf->peer == prev->peer && conf->keepalive == prev->keepalive) {
+
+            if (prev->idle == NULL) {
+                prev->idle = ngx_mail_auth_http_create_idle(cf,
+                                                            prev->keepalive);
+                if (prev->idle == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            conf->idle = prev->idle;
+
+        } else {
+            conf->idle = ngx_mail_auth_http_create_idle(cf, conf->keepalive);
+            if (conf->idle == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+    }
+
+    if (conf->cache_zone == NGX_CONF_UNSET_PTR) {
+        if (prev->cache_zone == NGX_CONF_UNSET_PTR) {
+            conf->cache_zone = NULL;
+            conf->cache_valid = 0;
+
+        } else {
+            conf->cache_zone = prev->cache_zone;
+            conf->cache_valid = prev->cache_valid;
+        }
+    }
+
     if (conf->headers == NULL) {
         conf->headers = prev->headers;
         conf->header = prev->header;
@@ -1572,3 +2418,151 @@ ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_mail_auth_http_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    u_char                      *p;
+    time_t                       valid;
+    ssize_t                      size;
+    ngx_str_t                   *value, name, s;
+    ngx_uint_t                   i;
+    ngx_mail_auth_http_cache_t  *cache;
+
+    if (ahcf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        ahcf->cache_zone = NULL;
+        ahcf->cache_valid = 0;
+
+        return NGX_CONF_OK;
+    }
+
+    ngx_str_null(&name);
+    size = 0;
+    valid = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[i].data + value[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+                if (size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "zone \"%V\" is too small", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+            } else {
+                name.len = value[i].len - 5;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+
+            if (valid == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid time \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    ahcf->cache_zone = ngx_shared_memory_add(cf, &name, size,
+                                             &ngx_mail_auth_http_module);
+    if (ahcf->cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ahcf->cache_zone->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_http_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ahcf->cache_zone->init = ngx_mail_auth_http_cache_init;
+        ahcf->cache_zone->data = cache;
+    }
+
+    ahcf->cache_valid = valid;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_mail_auth_http_idle_t *
+ngx_mail_auth_http_create_idle(ngx_conf_t *cf, ngx_uint_t n)
+{
+    ngx_uint_t                       i;
+    ngx_mail_auth_http_idle_t       *idle;
+    ngx_mail_auth_http_idle_conn_t  *items;
+
+    idle = ngx_palloc(cf->pool, sizeof(ngx_mail_auth_http_idle_t));
+    if (idle == NULL) {
+        return NULL;
+    }
+
+    items = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_http_idle_conn_t) * n);
+    if (items == NULL) {
+        return NULL;
+    }
+
+    ngx_queue_init(&idle->cache);
+    ngx_queue_init(&idle->free);
+
+    for (i = 0; i < n; i++) {
+        items[i].idle = idle;
+        ngx_queue_insert_head(&idle->free, &items[i].queue);
+    }
+
+    return idle;
+}
@@ -12,6 +12,7 @@
 ngx_uint_t  ngx_pagesize;
 ngx_uint_t  ngx_pagesize_shift;
 ngx_uint_t  ngx_cacheline_size;
+ngx_uint_t  ngx_huge_pagesize;
 
 
 void *
@@ -88,3 +89,68 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
 }
 
 #endif
+
+
+/*
+ * memory which is never freed, such as connection and event arrays,
+ * may be backed by huge pages to reduce TLB misses
+ */
+
+void *
+ngx_alloc_huge(size_t size, ngx_uint_t huge_pages, ngx_log_t *log)
+{
+    void  *p;
+
+    if (huge_pages == NGX_HUGE_PAGES_OFF) {
+        return ngx_alloc(size, log);
+    }
+
+    if (ngx_huge_pagesize == 0) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "huge pages are not supported, using normal pages");
+        return ngx_alloc(size, log);
+    }
+
+#if (NGX_HAVE_MAP_ANON && defined MAP_HUGETLB)
+
+    if (huge_pages == NGX_HUGE_PAGES_ON) {
+        p = mmap(NULL, ngx_align(size, ngx_huge_pagesize),
+                 PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_HUGETLB,
+                 -1, 0);
+
+        if (p != MAP_FAILED) {
+            ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                           "mmap(MAP_HUGETLB): %p:%uz", p, size);
+            return p;
+        }
+
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) failed, using normal pages",
+                      size);
+
+        return ngx_alloc(size, log);
+    }
+
+#endif
+
+#if (defined MADV_HUGEPAGE)
+
+    p = ngx_memalign(ngx_huge_pagesize, size, log);
+
+    if (p && madvise(p, size, MADV_HUGEPAGE) == -1) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE, %uz) failed, "
+                      "using normal pages", size);
+    }
+
+    return p;
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, log, 0,
+                  "huge pages are not supported, using normal pages");
+
+    return ngx_alloc(size, log);
+
+#endif
+}
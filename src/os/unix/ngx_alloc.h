@@ -37,9 +37,13 @@ void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log);
 #endif
 
 
+void *ngx_alloc_huge(size_t size, ngx_uint_t huge_pages, ngx_log_t *log);
+
+
 extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
 extern ngx_uint_t  ngx_cacheline_size;
+extern ngx_uint_t  ngx_huge_pagesize;
 
 
 #endif /* _NGX_ALLOC_H_INCLUDED_ */
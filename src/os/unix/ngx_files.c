@@ -85,6 +85,7 @@ typedef struct {
     size_t         size;
     ngx_chain_t   *chain;
     off_t          offset;
+    off_t          dontcache;
 
     size_t         nbytes;
     ngx_err_t      err;
@@ -476,6 +477,20 @@ eintr:
 ssize_t
 ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
     ngx_pool_t *pool)
+{
+    return ngx_thread_write_chain_to_file_dontcache(file, cl, offset, -1,
+                                                    pool);
+}
+
+
+/*
+ * if dontcache is not -1, the range from it to the end of the data written
+ * is dropped from the page cache in the thread after a successful write
+ */
+
+ssize_t
+ngx_thread_write_chain_to_file_dontcache(ngx_file_t *file, ngx_chain_t *cl,
+    off_t offset, off_t dontcache, ngx_pool_t *pool)
 {
     ngx_thread_task_t      *task;
     ngx_thread_file_ctx_t  *ctx;
@@ -524,6 +539,7 @@ ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
     ctx->fd = file->fd;
     ctx->chain = cl;
     ctx->offset = offset;
+    ctx->dontcache = dontcache;
 
     if (file->thread_handler(task, file) != NGX_OK) {
         return NGX_ERROR;
@@ -586,6 +602,18 @@ eintr:
         offset += n;
     } while (cl);
 
+#if (NGX_HAVE_DONTCACHE)
+
+    if (ctx->dontcache != -1
+        && ngx_dontcache(ctx->fd, ctx->dontcache, offset - ctx->dontcache)
+           == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_dontcache_n " failed");
+    }
+
+#endif
+
 #else
 
     ctx->err = NGX_ENOSYS;
@@ -825,6 +853,53 @@ ngx_read_ahead(ngx_fd_t fd, size_t n)
 #endif
 
 
+#if (NGX_HAVE_POSIX_FADVISE)
+
+/*
+ * POSIX_FADV_DONTNEED starts writeback of dirty pages in the range
+ * and drops the clean ones; pages which are still under writeback
+ * are dropped by subsequent calls
+ */
+
+ngx_int_t
+ngx_dontcache(ngx_fd_t fd, off_t offset, off_t size)
+{
+    int  err;
+
+    err = posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+
+    if (err == 0) {
+        return 0;
+    }
+
+    ngx_set_errno(err);
+    return NGX_FILE_ERROR;
+}
+
+
+/*
+ * POSIX_FADV_WILLNEED submits reads of the range to the disk
+ * without waiting for them to complete
+ */
+
+ngx_int_t
+ngx_prefetch(ngx_fd_t fd, off_t offset, off_t size)
+{
+    int  err;
+
+    err = posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+
+    if (err == 0) {
+        return 0;
+    }
+
+    ngx_set_errno(err);
+    return NGX_FILE_ERROR;
+}
+
+#endif
+
+
 #if (NGX_HAVE_O_DIRECT)
 
 ngx_int_t
@@ -323,6 +323,20 @@ ngx_int_t ngx_read_ahead(ngx_fd_t fd, size_t n);
 #endif
 
 
+#if (NGX_HAVE_POSIX_FADVISE)
+
+#define NGX_HAVE_DONTCACHE       1
+#define NGX_HAVE_PREFETCH        1
+
+ngx_int_t ngx_dontcache(ngx_fd_t fd, off_t offset, off_t size);
+#define ngx_dontcache_n          "posix_fadvise(POSIX_FADV_DONTNEED)"
+
+ngx_int_t ngx_prefetch(ngx_fd_t fd, off_t offset, off_t size);
+#define ngx_prefetch_n           "posix_fadvise(POSIX_FADV_WILLNEED)"
+
+#endif
+
+
 #if (NGX_HAVE_O_DIRECT)
 
 ngx_int_t ngx_directio_on(ngx_fd_t fd);
@@ -389,6 +403,8 @@ ssize_t ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size,
     off_t offset, ngx_pool_t *pool);
 ssize_t ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl,
     off_t offset, ngx_pool_t *pool);
+ssize_t ngx_thread_write_chain_to_file_dontcache(ngx_file_t *file,
+    ngx_chain_t *cl, off_t offset, off_t dontcache, ngx_pool_t *pool);
 #endif
 
 
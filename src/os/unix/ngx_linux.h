@@ -13,4 +13,45 @@ ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+#define NGX_LINUX_ZEROCOPY_SENDS  64
+
+typedef struct {
+    size_t       min_size;
+    off_t        inflight;
+
+    uint32_t     head;
+    uint32_t     tail;
+    uint64_t     done;
+    size_t       sent[NGX_LINUX_ZEROCOPY_SENDS];
+
+    unsigned     copied:1;
+    unsigned     disabled:1;
+} ngx_linux_zerocopy_t;
+
+
+ngx_int_t ngx_linux_zerocopy_init(ngx_connection_t *c, size_t min_size);
+void ngx_linux_zerocopy_abort(ngx_connection_t *c);
+
+#endif
+
+
+#if (NGX_HAVE_SPLICE)
+
+typedef struct {
+    ngx_fd_t     fd[2];
+    size_t       size;
+    ngx_log_t   *log;
+} ngx_splice_pipe_t;
+
+
+ngx_splice_pipe_t *ngx_linux_splice_pipe(ngx_pool_t *pool, ngx_log_t *log);
+ssize_t ngx_linux_splice_recv(ngx_connection_t *c, ngx_splice_pipe_t *p,
+    size_t size);
+ssize_t ngx_linux_splice_send(ngx_connection_t *c, ngx_splice_pipe_t *p);
+
+#endif
+
+
 #endif /* _NGX_LINUX_H_INCLUDED_ */
@@ -93,6 +93,33 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #include <sys/eventfd.h>
 #endif
 #include <sys/syscall.h>
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
+
+
+#if (NGX_HAVE_SIOCOUTQNSD)
+#include <linux/sockios.h>
+#endif
+
+
+#if (NGX_HAVE_UDP_SEGMENT)
+#include <netinet/udp.h>
+#endif
+
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+#include <linux/mempolicy.h>
+#endif
+
+
 #if (NGX_HAVE_FILE_AIO)
 #include <linux/aio_abi.h>
 typedef struct iocb  ngx_aiocb_t;
@@ -13,6 +13,9 @@ u_char  ngx_linux_kern_ostype[50];
 u_char  ngx_linux_kern_osrelease[50];
 
 
+static void ngx_linux_huge_pagesize(ngx_log_t *log);
+
+
 static ngx_os_io_t ngx_linux_io = {
     ngx_unix_recv,
     ngx_readv_chain,
@@ -48,10 +51,67 @@ ngx_os_specific_init(ngx_log_t *log)
 
     ngx_os_io = ngx_linux_io;
 
+    ngx_linux_huge_pagesize(log);
+
+#if (NGX_HAVE_NUMA)
+    ngx_numa_init(log);
+#endif
+
     return NGX_OK;
 }
 
 
+static void
+ngx_linux_huge_pagesize(ngx_log_t *log)
+{
+    u_char    *p, *last;
+    ssize_t    n;
+    ngx_fd_t   fd;
+    ngx_int_t  kb;
+    u_char     buf[4096];
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return;
+    }
+
+    buf[n] = '\0';
+
+    /* "Hugepagesize:       2048 kB" */
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+    if (p == NULL) {
+        return;
+    }
+
+    p += sizeof("Hugepagesize:") - 1;
+
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+
+    for (last = p; *last >= '0' && *last <= '9'; last++) { /* void */ }
+
+    kb = ngx_atoi(p, last - p);
+
+    if (kb != NGX_ERROR && kb > 0) {
+        ngx_huge_pagesize = kb * 1024;
+    }
+}
+
+
 void
 ngx_os_specific_status(ngx_log_t *log)
 {
@@ -13,6 +13,12 @@
 static ssize_t ngx_linux_sendfile(ngx_connection_t *c, ngx_buf_t *file,
     size_t size);
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static ngx_int_t ngx_linux_zerocopy_send(ngx_connection_t *c,
+    ngx_chain_t **in, off_t limit);
+static off_t ngx_linux_zerocopy_complete(ngx_connection_t *c);
+#endif
+
 #if (NGX_THREADS)
 #include <ngx_thread_pool.h>
 
@@ -63,13 +69,30 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         return in;
     }
 
-
     /* the maximum limit size is 2G-1 - the page size */
 
     if (limit == 0 || limit > (off_t) (NGX_SENDFILE_MAXSIZE - ngx_pagesize)) {
         limit = NGX_SENDFILE_MAXSIZE - ngx_pagesize;
     }
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+    if (c->zerocopy) {
+        switch (ngx_linux_zerocopy_send(c, &in, limit)) {
+
+        case NGX_OK:
+            return in;
+
+        case NGX_ERROR:
+            return NGX_CHAIN_ERROR;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+    }
+
+#endif
+
 
     send = 0;
 
@@ -226,6 +249,362 @@ ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 }
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+/*
+ * With MSG_ZEROCOPY the kernel references the memory of the buffers
+ * until the data are acknowledged, so the bytes sent are not consumed
+ * from the chain until the completion notification for the send is read
+ * from the socket error queue.  Buffers thus stay busy for the upper
+ * layers and cannot be reused or freed while the kernel still uses them.
+ */
+
+ngx_int_t
+ngx_linux_zerocopy_init(ngx_connection_t *c, size_t min_size)
+{
+    int                    zerocopy;
+    ngx_linux_zerocopy_t  *zc;
+
+    zc = c->zerocopy;
+
+    if (zc == NULL) {
+        zc = ngx_pcalloc(c->pool, sizeof(ngx_linux_zerocopy_t));
+        if (zc == NULL) {
+            return NGX_ERROR;
+        }
+
+        c->zerocopy = zc;
+
+        zerocopy = 1;
+
+        if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY,
+                       (const void *) &zerocopy, sizeof(int))
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                          "setsockopt(SO_ZEROCOPY) failed, ignored");
+            zc->disabled = 1;
+        }
+    }
+
+    zc->min_size = min_size;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_linux_zerocopy_abort(ngx_connection_t *c)
+{
+    struct sockaddr        sa;
+    ngx_linux_zerocopy_t  *zc;
+
+    zc = c->zerocopy;
+
+    if (ngx_linux_zerocopy_complete(c) != NGX_ERROR
+        && zc->head == zc->tail)
+    {
+        zc->inflight = 0;
+        return;
+    }
+
+    /*
+     * the memory still referenced by the kernel is going to be freed,
+     * so the connection is reset to drop the data not yet acknowledged
+     */
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "zerocopy abort, inflight:%O", zc->inflight);
+
+    ngx_memzero(&sa, sizeof(struct sockaddr));
+    sa.sa_family = AF_UNSPEC;
+
+    if (connect(c->fd, &sa, sizeof(struct sockaddr)) == -1) {
+        ngx_connection_error(c, ngx_socket_errno,
+                             "connect(AF_UNSPEC) failed");
+    }
+
+    zc->inflight = 0;
+    zc->disabled = 1;
+}
+
+
+static ngx_int_t
+ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_chain_t **in, off_t limit)
+{
+    off_t                  send, skip, released;
+    size_t                 size, total;
+    u_char                *prev;
+    ssize_t                n;
+    ngx_err_t              err;
+    ngx_uint_t             niovs;
+    ngx_chain_t           *cl;
+    struct msghdr          msg;
+    ngx_linux_zerocopy_t  *zc;
+    struct iovec           iovs[NGX_IOVS_PREALLOCATE];
+
+    zc = c->zerocopy;
+
+    if (zc->inflight) {
+        released = ngx_linux_zerocopy_complete(c);
+
+        if (released == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (released) {
+            zc->inflight -= released;
+            *in = ngx_chain_update_sent(*in, released);
+        }
+
+    } else if (zc->disabled || zc->copied) {
+        return NGX_DECLINED;
+    }
+
+    send = 0;
+
+    for ( ;; ) {
+
+        /* skip the data still referenced by the kernel */
+
+        skip = zc->inflight;
+
+        for (cl = *in; cl; cl = cl->next) {
+
+            if (ngx_buf_special(cl->buf)) {
+                continue;
+            }
+
+            if (!ngx_buf_in_memory_only(cl->buf)) {
+                break;
+            }
+
+            size = cl->buf->last - cl->buf->pos;
+
+            if ((off_t) size > skip) {
+                break;
+            }
+
+            skip -= size;
+        }
+
+        /* create the iovec of the following memory bufs */
+
+        prev = NULL;
+        niovs = 0;
+        total = 0;
+
+        for ( /* void */ ; cl && send + (off_t) total < limit; cl = cl->next) {
+
+            if (ngx_buf_special(cl->buf)) {
+                continue;
+            }
+
+            if (!ngx_buf_in_memory_only(cl->buf)) {
+                break;
+            }
+
+            size = cl->buf->last - cl->buf->pos - (size_t) skip;
+
+            if ((off_t) size > limit - send - (off_t) total) {
+                size = (size_t) (limit - send - total);
+            }
+
+            if (prev == cl->buf->pos + skip) {
+                iovs[niovs - 1].iov_len += size;
+
+            } else {
+                if (niovs == NGX_IOVS_PREALLOCATE) {
+                    break;
+                }
+
+                iovs[niovs].iov_base = (void *) (cl->buf->pos + skip);
+                iovs[niovs].iov_len = size;
+                niovs++;
+            }
+
+            prev = cl->buf->pos + skip + size;
+            total += size;
+            skip = 0;
+        }
+
+        if (zc->inflight == 0
+            && (total == 0 || total < zc->min_size
+                || zc->disabled || zc->copied))
+        {
+            return NGX_DECLINED;
+        }
+
+        if (send >= limit) {
+            return NGX_OK;
+        }
+
+        if (total == 0 || zc->tail - zc->head == NGX_LINUX_ZEROCOPY_SENDS) {
+            /* wait for completions */
+            c->write->ready = 0;
+            return NGX_OK;
+        }
+
+        ngx_memzero(&msg, sizeof(struct msghdr));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = niovs;
+
+    eintr:
+
+        n = sendmsg(c->fd, &msg, MSG_ZEROCOPY);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "zerocopy sendmsg: #%uD %z of %uz, inflight:%O",
+                       zc->tail, n, total, zc->inflight);
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            switch (err) {
+            case NGX_EAGAIN:
+                c->write->ready = 0;
+                return NGX_OK;
+
+            case NGX_ENOBUFS:
+
+                /* too many notifications pending, copy the data */
+
+                if (zc->inflight == 0) {
+                    return NGX_DECLINED;
+                }
+
+                c->write->ready = 0;
+                return NGX_OK;
+
+            case NGX_EINTR:
+                goto eintr;
+
+            default:
+                c->write->error = 1;
+                ngx_connection_error(c, err, "sendmsg(MSG_ZEROCOPY) failed");
+                return NGX_ERROR;
+            }
+        }
+
+        zc->sent[zc->tail % NGX_LINUX_ZEROCOPY_SENDS] = n;
+        zc->tail++;
+
+        zc->inflight += n;
+        c->sent += n;
+        send += n;
+
+        if ((size_t) n < total) {
+            c->write->ready = 0;
+            return NGX_OK;
+        }
+    }
+}
+
+
+static off_t
+ngx_linux_zerocopy_complete(ngx_connection_t *c)
+{
+    off_t                      released;
+    ssize_t                    n;
+    uint32_t                   seq, lo, hi;
+    ngx_err_t                  err;
+    struct msghdr              msg;
+    struct cmsghdr            *cmsg;
+    ngx_linux_zerocopy_t      *zc;
+    struct sock_extended_err  *ee;
+    u_char                     buf[CMSG_SPACE(sizeof(struct sock_extended_err)
+                                              + sizeof(struct sockaddr_in6))];
+
+    zc = c->zerocopy;
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+        msg.msg_control = buf;
+        msg.msg_controllen = sizeof(buf);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EAGAIN) {
+                break;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            c->write->error = 1;
+            ngx_connection_error(c, err, "recvmsg(MSG_ERRQUEUE) failed");
+            return NGX_ERROR;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == IPPROTO_IP
+                  && cmsg->cmsg_type == IP_RECVERR)
+#if (NGX_HAVE_INET6)
+                && !(cmsg->cmsg_level == IPPROTO_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR)
+#endif
+                )
+            {
+                continue;
+            }
+
+            ee = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            lo = ee->ee_info;
+            hi = ee->ee_data;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy completion: #%uD-#%uD%s", lo, hi,
+                           (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                           ? " copied" : "");
+
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* no reason to pay for page pinning */
+                zc->copied = 1;
+            }
+
+            for (seq = lo; seq - lo <= hi - lo; seq++) {
+
+                if (seq - zc->head < zc->tail - zc->head) {
+                    zc->done |= (uint64_t) 1
+                                << (seq % NGX_LINUX_ZEROCOPY_SENDS);
+                }
+
+                if (seq == hi) {
+                    break;
+                }
+            }
+        }
+    }
+
+    released = 0;
+
+    while (zc->head != zc->tail
+           && (zc->done
+               & ((uint64_t) 1 << (zc->head % NGX_LINUX_ZEROCOPY_SENDS))))
+    {
+        zc->done &= ~((uint64_t) 1 << (zc->head % NGX_LINUX_ZEROCOPY_SENDS));
+        released += zc->sent[zc->head % NGX_LINUX_ZEROCOPY_SENDS];
+        zc->head++;
+    }
+
+    return released;
+}
+
+#endif
+
+
 static ssize_t
 ngx_linux_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
 {
@@ -0,0 +1,182 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * splice() moves data between two plain TCP sockets through a pipe
+ * without copying it to user space.  The pipe is only refilled once
+ * it was completely drained, so EAGAIN from a socket-to-pipe splice()
+ * always means that there is no data in the socket.
+ */
+
+
+static void ngx_linux_splice_cleanup(void *data);
+
+
+ngx_splice_pipe_t *
+ngx_linux_splice_pipe(ngx_pool_t *pool, ngx_log_t *log)
+{
+    ngx_pool_cleanup_t  *cln;
+    ngx_splice_pipe_t   *p;
+
+    p = ngx_palloc(pool, sizeof(ngx_splice_pipe_t));
+    if (p == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    if (pipe2(p->fd, O_NONBLOCK|O_CLOEXEC) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "pipe2() failed");
+        return NULL;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "splice pipe: %d:%d", p->fd[0], p->fd[1]);
+
+    p->size = 0;
+    p->log = log;
+
+    cln->handler = ngx_linux_splice_cleanup;
+    cln->data = p;
+
+    return p;
+}
+
+
+static void
+ngx_linux_splice_cleanup(void *data)
+{
+    ngx_splice_pipe_t  *p = data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "splice pipe close: %d:%d", p->fd[0], p->fd[1]);
+
+    if (close(p->fd[0]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno, "close() pipe failed");
+    }
+
+    if (close(p->fd[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_errno, "close() pipe failed");
+    }
+}
+
+
+ssize_t
+ngx_linux_splice_recv(ngx_connection_t *c, ngx_splice_pipe_t *p, size_t size)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *rev;
+
+    rev = c->read;
+
+    for ( ;; ) {
+        n = splice(c->fd, NULL, p->fd[1], NULL, size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "splice recv: fd:%d %z of %uz", c->fd, n, size);
+
+        if (n > 0) {
+
+            /*
+             * a short splice() does not mean that the socket is drained,
+             * as the pipe might have run out of buffers
+             */
+
+            p->size += n;
+            return n;
+        }
+
+        if (n == 0) {
+            rev->ready = 0;
+            rev->eof = 1;
+            return 0;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EAGAIN || err == NGX_EINTR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "splice() not ready");
+
+            if (err == NGX_EAGAIN) {
+                rev->ready = 0;
+                return NGX_AGAIN;
+            }
+
+            continue;
+        }
+
+        rev->error = 1;
+        ngx_connection_error(c, err, "splice() from socket failed");
+
+        return NGX_ERROR;
+    }
+}
+
+
+ssize_t
+ngx_linux_splice_send(ngx_connection_t *c, ngx_splice_pipe_t *p)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_event_t  *wev;
+
+    wev = c->write;
+
+    for ( ;; ) {
+        n = splice(p->fd[0], NULL, c->fd, NULL, p->size,
+                   SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "splice send: fd:%d %z of %uz", c->fd, n, p->size);
+
+        if (n > 0) {
+            if ((size_t) n < p->size) {
+                wev->ready = 0;
+            }
+
+            p->size -= n;
+            c->sent += n;
+
+            return n;
+        }
+
+        err = ngx_socket_errno;
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, err, "splice() returned zero");
+            wev->error = 1;
+            return NGX_ERROR;
+        }
+
+        if (err == NGX_EAGAIN || err == NGX_EINTR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "splice() not ready");
+
+            if (err == NGX_EAGAIN) {
+                wev->ready = 0;
+                return NGX_AGAIN;
+            }
+
+            continue;
+        }
+
+        wev->error = 1;
+        ngx_connection_error(c, err, "splice() to socket failed");
+
+        return NGX_ERROR;
+    }
+}
@@ -17,13 +17,17 @@ static void ngx_start_cache_manager_processes(ngx_cycle_t *cycle,
     ngx_uint_t respawn);
 static void ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
+static ngx_uint_t ngx_worker_processes_alive(void);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker);
 static void ngx_worker_process_exit(ngx_cycle_t *cycle);
 static void ngx_channel_handler(ngx_event_t *ev);
+static void ngx_handoff_idle_connections(ngx_cycle_t *cycle);
+static ngx_int_t ngx_handoff_socket(ngx_cycle_t *cycle, ngx_socket_t s);
 static void ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data);
+static void ngx_cache_manager_process_flush(ngx_cycle_t *cycle);
 static void ngx_cache_manager_process_handler(ngx_event_t *ev);
 static void ngx_cache_loader_process_handler(ngx_event_t *ev);
 
@@ -240,9 +244,37 @@ ngx_master_process_cycle(ngx_cycle_t *cycle)
             ngx_cycle = cycle;
             ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                                    ngx_core_module);
+
+            /*
+             * after the WINCH signal there are no worker processes,
+             * and reload is the way to start them again
+             */
+
+            if (ccf->reload_keep_workers
+                && cycle->conf_unchanged
+                && !ngx_noaccepting
+                && ngx_worker_processes_alive())
+            {
+                ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                              "configuration is not changed, "
+                              "keeping worker processes");
+
+                /*
+                 * log files are not a part of the digest, and might have
+                 * been rotated, so the kept processes reopen them as on
+                 * the reopen signal
+                 */
+
+                ngx_reopen_files(cycle, ccf->user);
+                ngx_signal_worker_processes(cycle,
+                                        ngx_signal_value(NGX_REOPEN_SIGNAL));
+                continue;
+            }
+
             ngx_start_worker_processes(cycle, ccf->worker_processes,
                                        NGX_PROCESS_JUST_RESPAWN);
             ngx_start_cache_manager_processes(cycle, 1);
+            ngx_noaccepting = 0;
 
             /* allow new processes to start */
             ngx_msleep(100);
@@ -437,6 +469,21 @@ ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch)
             continue;
         }
 
+        /*
+         * worker processes started on reconfiguration may take over
+         * idle connections of the processes of previous generations
+         */
+
+        if (ngx_processes[ch->slot].proc == ngx_worker_process_cycle
+            && ngx_processes[ch->slot].just_spawn
+            && !ngx_processes[i].just_spawn)
+        {
+            ch->command = NGX_CMD_HANDOFF_CHANNEL;
+
+        } else {
+            ch->command = NGX_CMD_OPEN_CHANNEL;
+        }
+
         ngx_log_debug6(NGX_LOG_DEBUG_CORE, cycle->log, 0,
                       "pass channel s:%i pid:%P fd:%d to s:%i pid:%P fd:%d",
                       ch->slot, ch->pid, ch->fd,
@@ -553,6 +600,28 @@ ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo)
 }
 
 
+static ngx_uint_t
+ngx_worker_processes_alive(void)
+{
+    ngx_int_t  i;
+
+    for (i = 0; i < ngx_last_process; i++) {
+
+        if (ngx_processes[i].pid == -1
+            || ngx_processes[i].exiting
+            || ngx_processes[i].exited
+            || ngx_processes[i].proc != ngx_worker_process_cycle)
+        {
+            continue;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
 static ngx_uint_t
 ngx_reap_children(ngx_cycle_t *cycle)
 {
@@ -763,6 +832,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
                 ngx_exiting = 1;
                 ngx_set_shutdown_timer(cycle);
                 ngx_close_listening_sockets(cycle);
+                ngx_handoff_idle_connections(cycle);
                 ngx_close_idle_connections(cycle);
             }
         }
@@ -851,6 +921,12 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
 
         if (cpu_affinity) {
             ngx_setaffinity(cpu_affinity, cycle->log);
+
+#if (NGX_HAVE_NUMA)
+            if (ccf->numa) {
+                ngx_numa_set_local(cpu_affinity, cycle->log);
+            }
+#endif
         }
     }
 
@@ -1062,6 +1138,7 @@ ngx_channel_handler(ngx_event_t *ev)
             break;
 
         case NGX_CMD_OPEN_CHANNEL:
+        case NGX_CMD_HANDOFF_CHANNEL:
 
             ngx_log_debug3(NGX_LOG_DEBUG_CORE, ev->log, 0,
                            "get channel s:%i pid:%P fd:%d",
@@ -1069,6 +1146,31 @@ ngx_channel_handler(ngx_event_t *ev)
 
             ngx_processes[ch.slot].pid = ch.pid;
             ngx_processes[ch.slot].channel[0] = ch.fd;
+            ngx_processes[ch.slot].handoff =
+                                     (ch.command == NGX_CMD_HANDOFF_CHANNEL);
+            break;
+
+        case NGX_CMD_HANDOFF:
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                           "get connection fd:%d from pid:%P", ch.fd, ch.pid);
+
+            if (ngx_process == NGX_PROCESS_WORKER && !ngx_exiting) {
+                ngx_event_handoff((ngx_cycle_t *) ngx_cycle, ch.fd);
+                break;
+            }
+
+            /* an exiting worker passes the connection further */
+
+            if (ngx_process == NGX_PROCESS_WORKER) {
+                (void) ngx_handoff_socket((ngx_cycle_t *) ngx_cycle, ch.fd);
+            }
+
+            if (ngx_close_socket(ch.fd) == -1) {
+                ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_socket_errno,
+                              ngx_close_socket_n " failed");
+            }
+
             break;
 
         case NGX_CMD_CLOSE_CHANNEL:
@@ -1084,12 +1186,101 @@ ngx_channel_handler(ngx_event_t *ev)
             }
 
             ngx_processes[ch.slot].channel[0] = -1;
+            ngx_processes[ch.slot].handoff = 0;
             break;
         }
     }
 }
 
 
+static void
+ngx_handoff_idle_connections(ngx_cycle_t *cycle)
+{
+    ngx_uint_t         i, n;
+    ngx_core_conf_t   *ccf;
+    ngx_connection_t  *c;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->connection_handoff) {
+        return;
+    }
+
+    n = 0;
+    c = cycle->connections;
+
+    for (i = 0; i < cycle->connection_n; i++) {
+
+        if (c[i].fd == (ngx_socket_t) -1 || !c[i].idle || !c[i].handoff) {
+            continue;
+        }
+
+        if (ngx_handoff_socket(cycle, c[i].fd) != NGX_OK) {
+            break;
+        }
+
+        /*
+         * the socket remains open in another process, so it has to be
+         * removed from epoll explicitly before it is closed here
+         */
+
+        if (ngx_event_flags & NGX_USE_EPOLL_EVENT) {
+            ngx_del_conn(&c[i], 0);
+        }
+
+        n++;
+    }
+
+    if (n) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "%ui idle connections passed to new worker processes",
+                      n);
+    }
+}
+
+
+static ngx_int_t
+ngx_handoff_socket(ngx_cycle_t *cycle, ngx_socket_t s)
+{
+    ngx_int_t         i, n;
+    ngx_channel_t     ch;
+    static ngx_int_t  next;
+
+    ngx_memzero(&ch, sizeof(ngx_channel_t));
+
+    ch.command = NGX_CMD_HANDOFF;
+    ch.pid = ngx_pid;
+    ch.slot = ngx_process_slot;
+    ch.fd = s;
+
+    for (n = 0; n < NGX_MAX_PROCESSES; n++) {
+
+        i = (next + n) % NGX_MAX_PROCESSES;
+
+        if (!ngx_processes[i].handoff
+            || ngx_processes[i].pid == -1
+            || ngx_processes[i].channel[0] == -1)
+        {
+            continue;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "pass connection fd:%d to s:%i pid:%P",
+                       s, i, ngx_processes[i].pid);
+
+        if (ngx_write_channel(ngx_processes[i].channel[0], &ch,
+                              sizeof(ngx_channel_t), cycle->log)
+            == NGX_OK)
+        {
+            next = i + 1;
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
 static void
 ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 {
@@ -1127,6 +1318,13 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 
         if (ngx_terminate || ngx_quit) {
             ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
+
+            if (ev.timer_set) {
+                ngx_del_timer(&ev);
+            }
+
+            ngx_cache_manager_process_flush(cycle);
+
             exit(0);
         }
 
@@ -1141,6 +1339,40 @@ ngx_cache_manager_process_cycle(ngx_cycle_t *cycle, void *data)
 }
 
 
+static void
+ngx_cache_manager_process_flush(ngx_cycle_t *cycle)
+{
+    ngx_uint_t    i, done;
+    ngx_path_t  **path;
+
+    /*
+     * operations started by path managers, such as cache files being
+     * deleted by threads, are completed before exit, as otherwise
+     * the shared state they hold would never be released
+     */
+
+    for ( ;; ) {
+        done = 1;
+
+        path = cycle->paths.elts;
+        for (i = 0; i < cycle->paths.nelts; i++) {
+
+            if (path[i]->flusher
+                && path[i]->flusher(path[i]->data) == NGX_AGAIN)
+            {
+                done = 0;
+            }
+        }
+
+        if (done) {
+            return;
+        }
+
+        ngx_process_events_and_timers(cycle);
+    }
+}
+
+
 static void
 ngx_cache_manager_process_handler(ngx_event_t *ev)
 {
@@ -51,3 +51,215 @@ ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log)
 }
 
 #endif
+
+
+#if (NGX_HAVE_NUMA)
+
+ngx_uint_t  ngx_numa_nodes;
+
+static unsigned long  ngx_numa_node_mask;
+
+/* node number plus one, zero for CPUs of unknown nodes */
+static u_char  ngx_numa_cpu_node[CPU_SETSIZE];
+
+
+void
+ngx_numa_init(ngx_log_t *log)
+{
+    u_char      *p, *last;
+    ssize_t      n;
+    ngx_fd_t     fd;
+    ngx_uint_t   node, cpu, from, digits;
+    u_char       buf[4096];
+    u_char       path[sizeof("/sys/devices/system/node/node/cpulist")
+                      + NGX_INT_T_LEN];
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        ngx_sprintf(path, "/sys/devices/system/node/node%ui/cpulist%Z", node);
+
+        fd = ngx_open_file(path, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+        if (fd == NGX_INVALID_FILE) {
+            continue;
+        }
+
+        n = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+        if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          ngx_close_file_n " \"%s\" failed", path);
+        }
+
+        if (n <= 0) {
+            continue;
+        }
+
+        /* the list looks like "0-3,8-11\n" */
+
+        last = buf + n;
+        *last = '\n';
+
+        cpu = 0;
+        from = (ngx_uint_t) -1;
+        digits = 0;
+
+        for (p = buf; p <= last; p++) {
+
+            if (*p >= '0' && *p <= '9') {
+                cpu = cpu * 10 + (*p - '0');
+                digits++;
+                continue;
+            }
+
+            if (*p == '-' && digits) {
+                from = cpu;
+                cpu = 0;
+                digits = 0;
+                continue;
+            }
+
+            if (digits) {
+                if (from > cpu) {
+                    from = cpu;
+                }
+
+                while (from <= cpu && from < CPU_SETSIZE) {
+                    ngx_numa_cpu_node[from++] = (u_char) (node + 1);
+                }
+            }
+
+            cpu = 0;
+            from = (ngx_uint_t) -1;
+            digits = 0;
+
+            if (*p == ',') {
+                continue;
+            }
+
+            break;
+        }
+
+        ngx_numa_node_mask |= 1UL << node;
+        ngx_numa_nodes++;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, log, 0,
+                   "numa nodes: %ui, mask: %xl",
+                   ngx_numa_nodes, ngx_numa_node_mask);
+}
+
+
+ngx_int_t
+ngx_numa_node(ngx_uint_t cpu)
+{
+    if (cpu >= CPU_SETSIZE || ngx_numa_cpu_node[cpu] == 0) {
+        return NGX_ERROR;
+    }
+
+    return ngx_numa_cpu_node[cpu] - 1;
+}
+
+
+ngx_int_t
+ngx_numa_auto_cpu(ngx_cpuset_t *mask, ngx_uint_t n)
+{
+    ngx_int_t   node;
+    ngx_uint_t  i, k, used;
+    ngx_uint_t  count[NGX_NUMA_MAX_NODES], nodes[NGX_NUMA_MAX_NODES];
+
+    /*
+     * workers are distributed over the nodes round-robin,
+     * and over the CPUs of the mask within each node
+     */
+
+    ngx_memzero(count, sizeof(count));
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        node = ngx_numa_node(i);
+
+        if (node != NGX_ERROR && CPU_ISSET(i, mask)) {
+            count[node]++;
+        }
+    }
+
+    used = 0;
+
+    for (i = 0; i < NGX_NUMA_MAX_NODES; i++) {
+        if (count[i]) {
+            nodes[used++] = i;
+        }
+    }
+
+    if (used == 0) {
+        return NGX_ERROR;
+    }
+
+    node = nodes[n % used];
+    k = (n / used) % count[node];
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, mask) && ngx_numa_node(i) == node && k-- == 0) {
+            return i;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+void
+ngx_numa_set_local(ngx_cpuset_t *cpu_affinity, ngx_log_t *log)
+{
+    ngx_int_t      node;
+    ngx_uint_t     i;
+    unsigned long  mask;
+
+    if (ngx_numa_nodes < 2) {
+        return;
+    }
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, cpu_affinity)) {
+            break;
+        }
+    }
+
+    node = ngx_numa_node(i);
+
+    if (node == NGX_ERROR) {
+        return;
+    }
+
+    mask = 1UL << node;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "set_mempolicy(MPOL_PREFERRED, %i)", node);
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                NGX_NUMA_MAX_NODES + 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy() failed");
+    }
+}
+
+
+void
+ngx_numa_interleave(void *addr, size_t size, ngx_log_t *log)
+{
+    if (ngx_numa_nodes < 2) {
+        return;
+    }
+
+    if (syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, &ngx_numa_node_mask,
+                NGX_NUMA_MAX_NODES + 1, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mbind(MPOL_INTERLEAVE) failed");
+    }
+}
+
+#endif
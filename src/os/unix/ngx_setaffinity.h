@@ -25,6 +25,21 @@ typedef cpuset_t  ngx_cpuset_t;
 
 void ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
 
+
+#if (NGX_HAVE_NUMA)
+
+#define NGX_NUMA_MAX_NODES  (8 * sizeof(unsigned long))
+
+extern ngx_uint_t  ngx_numa_nodes;
+
+void ngx_numa_init(ngx_log_t *log);
+ngx_int_t ngx_numa_node(ngx_uint_t cpu);
+ngx_int_t ngx_numa_auto_cpu(ngx_cpuset_t *mask, ngx_uint_t n);
+void ngx_numa_set_local(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
+void ngx_numa_interleave(void *addr, size_t size, ngx_log_t *log);
+
+#endif
+
 #else
 
 #define ngx_setaffinity(cpu_affinity, log)
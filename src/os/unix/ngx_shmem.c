@@ -14,6 +14,35 @@
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+    if (shm->huge_pages != NGX_HUGE_PAGES_OFF && ngx_huge_pagesize == 0) {
+        ngx_log_error(NGX_LOG_WARN, shm->log, 0,
+                      "huge pages are not supported, using normal pages "
+                      "for shared memory zone \"%V\"", &shm->name);
+        shm->huge_pages = NGX_HUGE_PAGES_OFF;
+    }
+
+#ifdef MAP_HUGETLB
+
+    if (shm->huge_pages == NGX_HUGE_PAGES_ON) {
+        shm->addr = (u_char *) mmap(NULL, ngx_align(shm->size,
+                                                    ngx_huge_pagesize),
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+        if (shm->addr != MAP_FAILED) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) failed, using normal pages "
+                      "for shared memory zone \"%V\"",
+                      shm->size, &shm->name);
+
+        shm->huge_pages = NGX_HUGE_PAGES_OFF;
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -24,6 +53,19 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#ifdef MADV_HUGEPAGE
+
+    if (shm->huge_pages != NGX_HUGE_PAGES_OFF
+        && madvise(shm->addr, shm->size, MADV_HUGEPAGE) == -1)
+    {
+        ngx_log_error(NGX_LOG_WARN, shm->log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE, %uz) failed, using normal pages "
+                      "for shared memory zone \"%V\"",
+                      shm->size, &shm->name);
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -31,9 +73,21 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#ifdef MAP_HUGETLB
+
+    if (shm->huge_pages == NGX_HUGE_PAGES_ON) {
+        size = ngx_align(size, ngx_huge_pagesize);
+    }
+
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 
@@ -54,6 +54,14 @@ int ngx_tcp_push(ngx_socket_t s);
 #endif
 
 
+#if (NGX_HAVE_SIOCOUTQNSD)
+
+#define ngx_socket_unsent(s, n)  ioctl(s, SIOCOUTQNSD, n)
+#define ngx_socket_unsent_n      "ioctl(SIOCOUTQNSD)"
+
+#endif
+
+
 #define ngx_shutdown_socket    shutdown
 #define ngx_shutdown_socket_n  "shutdown()"
 
@@ -10,20 +10,68 @@
 #include <ngx_event.h>
 
 
+/*
+ * up to NGX_UDP_SEND_BATCH datagrams from the chain are sent at once,
+ * either as a single segmented message if they are of equal size and
+ * UDP segmentation offload is available, or with sendmmsg()
+ */
+
+#if (NGX_HAVE_SENDMMSG)
+#define NGX_UDP_SEND_BATCH  16
+#else
+#define NGX_UDP_SEND_BATCH  1
+#endif
+
+/* the maximum UDP payload, taking IPv6 and UDP headers into account */
+#define NGX_UDP_GSO_MAX     (65535 - 48)
+
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+typedef union {
+    u_char                    buf[CMSG_SPACE(sizeof(ngx_sockaddr_t))
+#if (NGX_HAVE_UDP_SEGMENT)
+                                  + CMSG_SPACE(sizeof(uint16_t))
+#endif
+                                  ];
+    struct cmsghdr            cmsg;
+} ngx_udp_control_t;
+
+#endif
+
+
 static ngx_chain_t *ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec,
     ngx_chain_t *in, ngx_log_t *log);
-static ssize_t ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec);
+static ssize_t ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec,
+    size_t segment);
+#if (NGX_HAVE_SENDMMSG)
+static ssize_t ngx_sendmmsg(ngx_connection_t *c, ngx_iovec_t *vecs,
+    ngx_uint_t nvecs);
+#endif
+static void ngx_sendmsg_init(ngx_connection_t *c, struct msghdr *msg,
+    void *control, size_t segment);
+
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+/* datagrams of this size or larger are not sent with segmentation offload */
+static size_t  ngx_udp_gso_limit = NGX_UDP_GSO_MAX + 1;
+
+#endif
 
 
 ngx_chain_t *
 ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
+    size_t         segment;
     ssize_t        n;
     off_t          send;
-    ngx_chain_t   *cl;
+    ngx_uint_t     nvecs, niovs;
+    ngx_chain_t   *cl, *next;
     ngx_event_t   *wev;
-    ngx_iovec_t    vec;
-    struct iovec   iovs[NGX_IOVS_PREALLOCATE];
+    ngx_iovec_t    vec, vecs[NGX_UDP_SEND_BATCH];
+
+    static struct iovec  iovs[NGX_UDP_SEND_BATCH * NGX_IOVS_PREALLOCATE];
 
     wev = c->write;
 
@@ -50,20 +98,62 @@ ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     send = 0;
 
-    vec.iovs = iovs;
-    vec.nalloc = NGX_IOVS_PREALLOCATE;
-
     for ( ;; ) {
 
-        /* create the iovec and coalesce the neighbouring bufs */
+        /*
+         * create the iovecs of the datagrams and coalesce the neighbouring
+         * bufs; iovecs of all datagrams are placed one after another
+         */
 
-        cl = ngx_udp_output_chain_to_iovec(&vec, in, c->log);
+        vec.size = 0;
+        segment = 0;
+        nvecs = 0;
+        niovs = 0;
 
-        if (cl == NGX_CHAIN_ERROR) {
-            return NGX_CHAIN_ERROR;
+        for (cl = in; cl && nvecs < NGX_UDP_SEND_BATCH; cl = next) {
+
+            vecs[nvecs].iovs = &iovs[niovs];
+            vecs[nvecs].nalloc = NGX_IOVS_PREALLOCATE;
+
+            next = ngx_udp_output_chain_to_iovec(&vecs[nvecs], cl, c->log);
+
+            if (next == NGX_CHAIN_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (next == cl) {
+                break;
+            }
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+            /*
+             * datagrams of equal size, except for the last one which
+             * may be shorter, can be sent as a single segmented message
+             */
+
+            if (nvecs == 0) {
+                segment = vecs[0].size;
+
+            } else if (vecs[nvecs - 1].size != segment
+                       || vecs[nvecs].size > segment
+                       || vecs[nvecs].size == 0)
+            {
+                segment = 0;
+            }
+
+#endif
+
+            niovs += vecs[nvecs].count;
+            vec.size += vecs[nvecs].size;
+            nvecs++;
+
+            if (send + (off_t) vec.size >= limit) {
+                break;
+            }
         }
 
-        if (cl && cl->buf->in_file) {
+        if (nvecs == 0 && cl && cl->buf->in_file) {
             ngx_log_error(NGX_LOG_ALERT, c->log, 0,
                           "file buf in sendmsg "
                           "t:%d r:%d f:%d %p %p-%p %p %O-%O",
@@ -82,13 +172,55 @@ ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             return NGX_CHAIN_ERROR;
         }
 
-        if (cl == in) {
+        if (nvecs == 0) {
             return in;
         }
 
         send += vec.size;
 
-        n = ngx_sendmsg(c, &vec);
+#if (NGX_HAVE_UDP_SEGMENT)
+
+        if (nvecs == 1
+            || segment >= ngx_udp_gso_limit
+            || vec.size > NGX_UDP_GSO_MAX)
+        {
+            segment = 0;
+        }
+
+#else
+
+        segment = 0;
+
+#endif
+
+        if (segment) {
+            vec.iovs = iovs;
+            vec.count = niovs;
+
+            n = ngx_sendmsg(c, &vec, segment);
+
+            if (n == NGX_DECLINED) {
+                segment = 0;
+            }
+        }
+
+        if (segment == 0) {
+
+#if (NGX_HAVE_SENDMMSG)
+
+            if (nvecs > 1) {
+                n = ngx_sendmmsg(c, vecs, nvecs);
+
+            } else {
+                n = ngx_sendmsg(c, &vecs[0], 0);
+            }
+
+#else
+
+            n = ngx_sendmsg(c, &vecs[0], 0);
+
+#endif
+        }
 
         if (n == NGX_ERROR) {
             return NGX_CHAIN_ERROR;
@@ -197,51 +329,182 @@ ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in, ngx_log_t *log)
 
 
 static ssize_t
-ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
+ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec, size_t segment)
 {
-    ssize_t        n;
-    ngx_err_t      err;
-    struct msghdr  msg;
+    ssize_t            n;
+    ngx_err_t          err;
+    struct msghdr      msg;
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_udp_control_t  control;
+#else
+    void              *control = NULL;
+#endif
+
+    ngx_sendmsg_init(c, &msg, &control, segment);
+
+    msg.msg_iov = vec->iovs;
+    msg.msg_iovlen = vec->count;
+
+eintr:
+
+    n = sendmsg(c->fd, &msg, 0);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmsg: %z of %uz, segment:%uz", n, vec->size, segment);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmsg() was interrupted");
+            goto eintr;
+
+        default:
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+            /*
+             * segmentation offload is rejected with EIO if a device
+             * cannot calculate checksums, and with EINVAL or EMSGSIZE
+             * if a segment does not fit into the path MTU
+             */
+
+            if (segment && (err == NGX_EIO || err == NGX_EINVAL
+                            || err == NGX_EMSGSIZE))
+            {
+                ngx_log_error(NGX_LOG_INFO, c->log, err,
+                              "sendmsg() with segment size %uz failed",
+                              segment);
+
+                ngx_udp_gso_limit = (err == NGX_EIO) ? 0 : segment;
+
+                return NGX_DECLINED;
+            }
 
-#if (NGX_HAVE_IP_SENDSRCADDR)
-    u_char             msg_control[CMSG_SPACE(sizeof(struct in_addr))];
-#elif (NGX_HAVE_IP_PKTINFO)
-    u_char             msg_control[CMSG_SPACE(sizeof(struct in_pktinfo))];
 #endif
 
-#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
-    u_char             msg_control6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmsg() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return n;
+}
+
+
+#if (NGX_HAVE_SENDMMSG)
+
+static ssize_t
+ngx_sendmmsg(ngx_connection_t *c, ngx_iovec_t *vecs, ngx_uint_t nvecs)
+{
+    int                n;
+    size_t             size;
+    ngx_err_t          err;
+    ngx_uint_t         i;
+    struct mmsghdr     msgs[NGX_UDP_SEND_BATCH];
+
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_udp_control_t  control;
+#else
+    void              *control = NULL;
+#endif
+
+    /* all datagrams share the addresses and the control data */
+
+    ngx_sendmsg_init(c, &msgs[0].msg_hdr, &control, 0);
+
+    for (i = 0; i < nvecs; i++) {
+        msgs[i].msg_hdr = msgs[0].msg_hdr;
+        msgs[i].msg_hdr.msg_iov = vecs[i].iovs;
+        msgs[i].msg_hdr.msg_iovlen = vecs[i].count;
+        msgs[i].msg_len = 0;
+    }
+
+eintr:
+
+    n = sendmmsg(c->fd, msgs, nvecs, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendmmsg: %d of %ui", n, nvecs);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        switch (err) {
+        case NGX_EAGAIN:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmmsg() not ready");
+            return NGX_AGAIN;
+
+        case NGX_EINTR:
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendmmsg() was interrupted");
+            goto eintr;
+
+        default:
+            c->write->error = 1;
+            ngx_connection_error(c, err, "sendmmsg() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    /* the rest of datagrams will be sent on the next iteration */
+
+    size = 0;
+
+    for (i = 0; i < (ngx_uint_t) n; i++) {
+        size += vecs[i].size;
+    }
+
+    return size;
+}
+
 #endif
 
+
+static void
+ngx_sendmsg_init(ngx_connection_t *c, struct msghdr *msg, void *control,
+    size_t segment)
+{
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    struct cmsghdr  *cmsg;
+    size_t           len;
 #endif
 
-    ngx_memzero(&msg, sizeof(struct msghdr));
+    ngx_memzero(msg, sizeof(struct msghdr));
 
     if (c->socklen) {
-        msg.msg_name = c->sockaddr;
-        msg.msg_namelen = c->socklen;
+        msg->msg_name = c->sockaddr;
+        msg->msg_namelen = c->socklen;
     }
 
-    msg.msg_iov = vec->iovs;
-    msg.msg_iovlen = vec->count;
-
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
 
+    msg->msg_control = control;
+    msg->msg_controllen = sizeof(ngx_udp_control_t);
+
+    ngx_memzero(control, sizeof(ngx_udp_control_t));
+
+    cmsg = CMSG_FIRSTHDR(msg);
+    len = 0;
+
     if (c->listening && c->listening->wildcard && c->local_sockaddr) {
 
 #if (NGX_HAVE_IP_SENDSRCADDR)
 
         if (c->local_sockaddr->sa_family == AF_INET) {
-            struct cmsghdr      *cmsg;
             struct in_addr      *addr;
             struct sockaddr_in  *sin;
 
-            msg.msg_control = &msg_control;
-            msg.msg_controllen = sizeof(msg_control);
-
-            cmsg = CMSG_FIRSTHDR(&msg);
             cmsg->cmsg_level = IPPROTO_IP;
             cmsg->cmsg_type = IP_SENDSRCADDR;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
@@ -250,19 +513,17 @@ ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
 
             addr = (struct in_addr *) CMSG_DATA(cmsg);
             *addr = sin->sin_addr;
+
+            len += CMSG_SPACE(sizeof(struct in_addr));
+            cmsg = CMSG_NXTHDR(msg, cmsg);
         }
 
 #elif (NGX_HAVE_IP_PKTINFO)
 
         if (c->local_sockaddr->sa_family == AF_INET) {
-            struct cmsghdr      *cmsg;
             struct in_pktinfo   *pkt;
             struct sockaddr_in  *sin;
 
-            msg.msg_control = &msg_control;
-            msg.msg_controllen = sizeof(msg_control);
-
-            cmsg = CMSG_FIRSTHDR(&msg);
             cmsg->cmsg_level = IPPROTO_IP;
             cmsg->cmsg_type = IP_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
@@ -272,6 +533,9 @@ ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
             pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
             ngx_memzero(pkt, sizeof(struct in_pktinfo));
             pkt->ipi_spec_dst = sin->sin_addr;
+
+            len += CMSG_SPACE(sizeof(struct in_pktinfo));
+            cmsg = CMSG_NXTHDR(msg, cmsg);
         }
 
 #endif
@@ -279,14 +543,9 @@ ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
 #if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
 
         if (c->local_sockaddr->sa_family == AF_INET6) {
-            struct cmsghdr       *cmsg;
             struct in6_pktinfo   *pkt6;
             struct sockaddr_in6  *sin6;
 
-            msg.msg_control = &msg_control6;
-            msg.msg_controllen = sizeof(msg_control6);
-
-            cmsg = CMSG_FIRSTHDR(&msg);
             cmsg->cmsg_level = IPPROTO_IPV6;
             cmsg->cmsg_type = IPV6_PKTINFO;
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
@@ -296,40 +555,35 @@ ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
             pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
             ngx_memzero(pkt6, sizeof(struct in6_pktinfo));
             pkt6->ipi6_addr = sin6->sin6_addr;
+
+            len += CMSG_SPACE(sizeof(struct in6_pktinfo));
+            cmsg = CMSG_NXTHDR(msg, cmsg);
         }
 
 #endif
     }
 
-#endif
+#if (NGX_HAVE_UDP_SEGMENT)
 
-eintr:
+    if (segment) {
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
 
-    n = sendmsg(c->fd, &msg, 0);
+        *(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) segment;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "sendmsg: %z of %uz", n, vec->size);
+        len += CMSG_SPACE(sizeof(uint16_t));
+    }
 
-    if (n == -1) {
-        err = ngx_errno;
+#endif
 
-        switch (err) {
-        case NGX_EAGAIN:
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
-                           "sendmsg() not ready");
-            return NGX_AGAIN;
+    if (len) {
+        msg->msg_controllen = len;
 
-        case NGX_EINTR:
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
-                           "sendmsg() was interrupted");
-            goto eintr;
-
-        default:
-            c->write->error = 1;
-            ngx_connection_error(c, err, "sendmsg() failed");
-            return NGX_ERROR;
-        }
+    } else {
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
     }
 
-    return n;
+#endif
 }
@@ -18,6 +18,7 @@ void *ngx_calloc(size_t size, ngx_log_t *log);
 
 #define ngx_free          free
 #define ngx_memalign(alignment, size, log)  ngx_alloc(size, log)
+#define ngx_alloc_huge(size, huge_pages, log)  ngx_alloc(size, log)
 
 extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
@@ -20,6 +20,7 @@ typedef struct {
     HANDLE       handle;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+    ngx_uint_t   huge_pages;
 } ngx_shm_t;
 
 
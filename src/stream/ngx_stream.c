@@ -496,6 +496,7 @@ ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports)
             ls->backlog = addr[i].opt.backlog;
             ls->rcvbuf = addr[i].opt.rcvbuf;
             ls->sndbuf = addr[i].opt.sndbuf;
+            ls->max_sessions = addr[i].opt.max_sessions;
 
             ls->wildcard = addr[i].opt.wildcard;
 
@@ -514,6 +515,10 @@ ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports)
             ls->reuseport = addr[i].opt.reuseport;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+            ls->incoming_cpu = addr[i].opt.incoming_cpu;
+#endif
+
             stport = ngx_palloc(cf->pool, sizeof(ngx_stream_port_t));
             if (stport == NULL) {
                 return NGX_CONF_ERROR;
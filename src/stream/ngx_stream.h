@@ -54,6 +54,7 @@ typedef struct {
     unsigned                       ipv6only:1;
 #endif
     unsigned                       reuseport:1;
+    unsigned                       incoming_cpu:1;
     unsigned                       so_keepalive:2;
     unsigned                       proxy_protocol:1;
 #if (NGX_HAVE_KEEPALIVE_TUNABLE)
@@ -65,6 +66,7 @@ typedef struct {
     int                            rcvbuf;
     int                            sndbuf;
     int                            type;
+    ngx_uint_t                     max_sessions;
 } ngx_stream_listen_t;
 
 
@@ -220,6 +222,9 @@ struct ngx_stream_session_s {
     ngx_int_t                      phase_handler;
     ngx_uint_t                     status;
 
+    /* PROXY protocol header skipped by preread parsers */
+    size_t                         preread_offset;
+
     unsigned                       ssl:1;
 
     unsigned                       stat_processing:1;
@@ -274,7 +279,8 @@ typedef struct {
         NULL)
 
 
-#define NGX_STREAM_WRITE_BUFFERED  0x10
+#define NGX_STREAM_WRITE_BUFFERED   0x10
+#define NGX_STREAM_SPLICE_BUFFERED  0x20
 
 
 void ngx_stream_core_run_phases(ngx_stream_session_t *s);
@@ -303,4 +309,10 @@ typedef ngx_int_t (*ngx_stream_filter_pt)(ngx_stream_session_t *s,
 extern ngx_stream_filter_pt  ngx_stream_top_filter;
 
 
+#if (NGX_STREAM_LIMIT_RATE)
+ngx_msec_t ngx_stream_limit_rate_bytes(ngx_stream_session_t *s, size_t size);
+ngx_int_t ngx_stream_limit_rate_datagram(ngx_stream_session_t *s);
+#endif
+
+
 #endif /* _NGX_STREAM_H_INCLUDED_ */
@@ -1271,6 +1271,8 @@ ngx_stream_geo_include(ngx_conf_t *cf, ngx_stream_geo_conf_ctx_t *ctx,
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&file);
+
     if (ctx->ranges) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
 
@@ -644,6 +644,8 @@ ngx_stream_geoip_country(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->country, GEOIP_CHARSET_UTF8);
@@ -699,6 +701,8 @@ ngx_stream_geoip_org(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->org, GEOIP_CHARSET_UTF8);
@@ -760,6 +764,8 @@ ngx_stream_geoip_city(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_conf_digest_file(&value[1]);
+
     if (cf->args->nelts == 3) {
         if (ngx_strcmp(value[2].data, "utf8") == 0) {
             GeoIP_set_charset(gcf->city, GEOIP_CHARSET_UTF8);
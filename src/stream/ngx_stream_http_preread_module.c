@@ -0,0 +1,376 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_flag_t      enabled;
+} ngx_stream_http_preread_srv_conf_t;
+
+
+typedef struct {
+    u_char         *pos;
+    ngx_uint_t      lines;
+    ngx_str_t       host;
+} ngx_stream_http_preread_ctx_t;
+
+
+static ngx_int_t ngx_stream_http_preread_handler(ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_http_preread_request_line(ngx_stream_session_t *s,
+    ngx_stream_http_preread_ctx_t *ctx, u_char *p, u_char *last);
+static ngx_int_t ngx_stream_http_preread_set_host(ngx_stream_session_t *s,
+    ngx_stream_http_preread_ctx_t *ctx, u_char *p, u_char *last);
+static ngx_int_t ngx_stream_http_preread_host_variable(
+    ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_http_preread_add_variables(ngx_conf_t *cf);
+static void *ngx_stream_http_preread_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_stream_http_preread_merge_srv_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static ngx_int_t ngx_stream_http_preread_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_stream_http_preread_commands[] = {
+
+    { ngx_string("http_preread"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_http_preread_srv_conf_t, enabled),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_http_preread_module_ctx = {
+    ngx_stream_http_preread_add_variables,  /* preconfiguration */
+    ngx_stream_http_preread_init,           /* postconfiguration */
+
+    NULL,                                   /* create main configuration */
+    NULL,                                   /* init main configuration */
+
+    ngx_stream_http_preread_create_srv_conf, /* create server configuration */
+    ngx_stream_http_preread_merge_srv_conf  /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_http_preread_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_http_preread_module_ctx,    /* module context */
+    ngx_stream_http_preread_commands,       /* module directives */
+    NGX_STREAM_MODULE,                      /* module type */
+    NULL,                                   /* init master */
+    NULL,                                   /* init module */
+    NULL,                                   /* init process */
+    NULL,                                   /* init thread */
+    NULL,                                   /* exit thread */
+    NULL,                                   /* exit process */
+    NULL,                                   /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_stream_variable_t  ngx_stream_http_preread_vars[] = {
+
+    { ngx_string("http_preread_host"), NULL,
+      ngx_stream_http_preread_host_variable, 0, 0, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_int_t
+ngx_stream_http_preread_handler(ngx_stream_session_t *s)
+{
+    u_char                              *p, *q, *last;
+    ngx_int_t                            rc;
+    ngx_connection_t                    *c;
+    ngx_stream_http_preread_ctx_t       *ctx;
+    ngx_stream_http_preread_srv_conf_t  *hpcf;
+
+    c = s->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0, "http preread handler");
+
+    hpcf = ngx_stream_get_module_srv_conf(s, ngx_stream_http_preread_module);
+
+    if (!hpcf->enabled) {
+        return NGX_DECLINED;
+    }
+
+    if (c->type != SOCK_STREAM) {
+        return NGX_DECLINED;
+    }
+
+    if (c->buffer == NULL) {
+        return NGX_AGAIN;
+    }
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_http_preread_module);
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(c->pool, sizeof(ngx_stream_http_preread_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_stream_set_ctx(s, ctx, ngx_stream_http_preread_module);
+
+        ctx->pos = c->buffer->pos + s->preread_offset;
+    }
+
+    p = ctx->pos;
+    last = c->buffer->last;
+
+    if (ctx->lines == 0) {
+
+        /*
+         * give up early on anything that does not start with a method,
+         * e.g. a TLS handshake, instead of waiting for a line feed
+         */
+
+        for (q = p; q < last && *q != ' '; q++) {
+            if (*q < 'A' || *q > 'Z' || q - p == 32) {
+                ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                               "http preread: not an HTTP request");
+                return NGX_DECLINED;
+            }
+        }
+
+        if (q == p && q < last) {
+            return NGX_DECLINED;
+        }
+    }
+
+    for ( ;; ) {
+        q = ngx_strlchr(p, last, LF);
+
+        if (q == NULL) {
+            ctx->pos = p;
+            return NGX_AGAIN;
+        }
+
+        last = (q > p && q[-1] == CR) ? q - 1 : q;
+
+        if (ctx->lines++ == 0) {
+            rc = ngx_stream_http_preread_request_line(s, ctx, p, last);
+
+            if (rc != NGX_AGAIN) {
+                return rc;
+            }
+
+        } else {
+
+            if (p == last) {
+                ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                               "http preread: no host");
+                return NGX_OK;
+            }
+
+            if (last - p >= 5 && ngx_strncasecmp(p, (u_char *) "host:", 5) == 0)
+            {
+                return ngx_stream_http_preread_set_host(s, ctx, p + 5, last);
+            }
+        }
+
+        p = q + 1;
+        last = c->buffer->last;
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_http_preread_request_line(ngx_stream_session_t *s,
+    ngx_stream_http_preread_ctx_t *ctx, u_char *p, u_char *last)
+{
+    u_char  *uri, *host;
+
+    uri = ngx_strlchr(p, last, ' ');
+
+    if (uri == NULL) {
+        return NGX_DECLINED;
+    }
+
+    uri++;
+
+    if (last - uri > 7 && ngx_strncasecmp(uri, (u_char *) "http", 4) == 0) {
+
+        /* absolute URI takes precedence over the "Host" header */
+
+        host = uri + 4;
+
+        if (*host == 's' || *host == 'S') {
+            host++;
+        }
+
+        if (last - host > 3 && ngx_strncmp(host, "://", 3) == 0) {
+            host += 3;
+
+            for (p = host; p < last; p++) {
+                if (*p == '/' || *p == '?' || *p == ' ') {
+                    break;
+                }
+            }
+
+            return ngx_stream_http_preread_set_host(s, ctx, host, p);
+        }
+    }
+
+    if (ngx_strlchr(uri, last, ' ') == NULL) {
+
+        /* HTTP/0.9 */
+
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_stream_http_preread_set_host(ngx_stream_session_t *s,
+    ngx_stream_http_preread_ctx_t *ctx, u_char *p, u_char *last)
+{
+    u_char  *end;
+
+    while (p < last && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+
+    while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+        last--;
+    }
+
+    /* strip port */
+
+    if (p < last && *p == '[') {
+        end = ngx_strlchr(p, last, ']');
+
+        if (end) {
+            last = end + 1;
+        }
+
+    } else {
+        end = ngx_strlchr(p, last, ':');
+
+        if (end) {
+            last = end;
+        }
+    }
+
+    if (last > p && last[-1] == '.') {
+        last--;
+    }
+
+    if (p == last) {
+        return NGX_OK;
+    }
+
+    ctx->host.len = last - p;
+    ctx->host.data = ngx_pnalloc(s->connection->pool, ctx->host.len);
+    if (ctx->host.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_strlow(ctx->host.data, p, ctx->host.len);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "http preread: host \"%V\"", &ctx->host);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_http_preread_host_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    ngx_stream_http_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s, ngx_stream_http_preread_module);
+
+    if (ctx == NULL || ctx->host.len == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = ctx->host.len;
+    v->data = ctx->host.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_http_preread_add_variables(ngx_conf_t *cf)
+{
+    ngx_stream_variable_t  *var, *v;
+
+    for (v = ngx_stream_http_preread_vars; v->name.len; v++) {
+        var = ngx_stream_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_http_preread_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_stream_http_preread_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_http_preread_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->enabled = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_http_preread_merge_srv_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_stream_http_preread_srv_conf_t *prev = parent;
+    ngx_stream_http_preread_srv_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->enabled, prev->enabled, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_http_preread_init(ngx_conf_t *cf)
+{
+    ngx_stream_handler_pt        *h;
+    ngx_stream_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_PREREAD_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_http_preread_handler;
+
+    return NGX_OK;
+}
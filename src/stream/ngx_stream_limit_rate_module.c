@@ -0,0 +1,985 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+/*
+ * each key has three token buckets sharing the time of the last update:
+ * new connections, datagrams from clients, and bytes proxied in both
+ * directions; a bucket holds up to a second worth of its rate, excess
+ * values are kept in thousandths of the rate units, so a bucket drains
+ * by "rate" per millisecond
+ */
+
+
+typedef struct {
+    u_char                          color;
+    u_char                          dummy;
+    u_short                         len;
+    ngx_queue_t                     queue;
+    ngx_msec_t                      last;
+    /* 1 corresponds to 0.000001 of a connection */
+    uint64_t                        conn_excess;
+    /* 1 corresponds to 0.000001 of a datagram */
+    uint64_t                        dgram_excess;
+    /* 1 corresponds to 0.001 of a byte */
+    uint64_t                        bytes_excess;
+    ngx_uint_t                      count;
+    u_char                          data[1];
+} ngx_stream_limit_rate_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+} ngx_stream_limit_rate_shctx_t;
+
+
+typedef struct {
+    ngx_stream_limit_rate_shctx_t  *sh;
+    ngx_slab_pool_t                *shpool;
+    /* integer values, 1 corresponds to 0.001 r/s */
+    ngx_uint_t                      conn_rate;
+    ngx_uint_t                      dgram_rate;
+    /* bytes per second */
+    size_t                          bytes_rate;
+    ngx_stream_complex_value_t      key;
+} ngx_stream_limit_rate_ctx_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_stream_limit_rate_node_t   *node;
+} ngx_stream_limit_rate_entry_t;
+
+
+typedef struct {
+    ngx_array_t                     limits;
+    ngx_uint_t                      log_level;
+} ngx_stream_limit_rate_conf_t;
+
+
+static void ngx_stream_limit_rate_drain(ngx_stream_limit_rate_ctx_t *ctx,
+    ngx_stream_limit_rate_node_t *lr);
+static ngx_stream_limit_rate_node_t *ngx_stream_limit_rate_lookup(
+    ngx_stream_limit_rate_ctx_t *ctx, ngx_str_t *key, uint32_t hash);
+static void ngx_stream_limit_rate_expire(ngx_stream_limit_rate_ctx_t *ctx,
+    ngx_uint_t n);
+static void ngx_stream_limit_rate_cleanup(void *data);
+
+static void *ngx_stream_limit_rate_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_limit_rate_merge_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_stream_limit_rate_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_stream_limit_rate(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_stream_limit_rate_init(ngx_conf_t *cf);
+
+
+static ngx_conf_enum_t  ngx_stream_limit_rate_log_levels[] = {
+    { ngx_string("info"), NGX_LOG_INFO },
+    { ngx_string("notice"), NGX_LOG_NOTICE },
+    { ngx_string("warn"), NGX_LOG_WARN },
+    { ngx_string("error"), NGX_LOG_ERR },
+    { ngx_null_string, 0 }
+};
+
+
+static ngx_command_t  ngx_stream_limit_rate_commands[] = {
+
+    { ngx_string("limit_rate_zone"),
+      NGX_STREAM_MAIN_CONF|NGX_CONF_2MORE,
+      ngx_stream_limit_rate_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("limit_rate"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_stream_limit_rate,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("limit_rate_log_level"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_limit_rate_conf_t, log_level),
+      &ngx_stream_limit_rate_log_levels },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_limit_rate_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_stream_limit_rate_init,            /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_stream_limit_rate_create_conf,     /* create server configuration */
+    ngx_stream_limit_rate_merge_conf       /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_limit_rate_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_limit_rate_module_ctx,     /* module context */
+    ngx_stream_limit_rate_commands,        /* module directives */
+    NGX_STREAM_MODULE,                     /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_stream_limit_rate_handler(ngx_stream_session_t *s)
+{
+    size_t                          n;
+    uint32_t                        hash;
+    uint64_t                        conn, dgram;
+    ngx_str_t                       key;
+    ngx_uint_t                      i;
+    ngx_array_t                    *entries;
+    ngx_connection_t               *c;
+    ngx_pool_cleanup_t             *cln;
+    ngx_rbtree_node_t              *node;
+    ngx_stream_limit_rate_ctx_t    *ctx;
+    ngx_stream_limit_rate_node_t   *lr;
+    ngx_stream_limit_rate_conf_t   *lrcf;
+    ngx_stream_limit_rate_entry_t  *limits, *entry;
+
+    c = s->connection;
+
+    lrcf = ngx_stream_get_module_srv_conf(s, ngx_stream_limit_rate_module);
+
+    if (lrcf->limits.nelts == 0) {
+        return NGX_DECLINED;
+    }
+
+    entries = ngx_stream_get_module_ctx(s, ngx_stream_limit_rate_module);
+
+    if (entries) {
+        return NGX_DECLINED;
+    }
+
+    entries = ngx_array_create(c->pool, lrcf->limits.nelts,
+                               sizeof(ngx_stream_limit_rate_entry_t));
+    if (entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_stream_limit_rate_cleanup;
+    cln->data = entries;
+
+    ngx_stream_set_ctx(s, entries, ngx_stream_limit_rate_module);
+
+    limits = lrcf->limits.elts;
+
+    for (i = 0; i < lrcf->limits.nelts; i++) {
+        ctx = limits[i].shm_zone->data;
+
+        if (ngx_stream_complex_value(s, &ctx->key, &key) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (key.len == 0) {
+            continue;
+        }
+
+        if (key.len > 65535) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "the value of the \"%V\" key "
+                          "is more than 65535 bytes: \"%V\"",
+                          &ctx->key.value, &key);
+            continue;
+        }
+
+        hash = ngx_crc32_short(key.data, key.len);
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+
+        ngx_stream_limit_rate_expire(ctx, 1);
+
+        lr = ngx_stream_limit_rate_lookup(ctx, &key, hash);
+
+        if (lr == NULL) {
+
+            n = offsetof(ngx_rbtree_node_t, color)
+                + offsetof(ngx_stream_limit_rate_node_t, data)
+                + key.len;
+
+            node = ngx_slab_alloc_locked(ctx->shpool, n);
+
+            if (node == NULL) {
+                ngx_stream_limit_rate_expire(ctx, 0);
+
+                node = ngx_slab_alloc_locked(ctx->shpool, n);
+                if (node == NULL) {
+                    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+                    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                                  "could not allocate node%s",
+                                  ctx->shpool->log_ctx);
+
+                    return NGX_STREAM_SERVICE_UNAVAILABLE;
+                }
+            }
+
+            node->key = hash;
+
+            lr = (ngx_stream_limit_rate_node_t *) &node->color;
+
+            lr->len = (u_short) key.len;
+            lr->last = ngx_current_msec;
+            lr->conn_excess = 0;
+            lr->dgram_excess = 0;
+            lr->bytes_excess = 0;
+            lr->count = 0;
+
+            ngx_memcpy(lr->data, key.data, key.len);
+
+            ngx_rbtree_insert(&ctx->sh->rbtree, node);
+
+        } else {
+            ngx_stream_limit_rate_drain(ctx, lr);
+
+            ngx_queue_remove(&lr->queue);
+        }
+
+        ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+
+        conn = lr->conn_excess;
+        dgram = lr->dgram_excess;
+
+        if (ctx->conn_rate) {
+            conn += 1000000;
+
+            if (conn > ngx_max((uint64_t) ctx->conn_rate * 1000, 1000000)) {
+                ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+                ngx_log_error(lrcf->log_level, c->log, 0,
+                              "limiting connections by zone \"%V\"",
+                              &limits[i].shm_zone->shm.name);
+
+                return NGX_STREAM_SERVICE_UNAVAILABLE;
+            }
+        }
+
+        /* the first datagram of a session */
+
+        if (ctx->dgram_rate && c->type == SOCK_DGRAM) {
+            dgram += 1000000;
+
+            if (dgram > ngx_max((uint64_t) ctx->dgram_rate * 1000, 1000000))
+            {
+                ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+                ngx_log_error(lrcf->log_level, c->log, 0,
+                              "limiting datagrams by zone \"%V\"",
+                              &limits[i].shm_zone->shm.name);
+
+                return NGX_STREAM_SERVICE_UNAVAILABLE;
+            }
+        }
+
+        lr->conn_excess = conn;
+        lr->dgram_excess = dgram;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "limit rate: %08Xi %uL %uL %uL",
+                       hash, conn, dgram, lr->bytes_excess);
+
+        if (ctx->bytes_rate || (ctx->dgram_rate && c->type == SOCK_DGRAM)) {
+
+            /* the node is used while the session is active */
+
+            entry = ngx_array_push(entries);
+            if (entry == NULL) {
+                ngx_shmtx_unlock(&ctx->shpool->mutex);
+                return NGX_ERROR;
+            }
+
+            entry->shm_zone = limits[i].shm_zone;
+            entry->node = lr;
+
+            lr->count++;
+        }
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
+    return NGX_DECLINED;
+}
+
+
+ngx_msec_t
+ngx_stream_limit_rate_bytes(ngx_stream_session_t *s, size_t size)
+{
+    uint64_t                        excess, max;
+    ngx_msec_t                      delay, d;
+    ngx_uint_t                      i;
+    ngx_array_t                    *entries;
+    ngx_stream_limit_rate_ctx_t    *ctx;
+    ngx_stream_limit_rate_node_t   *lr;
+    ngx_stream_limit_rate_entry_t  *entry;
+
+    entries = ngx_stream_get_module_ctx(s, ngx_stream_limit_rate_module);
+
+    if (entries == NULL) {
+        return 0;
+    }
+
+    delay = 0;
+    entry = entries->elts;
+
+    for (i = 0; i < entries->nelts; i++) {
+        ctx = entry[i].shm_zone->data;
+
+        if (ctx->bytes_rate == 0) {
+            continue;
+        }
+
+        lr = entry[i].node;
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+
+        ngx_stream_limit_rate_drain(ctx, lr);
+
+        lr->bytes_excess += (uint64_t) size * 1000;
+        excess = lr->bytes_excess;
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+        max = (uint64_t) ctx->bytes_rate * 1000;
+
+        if (excess > max) {
+            d = (ngx_msec_t) ((excess - max) / ctx->bytes_rate + 1);
+            delay = ngx_max(delay, d);
+        }
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "limit rate bytes: %uz, delay: %M", size, delay);
+
+    return delay;
+}
+
+
+ngx_int_t
+ngx_stream_limit_rate_datagram(ngx_stream_session_t *s)
+{
+    uint64_t                        dgram;
+    ngx_uint_t                      i;
+    ngx_array_t                    *entries;
+    ngx_stream_limit_rate_ctx_t    *ctx;
+    ngx_stream_limit_rate_node_t   *lr;
+    ngx_stream_limit_rate_conf_t   *lrcf;
+    ngx_stream_limit_rate_entry_t  *entry;
+
+    entries = ngx_stream_get_module_ctx(s, ngx_stream_limit_rate_module);
+
+    if (entries == NULL) {
+        return NGX_OK;
+    }
+
+    entry = entries->elts;
+
+    for (i = 0; i < entries->nelts; i++) {
+        ctx = entry[i].shm_zone->data;
+
+        if (ctx->dgram_rate == 0) {
+            continue;
+        }
+
+        lr = entry[i].node;
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+
+        ngx_stream_limit_rate_drain(ctx, lr);
+
+        dgram = lr->dgram_excess + 1000000;
+
+        if (dgram > ngx_max((uint64_t) ctx->dgram_rate * 1000, 1000000)) {
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+            lrcf = ngx_stream_get_module_srv_conf(s,
+                                               ngx_stream_limit_rate_module);
+
+            ngx_log_error(lrcf->log_level, s->connection->log, 0,
+                          "limiting datagrams by zone \"%V\"",
+                          &entry[i].shm_zone->shm.name);
+
+            return NGX_DECLINED;
+        }
+
+        lr->dgram_excess = dgram;
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_limit_rate_drain(ngx_stream_limit_rate_ctx_t *ctx,
+    ngx_stream_limit_rate_node_t *lr)
+{
+    uint64_t        drain;
+    ngx_msec_t      now;
+    ngx_msec_int_t  ms;
+
+    now = ngx_current_msec;
+
+    ms = (ngx_msec_int_t) (now - lr->last);
+    ms = ngx_abs(ms);
+
+    if (ms == 0) {
+        return;
+    }
+
+    /* buckets hold no more than a second worth of their rates */
+
+    ms = ngx_min(ms, 60000);
+
+    drain = (uint64_t) ctx->conn_rate * ms;
+    lr->conn_excess = (lr->conn_excess > drain) ? lr->conn_excess - drain : 0;
+
+    drain = (uint64_t) ctx->dgram_rate * ms;
+    lr->dgram_excess = (lr->dgram_excess > drain)
+                       ? lr->dgram_excess - drain : 0;
+
+    drain = (uint64_t) ctx->bytes_rate * ms;
+    lr->bytes_excess = (lr->bytes_excess > drain)
+                       ? lr->bytes_excess - drain : 0;
+
+    lr->last = now;
+}
+
+
+static void
+ngx_stream_limit_rate_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t             **p;
+    ngx_stream_limit_rate_node_t   *lrn, *lrnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            lrn = (ngx_stream_limit_rate_node_t *) &node->color;
+            lrnt = (ngx_stream_limit_rate_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(lrn->data, lrnt->data, lrn->len, lrnt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_stream_limit_rate_node_t *
+ngx_stream_limit_rate_lookup(ngx_stream_limit_rate_ctx_t *ctx, ngx_str_t *key,
+    uint32_t hash)
+{
+    ngx_int_t                      rc;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_stream_limit_rate_node_t  *lr;
+
+    node = ctx->sh->rbtree.root;
+    sentinel = ctx->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        lr = (ngx_stream_limit_rate_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, lr->data, key->len, (size_t) lr->len);
+
+        if (rc == 0) {
+            return lr;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_stream_limit_rate_expire(ngx_stream_limit_rate_ctx_t *ctx, ngx_uint_t n)
+{
+    ngx_msec_t                     now;
+    ngx_queue_t                   *q;
+    ngx_msec_int_t                 ms;
+    ngx_rbtree_node_t             *node;
+    ngx_stream_limit_rate_node_t  *lr;
+
+    now = ngx_current_msec;
+
+    /*
+     * n == 1 deletes one or two entries not used for a minute
+     * n == 0 deletes oldest entry by force
+     *        and one or two entries not used for a minute
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&ctx->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&ctx->sh->queue);
+
+        lr = ngx_queue_data(q, ngx_stream_limit_rate_node_t, queue);
+
+        if (lr->count) {
+
+            /*
+             * the entry is used by long-lived sessions,
+             * move it out of the way
+             */
+
+            ngx_queue_remove(q);
+            ngx_queue_insert_head(&ctx->sh->queue, q);
+
+            n++;
+            continue;
+        }
+
+        if (n++ != 0) {
+
+            ms = (ngx_msec_int_t) (now - lr->last);
+            ms = ngx_abs(ms);
+
+            if (ms < 60000) {
+                return;
+            }
+        }
+
+        ngx_queue_remove(q);
+
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+
+        ngx_slab_free_locked(ctx->shpool, node);
+    }
+}
+
+
+static void
+ngx_stream_limit_rate_cleanup(void *data)
+{
+    ngx_array_t  *entries = data;
+
+    ngx_uint_t                      i;
+    ngx_stream_limit_rate_ctx_t    *ctx;
+    ngx_stream_limit_rate_entry_t  *entry;
+
+    entry = entries->elts;
+
+    for (i = 0; i < entries->nelts; i++) {
+        ctx = entry[i].shm_zone->data;
+
+        ngx_shmtx_lock(&ctx->shpool->mutex);
+
+        entry[i].node->count--;
+
+        ngx_shmtx_unlock(&ctx->shpool->mutex);
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_limit_rate_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_stream_limit_rate_ctx_t  *octx = data;
+
+    size_t                        len;
+    ngx_stream_limit_rate_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (octx) {
+        if (ctx->key.value.len != octx->key.value.len
+            || ngx_strncmp(ctx->key.value.data, octx->key.value.data,
+                           ctx->key.value.len)
+               != 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_rate_zone \"%V\" uses the \"%V\" key "
+                          "while previously it used the \"%V\" key",
+                          &shm_zone->shm.name, &ctx->key.value,
+                          &octx->key.value);
+            return NGX_ERROR;
+        }
+
+        ctx->sh = octx->sh;
+        ctx->shpool = octx->shpool;
+
+        return NGX_OK;
+    }
+
+    ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ctx->sh = ctx->shpool->data;
+
+        return NGX_OK;
+    }
+
+    ctx->sh = ngx_slab_alloc(ctx->shpool,
+                             sizeof(ngx_stream_limit_rate_shctx_t));
+    if (ctx->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->shpool->data = ctx->sh;
+
+    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel,
+                    ngx_stream_limit_rate_rbtree_insert_value);
+
+    ngx_queue_init(&ctx->sh->queue);
+
+    len = sizeof(" in limit_rate_zone \"\"") + shm_zone->shm.name.len;
+
+    ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
+    if (ctx->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ctx->shpool->log_ctx, " in limit_rate_zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ctx->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_limit_rate_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_limit_rate_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_limit_rate_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->limits.elts = NULL;
+     */
+
+    conf->log_level = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_limit_rate_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_stream_limit_rate_conf_t *prev = parent;
+    ngx_stream_limit_rate_conf_t *conf = child;
+
+    if (conf->limits.elts == NULL) {
+        conf->limits = prev->limits;
+    }
+
+    ngx_conf_merge_uint_value(conf->log_level, prev->log_level, NGX_LOG_ERR);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_limit_rate_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                              *p;
+    size_t                               len;
+    ssize_t                              size, bytes;
+    ngx_str_t                           *value, name, s;
+    ngx_int_t                            rate, scale;
+    ngx_uint_t                           i, *rp;
+    ngx_shm_zone_t                      *shm_zone;
+    ngx_stream_limit_rate_ctx_t         *ctx;
+    ngx_stream_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    ctx = ngx_pcalloc(cf->pool, sizeof(ngx_stream_limit_rate_ctx_t));
+    if (ctx == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&ccv, sizeof(ngx_stream_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &ctx->key;
+
+    if (ngx_stream_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    size = 0;
+    name.len = 0;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "connections=", 12) == 0) {
+            rp = &ctx->conn_rate;
+            len = 12;
+
+        } else if (ngx_strncmp(value[i].data, "datagrams=", 10) == 0) {
+            rp = &ctx->dgram_rate;
+            len = 10;
+
+        } else if (ngx_strncmp(value[i].data, "bytes=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            bytes = ngx_parse_size(&s);
+            if (bytes <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid rate \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ctx->bytes_rate = bytes;
+
+            continue;
+
+        } else {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        scale = 1;
+        s.len = value[i].len;
+
+        p = value[i].data + s.len - 3;
+
+        if (s.len > len + 3 && ngx_strncmp(p, "r/s", 3) == 0) {
+            s.len -= 3;
+
+        } else if (s.len > len + 3 && ngx_strncmp(p, "r/m", 3) == 0) {
+            scale = 60;
+            s.len -= 3;
+        }
+
+        rate = ngx_atoi(value[i].data + len, s.len - len);
+        if (rate <= 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid rate \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        *rp = (ngx_uint_t) (rate * 1000 / scale);
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx->conn_rate == 0 && ctx->dgram_rate == 0 && ctx->bytes_rate == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"connections\", \"datagrams\" "
+                           "or \"bytes\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_stream_limit_rate_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ctx = shm_zone->data;
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "%V \"%V\" is already bound to key \"%V\"",
+                           &cmd->name, &name, &ctx->key.value);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_stream_limit_rate_init_zone;
+    shm_zone->data = ctx;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_stream_limit_rate(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_limit_rate_conf_t  *lrcf = conf;
+
+    ngx_str_t                      *value, s;
+    ngx_uint_t                      i;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_stream_limit_rate_entry_t  *limit, *limits;
+
+    value = cf->args->elts;
+
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    s.len = value[1].len - 5;
+    s.data = value[1].data + 5;
+
+    shm_zone = ngx_shared_memory_add(cf, &s, 0,
+                                     &ngx_stream_limit_rate_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    limits = lrcf->limits.elts;
+
+    if (limits == NULL) {
+        if (ngx_array_init(&lrcf->limits, cf->pool, 1,
+                           sizeof(ngx_stream_limit_rate_entry_t))
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 0; i < lrcf->limits.nelts; i++) {
+        if (shm_zone == limits[i].shm_zone) {
+            return "is duplicate";
+        }
+    }
+
+    limit = ngx_array_push(&lrcf->limits);
+    if (limit == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    limit->shm_zone = shm_zone;
+    limit->node = NULL;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_limit_rate_init(ngx_conf_t *cf)
+{
+    ngx_stream_handler_pt        *h;
+    ngx_stream_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_PREACCESS_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_limit_rate_handler;
+
+    return NGX_OK;
+}
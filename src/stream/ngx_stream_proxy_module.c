@@ -24,12 +24,19 @@ typedef struct {
     ngx_msec_t                       timeout;
     ngx_msec_t                       next_upstream_timeout;
     size_t                           buffer_size;
+    size_t                           max_buffer_size;
     size_t                           upload_rate;
     size_t                           download_rate;
     ngx_uint_t                       responses;
     ngx_uint_t                       next_upstream_tries;
     ngx_flag_t                       next_upstream;
     ngx_flag_t                       proxy_protocol;
+    ngx_uint_t                       proxy_protocol_version;
+    ngx_array_t                     *proxy_protocol_tlvs;
+    ngx_flag_t                       buffer_pool;
+#if (NGX_HAVE_SPLICE)
+    ngx_flag_t                       splice;
+#endif
     ngx_stream_upstream_local_t     *local;
 
 #if (NGX_STREAM_SSL)
@@ -56,6 +63,28 @@ typedef struct {
 } ngx_stream_proxy_srv_conf_t;
 
 
+typedef struct {
+    ngx_uint_t                       type;
+    ngx_stream_complex_value_t       value;
+} ngx_stream_proxy_tlv_t;
+
+
+typedef struct {
+    size_t                           size;
+    ngx_uint_t                       nfree;
+    void                            *free;
+} ngx_stream_proxy_buffer_pool_t;
+
+
+/*
+ * free buffers of up to 16 different sizes are kept by a worker process,
+ * no more than 32 of each size
+ */
+
+#define NGX_STREAM_PROXY_POOL_SIZES  16
+#define NGX_STREAM_PROXY_POOL_FREE   32
+
+
 static void ngx_stream_proxy_handler(ngx_stream_session_t *s);
 static ngx_int_t ngx_stream_proxy_eval(ngx_stream_session_t *s,
     ngx_stream_proxy_srv_conf_t *pscf);
@@ -63,6 +92,8 @@ static ngx_int_t ngx_stream_proxy_set_local(ngx_stream_session_t *s,
     ngx_stream_upstream_t *u, ngx_stream_upstream_local_t *local);
 static void ngx_stream_proxy_connect(ngx_stream_session_t *s);
 static void ngx_stream_proxy_init_upstream(ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_proxy_create_proxy_protocol(
+    ngx_stream_session_t *s, ngx_str_t *header);
 static void ngx_stream_proxy_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_stream_proxy_upstream_handler(ngx_event_t *ev);
 static void ngx_stream_proxy_downstream_handler(ngx_event_t *ev);
@@ -72,6 +103,14 @@ static void ngx_stream_proxy_connect_handler(ngx_event_t *ev);
 static ngx_int_t ngx_stream_proxy_test_connect(ngx_connection_t *c);
 static void ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if (NGX_HAVE_SPLICE)
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_uint_t from_upstream);
+#endif
+static ngx_int_t ngx_stream_proxy_alloc_buffer(ngx_buf_t *b, size_t size,
+    ngx_log_t *log);
+static void ngx_stream_proxy_free_buffer(ngx_buf_t *b, ngx_log_t *log);
+static void ngx_stream_proxy_cleanup_buffers(void *data);
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
 static void ngx_stream_proxy_finalize(ngx_stream_session_t *s, ngx_uint_t rc);
 static u_char *ngx_stream_proxy_log_error(ngx_log_t *log, u_char *buf,
@@ -84,6 +123,8 @@ static char *ngx_stream_proxy_pass(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_stream_proxy_bind(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_stream_proxy_protocol_tlv(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 #if (NGX_STREAM_SSL)
 
@@ -110,6 +151,15 @@ static ngx_conf_bitmask_t  ngx_stream_proxy_ssl_protocols[] = {
 #endif
 
 
+static ngx_stream_proxy_buffer_pool_t
+    ngx_stream_proxy_buffer_pool[NGX_STREAM_PROXY_POOL_SIZES];
+
+
+static ngx_conf_num_bounds_t  ngx_stream_proxy_protocol_version_bounds = {
+    ngx_conf_check_num_bounds, 1, 2
+};
+
+
 static ngx_conf_deprecated_t  ngx_conf_deprecated_proxy_downstream_buffer = {
     ngx_conf_deprecated, "proxy_downstream_buffer", "proxy_buffer_size"
 };
@@ -156,6 +206,20 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("proxy_max_buffer_size"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, max_buffer_size),
+      NULL },
+
+    { ngx_string("proxy_buffer_pool"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, buffer_pool),
+      NULL },
+
     { ngx_string("proxy_downstream_buffer"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -219,6 +283,31 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, proxy_protocol),
       NULL },
 
+    { ngx_string("proxy_protocol_version"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, proxy_protocol_version),
+      &ngx_stream_proxy_protocol_version_bounds },
+
+    { ngx_string("proxy_protocol_tlv"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE2,
+      ngx_stream_proxy_protocol_tlv,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#if (NGX_HAVE_SPLICE)
+
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
     { ngx_string("proxy_ssl"),
@@ -353,6 +442,7 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
     ngx_str_t                        *host;
     ngx_uint_t                        i;
     ngx_connection_t                 *c;
+    ngx_pool_cleanup_t               *cln;
     ngx_resolver_ctx_t               *ctx, temp;
     ngx_stream_upstream_t            *u;
     ngx_stream_core_srv_conf_t       *cscf;
@@ -398,7 +488,34 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
         return;
     }
 
-    if (c->type == SOCK_STREAM) {
+    if (pscf->buffer_pool && c->type == SOCK_STREAM) {
+
+        /*
+         * buffers are taken from the pool of the worker process
+         * when there are data to read, and are returned there
+         * once a direction has nothing to send
+         */
+
+        cln = ngx_pool_cleanup_add(c->pool, 0);
+        if (cln == NULL) {
+            ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        cln->handler = ngx_stream_proxy_cleanup_buffers;
+        cln->data = s;
+
+        u->buffer_pool = 1;
+        u->downstream_buf_size = pscf->buffer_size;
+        u->upstream_buf_size = pscf->buffer_size;
+
+    } else {
+
+        /*
+         * UDP sessions receive further datagrams of the client
+         * through the downstream buffer as well
+         */
+
         p = ngx_pnalloc(c->pool, pscf->buffer_size);
         if (p == NULL) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
@@ -409,10 +526,15 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
         u->downstream_buf.end = p + pscf->buffer_size;
         u->downstream_buf.pos = p;
         u->downstream_buf.last = p;
+    }
 
+    if (c->type == SOCK_STREAM) {
         if (c->read->ready) {
             ngx_post_event(c->read, &ngx_posted_events);
         }
+
+    } else {
+        u->requests = 1;
     }
 
     if (pscf->upstream_value) {
@@ -731,6 +853,7 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 {
     int                           tcp_nodelay;
     u_char                       *p;
+    ngx_str_t                     header;
     ngx_chain_t                  *cl;
     ngx_connection_t             *c, *pc;
     ngx_log_handler_pt            handler;
@@ -816,7 +939,7 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 
     c->log->action = "proxying connection";
 
-    if (u->upstream_buf.start == NULL) {
+    if (u->upstream_buf.start == NULL && !u->buffer_pool) {
         p = ngx_pnalloc(c->pool, pscf->buffer_size);
         if (p == NULL) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
@@ -860,21 +983,13 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
             return;
         }
 
-        p = ngx_pnalloc(c->pool, NGX_PROXY_PROTOCOL_MAX_HEADER);
-        if (p == NULL) {
+        if (ngx_stream_proxy_create_proxy_protocol(s, &header) != NGX_OK) {
             ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
             return;
         }
 
-        cl->buf->pos = p;
-
-        p = ngx_proxy_protocol_write(c, p, p + NGX_PROXY_PROTOCOL_MAX_HEADER);
-        if (p == NULL) {
-            ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        cl->buf->last = p;
+        cl->buf->pos = header.data;
+        cl->buf->last = header.data + header.len;
         cl->buf->temporary = 1;
         cl->buf->flush = 0;
         cl->buf->last_buf = 0;
@@ -891,6 +1006,21 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
         pc->read->eof = 1;
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    if (pscf->splice
+        && c->type == SOCK_STREAM
+#if (NGX_SSL)
+        && c->ssl == NULL
+        && pc->ssl == NULL
+#endif
+        )
+    {
+        u->splice = 1;
+    }
+
+#endif
+
     u->connected = 1;
 
     pc->read->handler = ngx_stream_proxy_upstream_handler;
@@ -904,25 +1034,123 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 }
 
 
+static ngx_int_t
+ngx_stream_proxy_create_proxy_protocol(ngx_stream_session_t *s,
+    ngx_str_t *header)
+{
+    u_char                       *p;
+    size_t                        len;
+    ngx_uint_t                    i;
+    ngx_array_t                   tlvs;
+    ngx_connection_t             *c;
+    ngx_stream_proxy_tlv_t       *ptlv;
+    ngx_proxy_protocol_tlv_t     *tlv;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+
+    c = s->connection;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    if (pscf->proxy_protocol_version == 1) {
+        p = ngx_pnalloc(c->pool, NGX_PROXY_PROTOCOL_V1_MAX_HEADER);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        header->data = p;
+
+        p = ngx_proxy_protocol_write(c, p,
+                                     p + NGX_PROXY_PROTOCOL_V1_MAX_HEADER);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        header->len = p - header->data;
+
+        return NGX_OK;
+    }
+
+    len = NGX_PROXY_PROTOCOL_V2_MAX_HEADER;
+
+    if (pscf->proxy_protocol_tlvs) {
+
+        if (ngx_array_init(&tlvs, c->pool, pscf->proxy_protocol_tlvs->nelts,
+                           sizeof(ngx_proxy_protocol_tlv_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ptlv = pscf->proxy_protocol_tlvs->elts;
+
+        for (i = 0; i < pscf->proxy_protocol_tlvs->nelts; i++) {
+
+            tlv = ngx_array_push(&tlvs);
+            if (tlv == NULL) {
+                return NGX_ERROR;
+            }
+
+            tlv->type = ptlv[i].type;
+
+            if (ngx_stream_complex_value(s, &ptlv[i].value, &tlv->value)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            /* empty values, e.g. of unset variables, are not sent */
+
+            if (tlv->value.len == 0) {
+                tlvs.nelts--;
+                continue;
+            }
+
+            len += 3 + tlv->value.len;
+        }
+
+        if (len > 0xffff) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "PROXY protocol header is too large");
+            return NGX_ERROR;
+        }
+    }
+
+    p = ngx_pnalloc(c->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    header->data = p;
+
+    p = ngx_proxy_protocol_v2_write(c, p, p + len,
+                                    pscf->proxy_protocol_tlvs ? &tlvs : NULL);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    header->len = p - header->data;
+
+    return NGX_OK;
+}
+
+
 #if (NGX_STREAM_SSL)
 
 static ngx_int_t
 ngx_stream_proxy_send_proxy_protocol(ngx_stream_session_t *s)
 {
-    u_char                       *p;
     ssize_t                       n, size;
+    ngx_str_t                     header;
     ngx_connection_t             *c, *pc;
     ngx_stream_upstream_t        *u;
     ngx_stream_proxy_srv_conf_t  *pscf;
-    u_char                        buf[NGX_PROXY_PROTOCOL_MAX_HEADER];
 
     c = s->connection;
 
     ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
                    "stream proxy send PROXY protocol header");
 
-    p = ngx_proxy_protocol_write(c, buf, buf + NGX_PROXY_PROTOCOL_MAX_HEADER);
-    if (p == NULL) {
+    if (ngx_stream_proxy_create_proxy_protocol(s, &header) != NGX_OK) {
         ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
         return NGX_ERROR;
     }
@@ -931,9 +1159,9 @@ ngx_stream_proxy_send_proxy_protocol(ngx_stream_session_t *s)
 
     pc = u->peer.connection;
 
-    size = p - buf;
+    size = header.len;
 
-    n = pc->send(pc, buf, size);
+    n = pc->send(pc, header.data, size);
 
     if (n == NGX_AGAIN) {
         if (ngx_handle_write_event(pc->write, 0) != NGX_OK) {
@@ -1453,12 +1681,15 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
     ngx_uint_t do_write)
 {
     off_t                        *received, limit;
-    size_t                        size, limit_rate;
+    size_t                        size, limit_rate, *buf_size;
     ssize_t                       n;
     ngx_buf_t                    *b;
     ngx_int_t                     rc;
-    ngx_uint_t                    flags;
+    ngx_uint_t                    flags, batch;
     ngx_msec_t                    delay;
+#if (NGX_STREAM_LIMIT_RATE)
+    ngx_msec_t                    zone_delay;
+#endif
     ngx_chain_t                  *cl, **ll, **out, **busy;
     ngx_connection_t             *c, *pc, *src, *dst;
     ngx_log_handler_pt            handler;
@@ -1491,6 +1722,7 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         src = pc;
         dst = c;
         b = &u->upstream_buf;
+        buf_size = &u->upstream_buf_size;
         limit_rate = pscf->download_rate;
         received = &u->received;
         out = &u->downstream_out;
@@ -1500,15 +1732,36 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
         src = c;
         dst = pc;
         b = &u->downstream_buf;
+        buf_size = &u->downstream_buf_size;
         limit_rate = pscf->upload_rate;
         received = &s->received;
         out = &u->upstream_out;
         busy = &u->upstream_busy;
     }
 
+    batch = 0;
+
     for ( ;; ) {
 
-        if (do_write && dst) {
+#if (NGX_HAVE_SPLICE)
+
+        /* switch to splice() once all buffered data are sent */
+
+        if (u->splice && dst && *out == NULL && *busy == NULL
+            && !(dst->buffered & ~NGX_STREAM_SPLICE_BUFFERED))
+        {
+            if (ngx_stream_proxy_splice(s, src, dst, from_upstream)
+                != NGX_OK)
+            {
+                return;
+            }
+
+            break;
+        }
+
+#endif
+
+        if (do_write && dst && !batch) {
 
             if (*out || *busy || dst->buffered) {
                 rc = ngx_stream_top_filter(s, *out, from_upstream);
@@ -1527,36 +1780,77 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
                                       (ngx_buf_tag_t) &ngx_stream_proxy_module);
 
                 if (*busy == NULL) {
-                    b->pos = b->start;
-                    b->last = b->start;
+
+                    if (u->buffer_pool
+                        && b->start
+                        && b->last == b->end
+                        && *buf_size < pscf->max_buffer_size)
+                    {
+                        /* the buffer was filled up, use a larger one */
+
+                        *buf_size = ngx_min(*buf_size * 2,
+                                            pscf->max_buffer_size);
+
+                        ngx_stream_proxy_free_buffer(b, c->log);
+
+                    } else {
+                        b->pos = b->start;
+                        b->last = b->start;
+                    }
                 }
             }
         }
 
+        if (b->start == NULL && src->read->ready) {
+            if (ngx_stream_proxy_alloc_buffer(b, *buf_size, c->log)
+                != NGX_OK)
+            {
+                ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
+                return;
+            }
+        }
+
         size = b->end - b->last;
 
         if (size && src->read->ready && !src->read->delayed
             && !src->read->error)
         {
+            /* the longest of the session and per-key delays is used */
+
+#if (NGX_STREAM_LIMIT_RATE)
+            delay = ngx_stream_limit_rate_bytes(s, 0);
+#else
+            delay = 0;
+#endif
+
             if (limit_rate) {
                 limit = (off_t) limit_rate * (ngx_time() - u->start_sec + 1)
                         - *received;
 
                 if (limit <= 0) {
-                    src->read->delayed = 1;
-                    delay = (ngx_msec_t) (- limit * 1000 / limit_rate + 1);
-                    ngx_add_timer(src->read, delay);
-                    break;
-                }
+                    delay = ngx_max(delay, (ngx_msec_t) (- limit * 1000
+                                                         / limit_rate + 1));
 
-                if ((off_t) size > limit) {
+                } else if ((off_t) size > limit) {
                     size = (size_t) limit;
                 }
             }
 
+            if (delay) {
+                src->read->delayed = 1;
+                ngx_add_timer(src->read, delay);
+                break;
+            }
+
             n = src->recv(src, b->last, size);
 
             if (n == NGX_AGAIN) {
+
+                if (batch) {
+                    batch = 0;
+                    continue;
+                }
+
                 break;
             }
 
@@ -1571,13 +1865,32 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
             }
 
             if (n >= 0) {
+
+#if (NGX_STREAM_LIMIT_RATE)
+                if (n && c->type == SOCK_DGRAM && !from_upstream
+                    && ngx_stream_limit_rate_datagram(s) != NGX_OK)
+                {
+                    /* the datagram is dropped */
+                    continue;
+                }
+#endif
+
+                delay = 0;
+
                 if (limit_rate) {
                     delay = (ngx_msec_t) (n * 1000 / limit_rate);
+                }
 
-                    if (delay > 0) {
-                        src->read->delayed = 1;
-                        ngx_add_timer(src->read, delay);
-                    }
+#if (NGX_STREAM_LIMIT_RATE)
+                if (n) {
+                    zone_delay = ngx_stream_limit_rate_bytes(s, n);
+                    delay = ngx_max(delay, zone_delay);
+                }
+#endif
+
+                if (delay > 0) {
+                    src->read->delayed = 1;
+                    ngx_add_timer(src->read, delay);
                 }
 
                 if (from_upstream) {
@@ -1587,10 +1900,23 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
                     }
                 }
 
-                if (c->type == SOCK_DGRAM && ++u->responses == pscf->responses)
-                {
-                    src->read->ready = 0;
-                    src->read->eof = 1;
+                if (c->type == SOCK_DGRAM) {
+
+                    /*
+                     * the upstream is done when all responses
+                     * to all datagrams of the session are received
+                     */
+
+                    if (!from_upstream) {
+                        u->requests++;
+
+                    } else if (pscf->responses != NGX_MAX_INT32_VALUE
+                               && ++u->responses
+                                  == pscf->responses * u->requests)
+                    {
+                        src->read->ready = 0;
+                        src->read->eof = 1;
+                    }
                 }
 
                 for (ll = out; *ll; ll = &(*ll)->next) { /* void */ }
@@ -1616,13 +1942,47 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
                 b->last += n;
                 do_write = 1;
 
+                /*
+                 * datagrams are read while the buffer can hold one
+                 * of the maximum size, and then sent at once
+                 */
+
+                batch = (c->type == SOCK_DGRAM
+                         && limit_rate == 0
+                         && src->read->ready
+                         && !src->read->eof
+                         && !src->read->delayed
+                         && b->end - b->last >= 65535);
+
                 continue;
             }
         }
 
+        if (batch) {
+            batch = 0;
+            continue;
+        }
+
         break;
     }
 
+    if (u->buffer_pool && b->start && *out == NULL && *busy == NULL) {
+
+        /*
+         * the direction is idle, return the buffer to the pool;
+         * the size of the next one decays to proxy_buffer_size
+         */
+
+        ngx_stream_proxy_free_buffer(b, c->log);
+
+        *buf_size = ngx_max(*buf_size / 2, pscf->buffer_size);
+    }
+
+    if (pc && u->peer.notify) {
+        u->peer.notify(&u->peer, u->peer.data,
+                       NGX_STREAM_UPSTREAM_NOTIFY_DATA);
+    }
+
     if (src->read->eof && dst && (dst->read->eof || !dst->buffered)) {
         handler = c->log->handler;
         c->log->handler = NULL;
@@ -1664,6 +2024,251 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream,
 }
 
 
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_uint_t from_upstream)
+{
+    off_t                        *received, limit;
+    size_t                        size, limit_rate;
+    ssize_t                       n;
+    ngx_msec_t                    delay;
+#if (NGX_STREAM_LIMIT_RATE)
+    ngx_msec_t                    zone_delay;
+#endif
+    ngx_connection_t             *c;
+    ngx_splice_pipe_t            *p, **pp;
+    ngx_stream_upstream_t        *u;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+
+    c = s->connection;
+    u = s->upstream;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    if (from_upstream) {
+        pp = &u->upstream_pipe;
+        limit_rate = pscf->download_rate;
+        received = &u->received;
+
+    } else {
+        pp = &u->downstream_pipe;
+        limit_rate = pscf->upload_rate;
+        received = &s->received;
+    }
+
+    if (*pp == NULL) {
+        *pp = ngx_linux_splice_pipe(c->pool, c->log);
+        if (*pp == NULL) {
+            ngx_stream_proxy_finalize(s, NGX_STREAM_INTERNAL_SERVER_ERROR);
+            return NGX_ERROR;
+        }
+    }
+
+    p = *pp;
+
+    for ( ;; ) {
+
+        if (p->size && dst->write->ready) {
+            n = ngx_linux_splice_send(dst, p);
+
+            if (n == NGX_ERROR) {
+                ngx_stream_proxy_finalize(s, NGX_STREAM_OK);
+                return NGX_ERROR;
+            }
+        }
+
+        if (p->size) {
+            dst->buffered |= NGX_STREAM_SPLICE_BUFFERED;
+            break;
+        }
+
+        dst->buffered &= ~NGX_STREAM_SPLICE_BUFFERED;
+
+        if (!src->read->ready || src->read->delayed || src->read->error) {
+            break;
+        }
+
+        size = pscf->buffer_size;
+
+        /* the longest of the session and per-key delays is used */
+
+#if (NGX_STREAM_LIMIT_RATE)
+        delay = ngx_stream_limit_rate_bytes(s, 0);
+#else
+        delay = 0;
+#endif
+
+        if (limit_rate) {
+            limit = (off_t) limit_rate * (ngx_time() - u->start_sec + 1)
+                    - *received;
+
+            if (limit <= 0) {
+                delay = ngx_max(delay, (ngx_msec_t) (- limit * 1000
+                                                     / limit_rate + 1));
+
+            } else if ((off_t) size > limit) {
+                size = (size_t) limit;
+            }
+        }
+
+        if (delay) {
+            src->read->delayed = 1;
+            ngx_add_timer(src->read, delay);
+            break;
+        }
+
+        n = ngx_linux_splice_recv(src, p, size);
+
+        if (n == NGX_AGAIN || n == 0) {
+            break;
+        }
+
+        if (n == NGX_ERROR) {
+            src->read->eof = 1;
+            break;
+        }
+
+        delay = 0;
+
+        if (limit_rate) {
+            delay = (ngx_msec_t) (n * 1000 / limit_rate);
+        }
+
+#if (NGX_STREAM_LIMIT_RATE)
+        zone_delay = ngx_stream_limit_rate_bytes(s, n);
+        delay = ngx_max(delay, zone_delay);
+#endif
+
+        if (delay > 0) {
+            src->read->delayed = 1;
+            ngx_add_timer(src->read, delay);
+        }
+
+        if (from_upstream) {
+            if (u->state->first_byte_time == (ngx_msec_t) -1) {
+                u->state->first_byte_time = ngx_current_msec
+                                            - u->state->response_time;
+            }
+        }
+
+        *received += n;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_stream_proxy_alloc_buffer(ngx_buf_t *b, size_t size, ngx_log_t *log)
+{
+    u_char                          *p;
+    ngx_uint_t                       i;
+    ngx_stream_proxy_buffer_pool_t  *bp;
+
+    bp = ngx_stream_proxy_buffer_pool;
+
+    for (i = 0; i < NGX_STREAM_PROXY_POOL_SIZES; i++) {
+        if (bp[i].size == size && bp[i].free) {
+            p = bp[i].free;
+            bp[i].free = *(void **) p;
+            bp[i].nfree--;
+
+            goto done;
+        }
+    }
+
+    p = ngx_alloc(size, log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+done:
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, log, 0,
+                   "stream proxy alloc buffer: %p:%uz", p, size);
+
+    b->start = p;
+    b->pos = p;
+    b->last = p;
+    b->end = p + size;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_free_buffer(ngx_buf_t *b, ngx_log_t *log)
+{
+    size_t                           size;
+    ngx_uint_t                       i;
+    ngx_stream_proxy_buffer_pool_t  *bp, *empty;
+
+    if (b->start == NULL) {
+        return;
+    }
+
+    size = b->end - b->start;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, log, 0,
+                   "stream proxy free buffer: %p:%uz", b->start, size);
+
+    bp = ngx_stream_proxy_buffer_pool;
+    empty = NULL;
+
+    for (i = 0; i < NGX_STREAM_PROXY_POOL_SIZES; i++) {
+
+        if (bp[i].size == size) {
+            break;
+        }
+
+        if (bp[i].size == 0 && empty == NULL) {
+            empty = &bp[i];
+        }
+    }
+
+    if (i < NGX_STREAM_PROXY_POOL_SIZES) {
+        bp = &bp[i];
+
+    } else if (empty) {
+        bp = empty;
+        bp->size = size;
+
+    } else {
+        bp = NULL;
+    }
+
+    if (bp && bp->nfree < NGX_STREAM_PROXY_POOL_FREE) {
+        *(void **) b->start = bp->free;
+        bp->free = b->start;
+        bp->nfree++;
+
+    } else {
+        ngx_free(b->start);
+    }
+
+    b->start = NULL;
+    b->pos = NULL;
+    b->last = NULL;
+    b->end = NULL;
+}
+
+
+static void
+ngx_stream_proxy_cleanup_buffers(void *data)
+{
+    ngx_stream_session_t  *s = data;
+
+    ngx_stream_proxy_free_buffer(&s->upstream->downstream_buf,
+                                 s->connection->log);
+    ngx_stream_proxy_free_buffer(&s->upstream->upstream_buf,
+                                 s->connection->log);
+}
+
+
 static void
 ngx_stream_proxy_next_upstream(ngx_stream_session_t *s)
 {
@@ -1844,12 +2449,19 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->next_upstream_timeout = NGX_CONF_UNSET_MSEC;
     conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->max_buffer_size = NGX_CONF_UNSET_SIZE;
     conf->upload_rate = NGX_CONF_UNSET_SIZE;
     conf->download_rate = NGX_CONF_UNSET_SIZE;
     conf->responses = NGX_CONF_UNSET_UINT;
     conf->next_upstream_tries = NGX_CONF_UNSET_UINT;
     conf->next_upstream = NGX_CONF_UNSET;
     conf->proxy_protocol = NGX_CONF_UNSET;
+    conf->proxy_protocol_version = NGX_CONF_UNSET_UINT;
+    conf->proxy_protocol_tlvs = NGX_CONF_UNSET_PTR;
+    conf->buffer_pool = NGX_CONF_UNSET;
+#if (NGX_HAVE_SPLICE)
+    conf->splice = NGX_CONF_UNSET;
+#endif
     conf->local = NGX_CONF_UNSET_PTR;
 
 #if (NGX_STREAM_SSL)
@@ -1883,6 +2495,27 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->buffer_size,
                               prev->buffer_size, 16384);
 
+    ngx_conf_merge_size_value(conf->max_buffer_size,
+                              prev->max_buffer_size, conf->buffer_size);
+
+    if (conf->max_buffer_size < conf->buffer_size) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_max_buffer_size\" must be equal to or "
+                           "greater than \"proxy_buffer_size\"");
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_value(conf->buffer_pool, prev->buffer_pool, 0);
+
+    /* free pooled buffers keep a pointer to the next one */
+
+    if (conf->buffer_pool && conf->buffer_size < sizeof(void *)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_buffer_size\" must be at least %uz "
+                           "with \"proxy_buffer_pool\"", sizeof(void *));
+        return NGX_CONF_ERROR;
+    }
+
     ngx_conf_merge_size_value(conf->upload_rate,
                               prev->upload_rate, 0);
 
@@ -1899,6 +2532,25 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->proxy_protocol, prev->proxy_protocol, 0);
 
+    ngx_conf_merge_uint_value(conf->proxy_protocol_version,
+                              prev->proxy_protocol_version, 1);
+
+    ngx_conf_merge_ptr_value(conf->proxy_protocol_tlvs,
+                             prev->proxy_protocol_tlvs, NULL);
+
+    if (conf->proxy_protocol
+        && conf->proxy_protocol_tlvs
+        && conf->proxy_protocol_version != 2)
+    {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"proxy_protocol_tlv\" is ignored "
+                           "with PROXY protocol version 1");
+    }
+
+#if (NGX_HAVE_SPLICE)
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+#endif
+
     ngx_conf_merge_ptr_value(conf->local, prev->local, NULL);
 
 #if (NGX_STREAM_SSL)
@@ -2169,3 +2821,52 @@ ngx_stream_proxy_bind(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_stream_proxy_protocol_tlv(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_proxy_srv_conf_t *pscf = conf;
+
+    ngx_int_t                            type;
+    ngx_str_t                           *value;
+    ngx_stream_proxy_tlv_t              *tlv;
+    ngx_stream_compile_complex_value_t   ccv;
+
+    value = cf->args->elts;
+
+    type = ngx_proxy_protocol_tlv_type(&value[1]);
+
+    if (type == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid TLV type \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (pscf->proxy_protocol_tlvs == NGX_CONF_UNSET_PTR) {
+        pscf->proxy_protocol_tlvs = ngx_array_create(cf->pool, 2,
+                                                sizeof(ngx_stream_proxy_tlv_t));
+        if (pscf->proxy_protocol_tlvs == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    tlv = ngx_array_push(pscf->proxy_protocol_tlvs);
+    if (tlv == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    tlv->type = type;
+
+    ngx_memzero(&ccv, sizeof(ngx_stream_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[2];
+    ccv.complex_value = &tlv->value;
+
+    if (ngx_stream_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
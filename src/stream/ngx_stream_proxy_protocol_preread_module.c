@@ -0,0 +1,417 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+/*
+ * the module looks at the PROXY protocol v2 header sent by a balancer
+ * in front of us without removing it from the data passed upstream;
+ * the header is skipped by other preread parsers
+ */
+
+
+typedef struct {
+    ngx_flag_t      enabled;
+} ngx_stream_proxy_protocol_preread_srv_conf_t;
+
+
+typedef struct {
+    ngx_str_t       addr;
+    ngx_str_t       port;
+    ngx_str_t       tlvs;
+} ngx_stream_proxy_protocol_preread_ctx_t;
+
+
+static ngx_int_t ngx_stream_proxy_protocol_preread_handler(
+    ngx_stream_session_t *s);
+static ngx_int_t ngx_stream_proxy_protocol_preread_parse(
+    ngx_stream_session_t *s, u_char *p, size_t len);
+static ngx_int_t ngx_stream_proxy_protocol_preread_variable(
+    ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_proxy_protocol_preread_tlv_variable(
+    ngx_stream_session_t *s, ngx_stream_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_stream_proxy_protocol_preread_add_variables(
+    ngx_conf_t *cf);
+static void *ngx_stream_proxy_protocol_preread_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_stream_proxy_protocol_preread_merge_srv_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static ngx_int_t ngx_stream_proxy_protocol_preread_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_stream_proxy_protocol_preread_commands[] = {
+
+    { ngx_string("proxy_protocol_preread"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_protocol_preread_srv_conf_t, enabled),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_proxy_protocol_preread_module_ctx = {
+    ngx_stream_proxy_protocol_preread_add_variables, /* preconfiguration */
+    ngx_stream_proxy_protocol_preread_init,          /* postconfiguration */
+
+    NULL,                                    /* create main configuration */
+    NULL,                                    /* init main configuration */
+
+    ngx_stream_proxy_protocol_preread_create_srv_conf,
+                                             /* create server configuration */
+    ngx_stream_proxy_protocol_preread_merge_srv_conf
+                                             /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_proxy_protocol_preread_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_proxy_protocol_preread_module_ctx, /* module context */
+    ngx_stream_proxy_protocol_preread_commands,    /* module directives */
+    NGX_STREAM_MODULE,                       /* module type */
+    NULL,                                    /* init master */
+    NULL,                                    /* init module */
+    NULL,                                    /* init process */
+    NULL,                                    /* init thread */
+    NULL,                                    /* exit thread */
+    NULL,                                    /* exit process */
+    NULL,                                    /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_stream_variable_t  ngx_stream_proxy_protocol_preread_vars[] = {
+
+    { ngx_string("proxy_protocol_preread_addr"), NULL,
+      ngx_stream_proxy_protocol_preread_variable,
+      offsetof(ngx_stream_proxy_protocol_preread_ctx_t, addr), 0, 0 },
+
+    { ngx_string("proxy_protocol_preread_port"), NULL,
+      ngx_stream_proxy_protocol_preread_variable,
+      offsetof(ngx_stream_proxy_protocol_preread_ctx_t, port), 0, 0 },
+
+    { ngx_string("proxy_protocol_preread_tlv_"), NULL,
+      ngx_stream_proxy_protocol_preread_tlv_variable,
+      0, NGX_STREAM_VAR_PREFIX, 0 },
+
+    { ngx_null_string, NULL, NULL, 0, 0, 0 }
+};
+
+
+static u_char  ngx_stream_proxy_protocol_preread_sig[] =
+    "\r\n\r\n\0\r\nQUIT\n";
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_handler(ngx_stream_session_t *s)
+{
+    u_char                                        *p;
+    size_t                                         len, size;
+    ngx_int_t                                      rc;
+    ngx_connection_t                              *c;
+    ngx_stream_proxy_protocol_preread_srv_conf_t  *ppcf;
+
+    c = s->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                   "proxy protocol preread handler");
+
+    ppcf = ngx_stream_get_module_srv_conf(s,
+                                       ngx_stream_proxy_protocol_preread_module);
+
+    if (!ppcf->enabled) {
+        return NGX_DECLINED;
+    }
+
+    if (c->type != SOCK_STREAM) {
+        return NGX_DECLINED;
+    }
+
+    if (c->buffer == NULL) {
+        return NGX_AGAIN;
+    }
+
+    p = c->buffer->pos;
+    len = c->buffer->last - p;
+
+    if (ngx_memcmp(p, ngx_stream_proxy_protocol_preread_sig, ngx_min(len, 12))
+        != 0)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "proxy protocol preread: no v2 header");
+        return NGX_DECLINED;
+    }
+
+    if (len < 16) {
+        return NGX_AGAIN;
+    }
+
+    if ((p[12] & 0xf0) != 0x20) {
+        ngx_log_debug1(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "proxy protocol preread: unsupported version %ui",
+                       (ngx_uint_t) (p[12] >> 4));
+        return NGX_DECLINED;
+    }
+
+    size = 16 + (p[14] << 8) + p[15];
+
+    if (size > (size_t) (c->buffer->end - c->buffer->pos)) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "PROXY protocol header of %uz bytes does not fit "
+                      "into preread buffer", size);
+        return NGX_DECLINED;
+    }
+
+    if (len < size) {
+        return NGX_AGAIN;
+    }
+
+    rc = ngx_stream_proxy_protocol_preread_parse(s, p, size);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    s->preread_offset = size;
+
+    /* let other preread parsers look at the data after the header */
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_parse(ngx_stream_session_t *s, u_char *p,
+    size_t len)
+{
+    int                                       family;
+    size_t                                    alen, asize;
+    in_port_t                                 port;
+    ngx_connection_t                         *c;
+    ngx_stream_proxy_protocol_preread_ctx_t  *ctx;
+
+    c = s->connection;
+
+    ctx = ngx_pcalloc(c->pool, sizeof(ngx_stream_proxy_protocol_preread_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_stream_set_ctx(s, ctx, ngx_stream_proxy_protocol_preread_module);
+
+    /* the LOCAL command carries no addresses */
+
+    switch ((p[12] & 0x0f) == 0x01 ? p[13] >> 4 : 0) {
+
+    case 1:
+        family = AF_INET;
+        asize = 12;
+        alen = NGX_INET_ADDRSTRLEN;
+        break;
+
+    case 2:
+#if (NGX_HAVE_INET6)
+        family = AF_INET6;
+        alen = NGX_INET6_ADDRSTRLEN;
+#else
+        family = AF_UNSPEC;
+        alen = 0;
+#endif
+        asize = 36;
+        break;
+
+    case 3:
+        family = AF_UNSPEC;
+        asize = 216;
+        alen = 0;
+        break;
+
+    default:
+        family = AF_UNSPEC;
+        asize = 0;
+        alen = 0;
+    }
+
+    if (len - 16 < asize) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "broken PROXY protocol v2 header");
+        return NGX_DECLINED;
+    }
+
+    if (alen) {
+        ctx->addr.data = ngx_pnalloc(c->pool, alen + sizeof("65535") - 1);
+        if (ctx->addr.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->addr.len = ngx_inet_ntop(family, p + 16, ctx->addr.data, alen);
+
+        port = (p[16 + asize - 4] << 8) + p[16 + asize - 3];
+
+        ctx->port.data = ctx->addr.data + ctx->addr.len;
+        ctx->port.len = ngx_sprintf(ctx->port.data, "%ui", (ngx_uint_t) port)
+                        - ctx->port.data;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "proxy protocol preread: %V %V",
+                       &ctx->addr, &ctx->port);
+    }
+
+    ctx->tlvs.len = len - 16 - asize;
+
+    if (ctx->tlvs.len) {
+        ctx->tlvs.data = ngx_pnalloc(c->pool, ctx->tlvs.len);
+        if (ctx->tlvs.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(ctx->tlvs.data, p + 16 + asize, ctx->tlvs.len);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    ngx_str_t                                *value;
+    ngx_stream_proxy_protocol_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s,
+                                    ngx_stream_proxy_protocol_preread_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    value = (ngx_str_t *) ((char *) ctx + data);
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = value->len;
+    v->data = value->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_tlv_variable(ngx_stream_session_t *s,
+    ngx_variable_value_t *v, uintptr_t data)
+{
+    ngx_str_t *name = (ngx_str_t *) data;
+
+    ngx_int_t                                 rc;
+    ngx_str_t                                 tlv, value;
+    ngx_stream_proxy_protocol_preread_ctx_t  *ctx;
+
+    ctx = ngx_stream_get_module_ctx(s,
+                                    ngx_stream_proxy_protocol_preread_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    tlv.len = name->len - (sizeof("proxy_protocol_preread_tlv_") - 1);
+    tlv.data = name->data + sizeof("proxy_protocol_preread_tlv_") - 1;
+
+    rc = ngx_proxy_protocol_lookup_tlv(s->connection, &ctx->tlvs, &tlv,
+                                       &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = value.len;
+    v->data = value.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_add_variables(ngx_conf_t *cf)
+{
+    ngx_stream_variable_t  *var, *v;
+
+    for (v = ngx_stream_proxy_protocol_preread_vars; v->name.len; v++) {
+        var = ngx_stream_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_proxy_protocol_preread_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_stream_proxy_protocol_preread_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool,
+                       sizeof(ngx_stream_proxy_protocol_preread_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->enabled = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_proxy_protocol_preread_merge_srv_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_stream_proxy_protocol_preread_srv_conf_t *prev = parent;
+    ngx_stream_proxy_protocol_preread_srv_conf_t *conf = child;
+
+    ngx_conf_merge_value(conf->enabled, prev->enabled, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_protocol_preread_init(ngx_conf_t *cf)
+{
+    ngx_stream_handler_pt        *h;
+    ngx_stream_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_STREAM_PREREAD_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_stream_proxy_protocol_preread_handler;
+
+    return NGX_OK;
+}
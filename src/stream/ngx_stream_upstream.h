@@ -25,6 +25,7 @@
 
 
 #define NGX_STREAM_UPSTREAM_NOTIFY_CONNECT     0x1
+#define NGX_STREAM_UPSTREAM_NOTIFY_DATA        0x2
 
 
 typedef struct {
@@ -119,6 +120,8 @@ typedef struct {
 
     ngx_buf_t                          downstream_buf;
     ngx_buf_t                          upstream_buf;
+    size_t                             downstream_buf_size;
+    size_t                             upstream_buf_size;
 
     ngx_chain_t                       *free;
     ngx_chain_t                       *upstream_out;
@@ -126,8 +129,14 @@ typedef struct {
     ngx_chain_t                       *downstream_out;
     ngx_chain_t                       *downstream_busy;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_splice_pipe_t                 *upstream_pipe;
+    ngx_splice_pipe_t                 *downstream_pipe;
+#endif
+
     off_t                              received;
     time_t                             start_sec;
+    ngx_uint_t                         requests;
     ngx_uint_t                         responses;
 
     ngx_str_t                          ssl_name;
@@ -137,6 +146,8 @@ typedef struct {
     ngx_stream_upstream_state_t       *state;
     unsigned                           connected:1;
     unsigned                           proxy_protocol:1;
+    unsigned                           splice:1;
+    unsigned                           buffer_pool:1;
 } ngx_stream_upstream_t;
 
 
@@ -0,0 +1,590 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+/*
+ * the methods select a peer with the least product of the number of
+ * active connections and a decaying average of either the connect time
+ * ("least_time connect") or the rate of bytes transferred ("least_bytes");
+ * the averages are kept in peers, that is, in the upstream zone if any
+ */
+
+
+#define NGX_STREAM_UPSTREAM_LEAST_CONNECT  0
+#define NGX_STREAM_UPSTREAM_LEAST_BYTES    1
+
+
+/* the rate is measured over intervals of at least a second */
+
+#define NGX_STREAM_UPSTREAM_RATE_INTERVAL  1000
+
+
+typedef struct {
+    ngx_uint_t                            method;
+} ngx_stream_upstream_least_time_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_stream_upstream_rr_peer_data_t    rrp;
+    ngx_stream_upstream_least_time_srv_conf_t  *conf;
+    ngx_stream_session_t                 *session;
+    ngx_msec_t                            start;
+    ngx_msec_t                            reported;
+    off_t                                 bytes;
+} ngx_stream_upstream_least_time_peer_data_t;
+
+
+static ngx_int_t ngx_stream_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_init_least_time_peer(
+    ngx_stream_session_t *s, ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_get_least_time_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_stream_upstream_free_least_time_peer(
+    ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
+static void ngx_stream_upstream_notify_least_time_peer(
+    ngx_peer_connection_t *pc, void *data, ngx_uint_t type);
+static void ngx_stream_upstream_least_time_report(
+    ngx_stream_upstream_least_time_peer_data_t *lp, ngx_peer_connection_t *pc);
+static uint64_t ngx_stream_upstream_least_time_score(
+    ngx_stream_upstream_least_time_srv_conf_t *ltcf,
+    ngx_stream_upstream_rr_peer_t *peer, ngx_msec_t now);
+static void ngx_stream_upstream_least_time_update_rate(
+    ngx_stream_upstream_rr_peer_t *peer, off_t bytes, ngx_msec_t now);
+static void *ngx_stream_upstream_least_time_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_stream_upstream_least_time_commands[] = {
+
+    { ngx_string("least_time"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_stream_upstream_least_time,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("least_bytes"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_NOARGS,
+      ngx_stream_upstream_least_time,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_least_time_module_ctx = {
+    NULL,                                    /* preconfiguration */
+    NULL,                                    /* postconfiguration */
+
+    NULL,                                    /* create main configuration */
+    NULL,                                    /* init main configuration */
+
+    ngx_stream_upstream_least_time_create_conf,
+                                             /* create server configuration */
+    NULL                                     /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_least_time_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_least_time_module_ctx, /* module context */
+    ngx_stream_upstream_least_time_commands, /* module directives */
+    NGX_STREAM_MODULE,                       /* module type */
+    NULL,                                    /* init master */
+    NULL,                                    /* init module */
+    NULL,                                    /* init process */
+    NULL,                                    /* init thread */
+    NULL,                                    /* exit thread */
+    NULL,                                    /* exit process */
+    NULL,                                    /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_stream_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, cf->log, 0,
+                   "init least time");
+
+    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_stream_upstream_init_least_time_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_init_least_time_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    ngx_stream_upstream_least_time_peer_data_t  *lp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
+                   "init least time peer");
+
+    lp = ngx_palloc(s->connection->pool,
+                    sizeof(ngx_stream_upstream_least_time_peer_data_t));
+    if (lp == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->upstream->peer.data = &lp->rrp;
+
+    if (ngx_stream_upstream_init_round_robin_peer(s, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->upstream->peer.get = ngx_stream_upstream_get_least_time_peer;
+    s->upstream->peer.free = ngx_stream_upstream_free_least_time_peer;
+    s->upstream->peer.notify = ngx_stream_upstream_notify_least_time_peer;
+
+    lp->conf = ngx_stream_conf_upstream_srv_conf(us,
+                                        ngx_stream_upstream_least_time_module);
+    lp->session = s;
+    lp->start = 0;
+    lp->reported = 0;
+    lp->bytes = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_get_least_time_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_stream_upstream_least_time_peer_data_t  *lp = data;
+
+    time_t                           now;
+    uint64_t                         score, best_score;
+    uintptr_t                        m;
+    ngx_int_t                        rc, total;
+    ngx_uint_t                       i, n, p, many;
+    ngx_msec_t                       msec;
+    ngx_stream_upstream_rr_peer_t   *peer, *best;
+    ngx_stream_upstream_rr_peers_t  *peers;
+    ngx_stream_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "get least time peer, try: %ui", pc->tries);
+
+    rrp = &lp->rrp;
+
+    lp->start = ngx_current_msec;
+    lp->reported = ngx_current_msec;
+    lp->bytes = 0;
+
+    if (rrp->peers->single) {
+        return ngx_stream_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->connection = NULL;
+
+    now = ngx_time();
+    msec = ngx_current_msec;
+
+    peers = rrp->peers;
+
+    ngx_stream_upstream_rr_peers_wlock(peers);
+
+    best = NULL;
+    best_score = 0;
+    total = 0;
+
+#if (NGX_SUPPRESS_WARN)
+    many = 0;
+    p = 0;
+#endif
+
+    for (peer = peers->peer, i = 0;
+         peer;
+         peer = peer->next, i++)
+    {
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            continue;
+        }
+
+        score = ngx_stream_upstream_least_time_score(lp->conf, peer, msec);
+
+        /*
+         * select peer with least weighted score; if there are
+         * multiple peers with the same score, select based on round-robin
+         */
+
+        if (best == NULL
+            || score * best->weight < best_score * peer->weight)
+        {
+            best = peer;
+            best_score = score;
+            many = 0;
+            p = i;
+
+        } else if (score * best->weight == best_score * peer->weight) {
+            many = 1;
+        }
+    }
+
+    if (best == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                       "get least time peer, no peer found");
+
+        goto failed;
+    }
+
+    if (many) {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                       "get least time peer, many");
+
+        score = best_score;
+
+        for (peer = best, i = p;
+             peer;
+             peer = peer->next, i++)
+        {
+            n = i / (8 * sizeof(uintptr_t));
+            m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+            if (rrp->tried[n] & m) {
+                continue;
+            }
+
+            if (peer->down) {
+                continue;
+            }
+
+            if (ngx_stream_upstream_least_time_score(lp->conf, peer, msec)
+                * best->weight != score * peer->weight)
+            {
+                continue;
+            }
+
+            if (peer->max_fails
+                && peer->fails >= peer->max_fails
+                && now - peer->checked <= peer->fail_timeout)
+            {
+                continue;
+            }
+
+            if (peer->max_conns && peer->conns >= peer->max_conns) {
+                continue;
+            }
+
+            peer->current_weight += peer->effective_weight;
+            total += peer->effective_weight;
+
+            if (peer->effective_weight < peer->weight) {
+                peer->effective_weight++;
+            }
+
+            if (peer->current_weight > best->current_weight) {
+                best = peer;
+                p = i;
+            }
+        }
+    }
+
+    best->current_weight -= total;
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                       "get least time peer, backup servers");
+
+        rrp->peers = peers->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+            rrp->tried[i] = 0;
+        }
+
+        ngx_stream_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_stream_upstream_get_least_time_peer(pc, lp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_stream_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_stream_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_stream_upstream_least_time_peer_data_t  *lp = data;
+
+    if (lp->conf->method == NGX_STREAM_UPSTREAM_LEAST_BYTES
+        && pc->connection
+        && lp->rrp.current)
+    {
+        ngx_stream_upstream_least_time_report(lp, pc);
+    }
+
+    ngx_stream_upstream_free_round_robin_peer(pc, &lp->rrp, state);
+}
+
+
+static void
+ngx_stream_upstream_notify_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type)
+{
+    ngx_stream_upstream_least_time_peer_data_t  *lp = data;
+
+    ngx_msec_t                      time;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    peer = lp->rrp.current;
+
+    switch (type) {
+
+    case NGX_STREAM_UPSTREAM_NOTIFY_CONNECT:
+
+        if (lp->conf->method == NGX_STREAM_UPSTREAM_LEAST_CONNECT
+            && pc->connection->type == SOCK_STREAM)
+        {
+            time = ngx_current_msec - lp->start;
+
+            ngx_stream_upstream_rr_peers_rlock(lp->rrp.peers);
+            ngx_stream_upstream_rr_peer_lock(lp->rrp.peers, peer);
+
+            /* exponentially weighted average with the factor of 1/8 */
+
+            peer->connect_time = (peer->connect_time * 7 + time) / 8;
+
+            ngx_stream_upstream_rr_peer_unlock(lp->rrp.peers, peer);
+            ngx_stream_upstream_rr_peers_unlock(lp->rrp.peers);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                           "least time connect: %M, average: %M",
+                           time, peer->connect_time);
+        }
+
+        break;
+
+    case NGX_STREAM_UPSTREAM_NOTIFY_DATA:
+
+        if (lp->conf->method == NGX_STREAM_UPSTREAM_LEAST_BYTES
+            && ngx_current_msec - lp->reported
+               >= NGX_STREAM_UPSTREAM_RATE_INTERVAL)
+        {
+            ngx_stream_upstream_least_time_report(lp, pc);
+        }
+
+        return;
+    }
+
+    ngx_stream_upstream_notify_round_robin_peer(pc, &lp->rrp, type);
+}
+
+
+static void
+ngx_stream_upstream_least_time_report(
+    ngx_stream_upstream_least_time_peer_data_t *lp, ngx_peer_connection_t *pc)
+{
+    off_t                           bytes;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    bytes = pc->connection->sent + lp->session->upstream->received;
+
+    if (bytes < lp->bytes) {
+        /* the next upstream */
+        lp->bytes = 0;
+    }
+
+    peer = lp->rrp.current;
+
+    ngx_stream_upstream_rr_peers_rlock(lp->rrp.peers);
+    ngx_stream_upstream_rr_peer_lock(lp->rrp.peers, peer);
+
+    ngx_stream_upstream_least_time_update_rate(peer, bytes - lp->bytes,
+                                               ngx_current_msec);
+
+    ngx_stream_upstream_rr_peer_unlock(lp->rrp.peers, peer);
+    ngx_stream_upstream_rr_peers_unlock(lp->rrp.peers);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "least bytes report: %O, %O, rate: %ui",
+                   bytes - lp->bytes, bytes, peer->rate);
+
+    lp->bytes = bytes;
+    lp->reported = ngx_current_msec;
+}
+
+
+static uint64_t
+ngx_stream_upstream_least_time_score(
+    ngx_stream_upstream_least_time_srv_conf_t *ltcf,
+    ngx_stream_upstream_rr_peer_t *peer, ngx_msec_t now)
+{
+    uint64_t  metric;
+
+    if (ltcf->method == NGX_STREAM_UPSTREAM_LEAST_BYTES) {
+        ngx_stream_upstream_least_time_update_rate(peer, 0, now);
+
+        /* in kilobytes per second to keep the product in range */
+
+        metric = peer->rate / 1024;
+
+    } else {
+        metric = peer->connect_time;
+    }
+
+    /*
+     * connections which have not yet contributed to the average are
+     * taken into account, so a burst of new sessions is not sent to
+     * a single peer
+     */
+
+    return (metric + 1) * (peer->conns + 1);
+}
+
+
+static void
+ngx_stream_upstream_least_time_update_rate(ngx_stream_upstream_rr_peer_t *peer,
+    off_t bytes, ngx_msec_t now)
+{
+    ngx_msec_t  elapsed;
+
+    peer->rate_bytes += bytes;
+
+    elapsed = now - peer->rate_start;
+
+    if (elapsed < NGX_STREAM_UPSTREAM_RATE_INTERVAL) {
+        return;
+    }
+
+    /* exponentially weighted average with the factor of 1/4 */
+
+    peer->rate = (peer->rate * 3
+                  + (ngx_uint_t) (peer->rate_bytes * 1000 / elapsed)) / 4;
+
+    peer->rate_bytes = 0;
+    peer->rate_start = now;
+}
+
+
+static void *
+ngx_stream_upstream_least_time_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_least_time_srv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool,
+                      sizeof(ngx_stream_upstream_least_time_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->method = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_stream_upstream_least_time_srv_conf_t  *ltcf = conf;
+
+    ngx_str_t                       *value;
+    ngx_stream_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 1) {
+        ltcf->method = NGX_STREAM_UPSTREAM_LEAST_BYTES;
+
+    } else if (ngx_strcmp(value[1].data, "connect") == 0) {
+        ltcf->method = NGX_STREAM_UPSTREAM_LEAST_CONNECT;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    uscf->peer.init_upstream = ngx_stream_upstream_init_least_time;
+
+    uscf->flags = NGX_STREAM_UPSTREAM_CREATE
+                  |NGX_STREAM_UPSTREAM_WEIGHT
+                  |NGX_STREAM_UPSTREAM_MAX_CONNS
+                  |NGX_STREAM_UPSTREAM_MAX_FAILS
+                  |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_STREAM_UPSTREAM_DOWN
+                  |NGX_STREAM_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
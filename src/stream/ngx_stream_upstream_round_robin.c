@@ -16,8 +16,6 @@
 
 static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_peer(
     ngx_stream_upstream_rr_peer_data_t *rrp);
-static void ngx_stream_upstream_notify_round_robin_peer(
-    ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
 
 #if (NGX_STREAM_SSL)
 
@@ -662,7 +660,7 @@ ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
-static void
+void
 ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t type)
 {
@@ -43,6 +43,11 @@ struct ngx_stream_upstream_rr_peer_s {
     void                            *ssl_session;
     int                              ssl_session_len;
 
+    ngx_msec_t                       connect_time;
+    ngx_uint_t                       rate;
+    off_t                            rate_bytes;
+    ngx_msec_t                       rate_start;
+
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_atomic_t                     lock;
 #endif
@@ -141,6 +146,8 @@ ngx_int_t ngx_stream_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_stream_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+void ngx_stream_upstream_notify_round_robin_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t type);
 
 
 #endif /* _NGX_STREAM_UPSTREAM_ROUND_ROBIN_H_INCLUDED_ */